@@ -111,6 +111,7 @@ static int ring_dbl_and_wait_for_period(struct case_data *priv,
 
 	ret = ioctl(ndev->fd, NT_IOCTL_IOPS, &iops);
 	if (ret < 0) {
+		ret = -errno;
 		pr_err("ERR-%d: do iops!\n", ret);
 		return ret;
 	}
@@ -193,3 +194,98 @@ del_queue:
 	return ret;
 }
 NVME_CASE_SYMBOL(case_perf_write_iops, "?");
+
+#define TEST_MQ_PAIRS		4
+#define TEST_MQ_DEPTH		128
+#define TEST_MQ_RANGE		SZ_64M
+
+/**
+ * @brief Drive multiple queue pairs by the in-kernel IOPS engine, 4KiB
+ *  random read and write mixed.
+ */
+static int case_perf_mq_iops(struct nvme_tool *tool, struct case_data *priv)
+{
+	struct nvme_dev_info *ndev = tool->ndev;
+	struct nvme_ns_group *ns_grp = ndev->ns_grp;
+	struct nvme_sq_info sqs[TEST_MQ_PAIRS];
+	struct nvme_sq_info *sq;
+	struct nvme_cq_info *cq;
+	struct nt_iops_mq *iops;
+	uint16_t nr_pair = min_t(uint16_t, TEST_MQ_PAIRS,
+		min(ndev->ctrl->nr_sq, ndev->ctrl->nr_cq));
+	uint32_t lbads;
+	uint64_t nsze;
+	int ret, i;
+
+	iops = calloc(1, sizeof(*iops) + sizeof(struct nt_iops_job) * nr_pair);
+	if (!iops) {
+		pr_err("failed to alloc memory!\n");
+		return -ENOMEM;
+	}
+
+	iops->nsid = le32_to_cpu(ns_grp->act_list[0]);
+	ret = nvme_id_ns_lbads(ns_grp, iops->nsid, &lbads);
+	ret |= nvme_id_ns_nsze(ns_grp, iops->nsid, &nsze);
+	if (ret < 0)
+		goto out;
+
+	iops->lba_size = lbads;
+	iops->nlb = TEST_RW_SIZE / lbads;
+	iops->slba = 0;
+	/* random write, so limit the range rather than wipe whole namespace */
+	iops->nr_lba = min_t(uint64_t, nsze, TEST_MQ_RANGE / lbads);
+	iops->qdepth = TEST_MQ_DEPTH;
+	iops->rw = NT_IOPS_MIX;
+	iops->rwmix = 70;
+	iops->random = 1;
+	iops->time = 2000;
+	iops->nr_job = nr_pair;
+
+	for (i = 0; i < nr_pair; i++) {
+		/* bind SQ to CQ with the same ID without changing ndev->iosqs */
+		sq = &sqs[i];
+		*sq = ndev->iosqs[i];
+		sq->cqid = sq->sqid;
+		cq = nvme_find_iocq_info(ndev, sq->cqid);
+		if (!cq) {
+			ret = -ENOENT;
+			goto del_queue;
+		}
+		sq->nr_entry = TEST_MQ_DEPTH + 1;
+		cq->nr_entry = TEST_MQ_DEPTH + 1;
+
+		ret = ut_create_pair_io_queue(priv, sq, cq);
+		if (ret < 0)
+			goto del_queue;
+
+		iops->job[i].sqid = sq->sqid;
+		iops->job[i].cqid = sq->cqid;
+		iops->job[i].cpu = -1;
+	}
+
+	ret = ioctl(ndev->fd, NT_IOCTL_IOPS_MQ, iops);
+	if (ret < 0) {
+		ret = -errno;
+		pr_err("ERR-%d: do iops!\n", ret);
+		goto del_queue;
+	}
+
+	for (i = 0; i < nr_pair; i++) {
+		pr_info("SQ%u: %llu ios, %u errors, lat(ns) min:%llu "
+			"avg:%llu max:%llu\n", iops->job[i].sqid,
+			(unsigned long long)iops->job[i].ios, iops->job[i].errors,
+			(unsigned long long)iops->job[i].lat_min,
+			(unsigned long long)iops->job[i].lat_avg,
+			(unsigned long long)iops->job[i].lat_max);
+	}
+	pr_info("Perf: %llu IOPS, %llu KiB/s\n",
+		(unsigned long long)iops->iops, (unsigned long long)iops->bw);
+
+del_queue:
+	for (i--; i >= 0; i--)
+		ret |= ut_delete_pair_io_queue(priv, &sqs[i], NULL);
+out:
+	free(iops);
+	return ret;
+}
+NVME_CASE_SYMBOL(case_perf_mq_iops, "?");
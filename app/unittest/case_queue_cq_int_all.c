@@ -445,6 +445,7 @@ static int sub_case_int_n_queue(void)
 	struct nvme_ctrl_instance *ctrl = ndev->ctrl;
 	struct nvme_ns_group *ns_grp = ndev->ns_grp;
 	struct nvme_sq_info *sqs = ndev->iosqs;
+	struct irq_ring_snap snap;
 	uint32_t index = 0;
 	enum nvme_irq_type type;
 	uint64_t nsze;
@@ -482,6 +483,7 @@ static int sub_case_int_n_queue(void)
 			}
 		}
 	}
+	irq_ring_snap_start(ndev, &snap, sqs, queue_num);
 	for (uint16_t i = 0; i < queue_num; i++)
 	{
 		io_sq_id = sqs[i].sqid;
@@ -494,6 +496,7 @@ static int sub_case_int_n_queue(void)
 		test_flag |= cq_gain(io_cq_id, sqs[i].cmd_cnt, &reap_num);
 		DBG_ON(test_flag < 0);
 	}
+	irq_ring_snap_stop(&snap);
 
 	nvme_delete_all_ioq(ndev);
 	return test_flag;
@@ -506,6 +509,7 @@ static int sub_case_multi_cq_map_one_int_vct(void)
 	struct nvme_ctrl_instance *ctrl = ndev->ctrl;
 	struct nvme_ns_group *ns_grp = ndev->ns_grp;
 	struct nvme_sq_info *sqs = ndev->iosqs;
+	struct irq_ring_snap snap;
 	uint32_t index = 0;
 	enum nvme_irq_type type;
 	uint64_t nsze;
@@ -543,6 +547,7 @@ static int sub_case_multi_cq_map_one_int_vct(void)
 			}
 		}
 	}
+	irq_ring_snap_start(ndev, &snap, sqs, queue_num);
 	for (uint16_t i = 0; i < queue_num; i++)
 	{
 		io_sq_id = sqs[i].sqid;
@@ -555,6 +560,7 @@ static int sub_case_multi_cq_map_one_int_vct(void)
 		test_flag |= cq_gain(io_cq_id, sqs[i].cmd_cnt, &reap_num);
 		DBG_ON(test_flag < 0);
 	}
+	irq_ring_snap_stop(&snap);
 
 	nvme_delete_all_ioq(ndev);
 	return test_flag;
@@ -73,6 +73,7 @@ static int sub_case_int_queue_mask(void)
 	struct nvme_ctrl_instance *ctrl = ndev->ctrl;
 	struct nvme_ns_group *ns_grp = ndev->ns_grp;
 	struct nvme_sq_info *sqs = ndev->iosqs;
+	struct irq_ring_snap snap;
 	enum nvme_irq_type type;
 	uint64_t nsze;
 	uint16_t i;
@@ -111,6 +112,7 @@ static int sub_case_int_queue_mask(void)
 			}
 		}
 	}
+	irq_ring_snap_start(ndev, &snap, sqs, queue_num);
 	for (i = 0; i < queue_num; i++)
 	{
 		io_sq_id = sqs[i].sqid;
@@ -127,6 +129,7 @@ static int sub_case_int_queue_mask(void)
 		test_flag |= cq_gain(io_cq_id, sqs[i].cmd_cnt, &reap_num);
 		DBG_ON(test_flag < 0);
 	}
+	irq_ring_snap_stop(&snap);
 	nvme_delete_all_ioq(ndev);
 	return test_flag;
 }
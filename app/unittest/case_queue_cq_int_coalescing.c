@@ -109,6 +109,7 @@ static int sub_case_cq_int_coalescing(void)
 	struct nvme_ctrl_instance *ctrl = ndev->ctrl;
 	struct nvme_ns_group *ns_grp = ndev->ns_grp;
 	struct nvme_sq_info *sqs = ndev->iosqs;
+	struct irq_ring_snap snap;
 	enum nvme_irq_type type;
 	int ret;
 	uint64_t nsze;
@@ -169,6 +170,7 @@ static int sub_case_cq_int_coalescing(void)
 			}
 		}
 	}
+	irq_ring_snap_start(ndev, &snap, sqs, queue_num);
 	for (i = 0; i < queue_num; i++)
 	{
 		test_flag |= nvme_ring_sq_doorbell(ndev->fd, sqs[i].sqid);
@@ -181,6 +183,7 @@ static int sub_case_cq_int_coalescing(void)
 		test_flag |= cq_gain_disp_cq(sqs[i].cqid, sqs[i].cmd_cnt, &reap_num, false);
 		DBG_ON(test_flag < 0);
 	}
+	irq_ring_snap_stop(&snap);
 
 	nvme_delete_all_ioq(ndev);
 	return test_flag;
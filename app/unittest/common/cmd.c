@@ -181,24 +181,18 @@ static int ut_deal_io_read_cmd(struct case_data *priv, struct nvme_sq_info *sq,
 	return ret;
 }
 
-static int ut_deal_io_write_cmd(struct case_data *priv, struct nvme_sq_info *sq,
-	uint64_t slba, uint32_t nlb, uint32_t flag)
+static int ut_fill_io_write_wrap(struct case_data *priv, 
+	struct nvme_sq_info *sq, uint64_t slba, uint32_t nlb, uint32_t flag,
+	struct nvme_rwc_wrapper *wrap)
 {
 	struct nvme_tool *tool = priv->tool;
 	struct nvme_dev_info *ndev = tool->ndev;
-	struct case_report *rpt = &priv->rpt;
 	struct case_config_effect *effect = priv->cfg.effect;
-	struct nvme_rwc_wrapper wrap = {0};
 	void *buf;
 	uint32_t buf_size;
 	uint32_t blk_size;
 	int ret;
 
-	ut_rpt_record_case_step(rpt, 
-		"%s a I/O write cmd(SLBA:0x%lx, NLB:%u) => NSID: 0x%x, SQ: %u",
-		ut_cmd_flag_option_name(flag), 
-		slba, nlb, effect->nsid, sq->sqid);
-
 	ret = nvme_id_ns_lbads(ndev->ns_grp, effect->nsid, &blk_size);
 	if (ret < 0)
 		return ret;
@@ -211,26 +205,47 @@ static int ut_deal_io_write_cmd(struct case_data *priv, struct nvme_sq_info *sq,
 		buf_size = tool->wbuf_size;
 	}
 
-	wrap.sqid = sq->sqid;
-	wrap.cqid = sq->cqid;
-	wrap.flags = effect->cmd.write.flags;
+	wrap->sqid = sq->sqid;
+	wrap->cqid = sq->cqid;
+	wrap->flags = effect->cmd.write.flags;
 	if (effect->inject_nsid)
-		wrap.nsid = effect->inject.nsid;
+		wrap->nsid = effect->inject.nsid;
 	else
-		wrap.nsid = effect->nsid;
+		wrap->nsid = effect->nsid;
+
+	wrap->slba = slba;
+	wrap->nlb = nlb;
+	wrap->control = effect->cmd.read.control;
+	wrap->buf = buf;
+	wrap->size = nlb * blk_size;
+	wrap->control = effect->cmd.write.dtype << 4;
+	wrap->dspec = effect->cmd.write.dspec;
+	wrap->check_none = effect->check_none;
+
+	BUG_ON(wrap->size > buf_size);
+	if (flag & UT_CMD_F_DATA_RANDOM)
+		fill_data_with_random(wrap->buf, wrap->size);
 
-	wrap.slba = slba;
-	wrap.nlb = nlb;
-	wrap.control = effect->cmd.read.control;
-	wrap.buf = buf;
-	wrap.size = nlb * blk_size;
-	wrap.control = effect->cmd.write.dtype << 4;
-	wrap.dspec = effect->cmd.write.dspec;
-	wrap.check_none = effect->check_none;
+	return 0;
+}
 
-	BUG_ON(wrap.size > buf_size);
-	if (flag & UT_CMD_F_DATA_RANDOM)
-		fill_data_with_random(wrap.buf, wrap.size);
+static int ut_deal_io_write_cmd(struct case_data *priv, struct nvme_sq_info *sq,
+	uint64_t slba, uint32_t nlb, uint32_t flag)
+{
+	struct nvme_dev_info *ndev = priv->tool->ndev;
+	struct case_report *rpt = &priv->rpt;
+	struct case_config_effect *effect = priv->cfg.effect;
+	struct nvme_rwc_wrapper wrap = {0};
+	int ret;
+
+	ut_rpt_record_case_step(rpt, 
+		"%s a I/O write cmd(SLBA:0x%lx, NLB:%u) => NSID: 0x%x, SQ: %u",
+		ut_cmd_flag_option_name(flag), 
+		slba, nlb, effect->nsid, sq->sqid);
+
+	ret = ut_fill_io_write_wrap(priv, sq, slba, nlb, flag, &wrap);
+	if (ret < 0)
+		return ret;
 
 	switch (flag & UT_CMD_F_OPTION_MASK) {
 	case UT_CMD_F_OPTION_SUBMIT:
@@ -578,15 +593,28 @@ int ut_submit_io_write_cmd(struct case_data *priv, struct nvme_sq_info *sq,
 int ut_submit_io_write_cmds(struct case_data *priv, struct nvme_sq_info *sq,
 	uint64_t slba, uint32_t nlb, int nr_cmd)
 {
+	struct nvme_dev_info *ndev = priv->tool->ndev;
+	struct case_report *rpt = &priv->rpt;
+	struct case_config_effect *effect = priv->cfg.effect;
+	struct nvme_rwc_wrapper wrap = {0};
 	int ret;
 
-	for (; nr_cmd > 0; nr_cmd--) {
-		ret = ut_submit_io_write_cmd(priv, sq, slba, nlb);
-		if (ret < 0)
-			return ret;
-	}
+	if (nr_cmd <= 0)
+		return 0;
 
-	return 0;
+	ut_rpt_record_case_step(rpt, 
+		"Submit %d I/O write cmds(SLBA:0x%lx, NLB:%u) => NSID: 0x%x, SQ: %u",
+		nr_cmd, slba, nlb, effect->nsid, sq->sqid);
+
+	ret = ut_fill_io_write_wrap(priv, sq, slba, nlb, 0, &wrap);
+	if (ret < 0)
+		return ret;
+
+	ret = nvme_cmd_io_write_batch(ndev->fd, &wrap, nr_cmd);
+	if (ret < 0)
+		return ret;
+
+	return (ret == nr_cmd) ? 0 : -EPERM;
 }
 
 /**
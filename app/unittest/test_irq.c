@@ -13,6 +13,7 @@
 #include <sys/ioctl.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libbase.h"
 #include "libnvme.h"
@@ -420,3 +421,77 @@ void test_irq_delete(int fd)
     while (nvme_inquiry_cq_entries(fd, 0) != num + 1)
         ;
 }
+
+/**
+ * @brief Map the irq rings of CQs bound to @sqs and save their head before
+ *  the workload starts.
+ */
+void irq_ring_snap_start(struct nvme_dev_info *ndev, struct irq_ring_snap *snap,
+	struct nvme_sq_info *sqs, uint16_t nr_sq)
+{
+	struct nvme_cq_info *cq;
+	uint16_t i;
+
+	memset(snap, 0, sizeof(*snap));
+
+	for (i = 0; i < nr_sq; i++) {
+		cq = nvme_find_iocq_info(ndev, sqs[i].cqid);
+		if (!cq || !cq->irq_en || cq->irq_no >= IRQ_RING_SNAP_MAX)
+			continue;
+		if (snap->ring[cq->irq_no])
+			continue;
+
+		snap->ring[cq->irq_no] = nvme_map_irq_ring(ndev->fd, cq->irq_no);
+		if (!snap->ring[cq->irq_no])
+			continue;
+		snap->head[cq->irq_no] = snap->ring[cq->irq_no]->head;
+		snap->nr_entry[cq->irq_no] = cq->nr_entry;
+	}
+}
+
+/*
+ * CQE per irq is the effectiveness of coalescing on the vector, it's derived
+ * from the head of CQ recorded by each irq event.
+ */
+static void disp_irq_ring_stat(uint16_t irq_no, struct irq_ring_snap *snap)
+{
+	struct nvme_irq_ring_stat stat;
+	uint64_t rate = 0;
+	double cqe_per_irq = 0;
+
+	if (nvme_irq_ring_stat(snap->ring[irq_no], snap->head[irq_no],
+		snap->nr_entry[irq_no], &stat) < 0 || !stat.nr_irq) {
+		pr_warn("IRQ%u: no irq recorded!\n", irq_no);
+		return;
+	}
+
+	if (stat.span_ns)
+		rate = (stat.nr_irq - 1) * 1000000000ULL / stat.span_ns;
+	if (stat.nr_irq > 1)
+		cqe_per_irq = (double)stat.nr_cqe / (stat.nr_irq - 1);
+
+	pr_info("IRQ%u: %llu irqs(%llu lost), %.2f CQE/irq, %llu irq/s, "
+		"gap(ns) min:%llu avg:%llu max:%llu\n", irq_no,
+		(unsigned long long)stat.nr_irq, (unsigned long long)stat.lost,
+		cqe_per_irq, (unsigned long long)rate,
+		(unsigned long long)stat.gap_min, (unsigned long long)stat.gap_avg,
+		(unsigned long long)stat.gap_max);
+}
+
+/**
+ * @brief Display the irq events recorded since irq_ring_snap_start(), then
+ *  unmap the rings.
+ */
+void irq_ring_snap_stop(struct irq_ring_snap *snap)
+{
+	uint16_t i;
+
+	for (i = 0; i < IRQ_RING_SNAP_MAX; i++) {
+		if (!snap->ring[i])
+			continue;
+
+		disp_irq_ring_stat(i, snap);
+		nvme_unmap_irq_ring(snap->ring[i]);
+		snap->ring[i] = NULL;
+	}
+}
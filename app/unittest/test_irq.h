@@ -25,4 +25,20 @@ void test_irq_delete(int fd);
 int irq_cr_contig_io_sq(int fd, int sq_id, int assoc_cq_id, uint16_t elems);
 int irq_cr_disc_io_sq(int fd, void *addr, int sq_id, int assoc_cq_id, uint16_t elems);
 
+#define IRQ_RING_SNAP_MAX	UINT8_MAX
+
+/**
+ * @brief Snapshot of irq rings of the vectors used by the CQs under test,
+ *  indexed by irq number.
+ */
+struct irq_ring_snap {
+	struct nvme_irq_ring	*ring[IRQ_RING_SNAP_MAX];
+	uint64_t		head[IRQ_RING_SNAP_MAX];
+	uint32_t		nr_entry[IRQ_RING_SNAP_MAX]; /* size of CQ */
+};
+
+void irq_ring_snap_start(struct nvme_dev_info *ndev, struct irq_ring_snap *snap,
+	struct nvme_sq_info *sqs, uint16_t nr_sq);
+void irq_ring_snap_stop(struct irq_ring_snap *snap);
+
 #endif
@@ -9,6 +9,305 @@
  * 
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include "libbase.h"
+#include "libnvme.h"
+#include "test.h"
 
+/*
+ * Only a window of PMR is mapped, which is small enough for any PMR.
+ * Stores wrap around in the window until the total size is reached.
+ */
+#define TEST_PMR_WINDOW		SZ_64K
+#define TEST_PMR_STORE_TOTAL	SZ_64M
+#define TEST_PMR_UNIT		64 /* a cache line */
+#define TEST_PMR_LOOP		1000
+
+/* PMRCAP.PMRWBM */
+#define TEST_PMRWBM_PMR_READ	BIT(0)
+#define TEST_PMRWBM_PMRSTS_READ	BIT(1)
+
+struct test_data {
+	int		fd;
+	uint32_t	pmrwbm;
+	void		*backup; /* PMR window saved before stores */
+	uint32_t	offset[TEST_PMR_LOOP]; /* random offset in window */
+	uint8_t		unit[TEST_PMR_UNIT];
+};
+
+static struct test_data g_test = {0};
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t calc_mib_per_sec(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes * 1000000000ULL / ns / SZ_1M : 0;
+}
+
+static int init_test_data(struct nvme_dev_info *ndev, struct test_data *data)
+{
+	uint32_t pmrcap;
+	uint32_t i;
+	int ret;
+
+	if (!NVME_CAP_PMRS(ndev->ctrl->prop->cap)) {
+		pr_warn("Not support persistent memory region!\n");
+		return -EOPNOTSUPP;
+	}
+
+	ret = nvme_read_ctrl_pmrcap(ndev->fd, &pmrcap);
+	if (ret < 0)
+		return ret;
+
+	data->fd = ndev->fd;
+	data->pmrwbm = NVME_PMRCAP_PMRWBM(pmrcap);
+	pr_info("PMRCAP: 0x%x, PMRWBM: 0x%x\n", pmrcap, data->pmrwbm);
+
+	for (i = 0; i < TEST_PMR_LOOP; i++)
+		data->offset[i] = rand() % (TEST_PMR_WINDOW / TEST_PMR_UNIT) *
+			TEST_PMR_UNIT;
+
+	fill_data_with_random(data->unit, TEST_PMR_UNIT);
+	return 0;
+}
+
+/**
+ * @brief Make the stores to PMR persistent.
+ *
+ * @note Stores are drained from write-combining buffers first, then read
+ *  back by the write barrier mechanism which PMRCAP.PMRWBM indicates. The
+ *  read of PMRSTS goes through ioctl, so the cost of syscall is included.
+ */
+static int persist_pmr(struct test_data *data, void *pmr)
+{
+	uint32_t pmrsts;
+
+	__sync_synchronize();
+
+	if (data->pmrwbm & TEST_PMRWBM_PMR_READ) {
+		(void)*(volatile uint32_t *)pmr;
+		return 0;
+	}
+	if (data->pmrwbm & TEST_PMRWBM_PMRSTS_READ)
+		return nvme_read_ctrl_pmrsts(data->fd, &pmrsts);
+
+	return 0;
+}
+
+static int store_pmr(struct test_data *data, bool random)
+{
+	void *pmr;
+	uint64_t start, end;
+	uint64_t total;
+	uint32_t oft = 0;
+	uint32_t i = 0;
+	int ret;
+
+	pmr = nvme_map_pmr(data->fd, TEST_PMR_WINDOW, true);
+	if (!pmr)
+		return -EPERM;
+
+	start = get_time_ns();
+	for (total = 0; total < TEST_PMR_STORE_TOTAL; total += TEST_PMR_UNIT) {
+		if (random) {
+			oft = data->offset[i++];
+			if (i == TEST_PMR_LOOP)
+				i = 0;
+		} else {
+			oft = total % TEST_PMR_WINDOW;
+		}
+		memcpy(pmr + oft, data->unit, TEST_PMR_UNIT);
+	}
+	ret = persist_pmr(data, pmr);
+	end = get_time_ns();
+	if (ret < 0)
+		goto out;
+
+	pr_info("%s store: %llu MiB/s\n", random ? "Random" : "Sequential",
+		(unsigned long long)calc_mib_per_sec(total, end - start));
+out:
+	nvme_unmap_pmr(pmr, TEST_PMR_WINDOW);
+	return ret;
+}
+
+static int subcase_pmr_seq_store(void)
+{
+	int ret;
+
+	ret = store_pmr(&g_test, false);
+	nvme_record_subcase_result(__func__, ret);
+	return ret;
+}
+
+static int subcase_pmr_rand_store(void)
+{
+	int ret;
+
+	ret = store_pmr(&g_test, true);
+	nvme_record_subcase_result(__func__, ret);
+	return ret;
+}
+
+/**
+ * @brief Measure the latency of making a cache line persistent, which is
+ *  stored to PMR right before.
+ */
+static int subcase_pmr_persist(void)
+{
+	struct test_data *data = &g_test;
+	void *pmr;
+	uint64_t start, lat;
+	uint64_t min = UINT64_MAX, max = 0, sum = 0;
+	uint32_t i;
+	int ret = 0;
+
+	pmr = nvme_map_pmr(data->fd, TEST_PMR_WINDOW, true);
+	if (!pmr) {
+		ret = -EPERM;
+		goto out;
+	}
+
+	for (i = 0; i < TEST_PMR_LOOP; i++) {
+		memcpy(pmr + data->offset[i], data->unit, TEST_PMR_UNIT);
+
+		start = get_time_ns();
+		ret = persist_pmr(data, pmr);
+		lat = get_time_ns() - start;
+		if (ret < 0)
+			goto unmap;
+
+		min = min(min, lat);
+		max = max(max, lat);
+		sum += lat;
+	}
+
+	pr_info("Persist(PMRWBM:0x%x) lat(ns) min:%llu avg:%llu max:%llu\n",
+		data->pmrwbm, (unsigned long long)min,
+		(unsigned long long)(sum / TEST_PMR_LOOP),
+		(unsigned long long)max);
+unmap:
+	nvme_unmap_pmr(pmr, TEST_PMR_WINDOW);
+out:
+	nvme_record_subcase_result(__func__, ret);
+	return ret;
+}
+
+/**
+ * @brief Measure the latency of loads from PMR, which is mapped uncached
+ *  so that every load reaches the controller.
+ */
+static int subcase_pmr_load(void)
+{
+	struct test_data *data = &g_test;
+	void *pmr;
+	uint64_t start, end;
+	uint32_t i;
+	int ret = 0;
+
+	pmr = nvme_map_pmr(data->fd, TEST_PMR_WINDOW, false);
+	if (!pmr) {
+		ret = -EPERM;
+		goto out;
+	}
+
+	start = get_time_ns();
+	for (i = 0; i < TEST_PMR_LOOP; i++)
+		(void)*(volatile uint32_t *)(pmr + data->offset[i]);
+	end = get_time_ns();
+
+	pr_info("Random load lat(ns) avg:%llu\n",
+		(unsigned long long)((end - start) / TEST_PMR_LOOP));
+
+	nvme_unmap_pmr(pmr, TEST_PMR_WINDOW);
+out:
+	nvme_record_subcase_result(__func__, ret);
+	return ret;
+}
+
+/**
+ * @brief Save the window of PMR which is going to be overwritten.
+ */
+static int save_pmr_window(struct test_data *data)
+{
+	void *pmr;
+
+	data->backup = malloc(TEST_PMR_WINDOW);
+	if (!data->backup) {
+		pr_err("failed to alloc backup buffer!\n");
+		return -ENOMEM;
+	}
+
+	pmr = nvme_map_pmr(data->fd, TEST_PMR_WINDOW, false);
+	if (!pmr) {
+		free(data->backup);
+		data->backup = NULL;
+		return -EPERM;
+	}
+	memcpy(data->backup, pmr, TEST_PMR_WINDOW);
+	nvme_unmap_pmr(pmr, TEST_PMR_WINDOW);
+	return 0;
+}
+
+static int restore_pmr_window(struct test_data *data)
+{
+	void *pmr;
+	int ret;
+
+	pmr = nvme_map_pmr(data->fd, TEST_PMR_WINDOW, true);
+	if (!pmr) {
+		pr_err("failed to restore PMR, data in PMR is lost!\n");
+		ret = -EPERM;
+		goto out;
+	}
+	memcpy(pmr, data->backup, TEST_PMR_WINDOW);
+	ret = persist_pmr(data, pmr);
+	nvme_unmap_pmr(pmr, TEST_PMR_WINDOW);
+out:
+	free(data->backup);
+	data->backup = NULL;
+	return ret;
+}
+
+/**
+ * @brief Benchmark PMR, the write-combining view and uncached view are
+ *  mapped one at a time.
+ *
+ * @note The window of PMR which is overwritten is saved before and restored
+ *  after the test.
+ */
+static int case_pmr_benchmark(struct nvme_tool *tool, struct case_data *priv)
+{
+	struct nvme_dev_info *ndev = tool->ndev;
+	int ret;
+
+	ret = init_test_data(ndev, &g_test);
+	if (ret < 0)
+		return ret;
+
+	ret = save_pmr_window(&g_test);
+	if (ret < 0)
+		return ret;
+
+	ret |= subcase_pmr_seq_store();
+	ret |= subcase_pmr_rand_store();
+	ret |= subcase_pmr_persist();
+	ret |= subcase_pmr_load();
+
+	ret |= restore_pmr_window(&g_test);
+
+	nvme_display_subcase_report();
+	return ret;
+}
+NVME_CASE_SYMBOL(case_pmr_benchmark,
+	"Measure store bandwidth, load and persist latency of PMR");
@@ -34,9 +34,17 @@
 #define NVME_VMPGOFF_TYPE_CQ		0
 #define NVME_VMPGOFF_TYPE_SQ		1
 #define NVME_VMPGOFF_TYPE_META		2
+#define NVME_VMPGOFF_TYPE_DB		3 /* doorbell registers, identify is I/O qid */
+#define NVME_VMPGOFF_TYPE_CMB_SQ	4 /* SQ in CMB, mapped write-combining */
+#define NVME_VMPGOFF_TYPE_PMR		5 /* PMR, identify selects memory type */
+#define NVME_VMPGOFF_TYPE_IRQ_RING	6 /* irq event ring, identify is irq_id */
 /* bit[15:0] Identify */
 #define NVME_VMPGOFF_ID(n)		((n) & 0xffff)
 
+/* Identify of NVME_VMPGOFF_TYPE_PMR */
+#define NVME_PMR_MAP_WC			0 /* write-combining, for stores */
+#define NVME_PMR_MAP_UC			1 /* uncached, for loads */
+
 enum {
 	NVME_READ_GENERIC = 0,
 	NVME_WRITE_GENERIC,
@@ -69,10 +77,26 @@ enum {
 
 	NVME_ALLOC_HMB,
 	NVME_RELEASE_HMB,
+
+	NVME_SUBMIT_64B_CMD_BATCH,
+	NVME_SET_QUEUE_OWNER,
+
+	NVME_REGISTER_BUFFER,
+	NVME_UNREGISTER_BUFFER,
+
+	NVME_REAP_CQE_WAIT,
+
+	NVME_LAT_STAT,
+	NVME_URING_SUBMIT_64B_CMD,
+	NVME_SET_POLL_CQ,
+	NVME_SET_IRQ_EVENTFD,
+	NVME_SET_DBBUF,
+	NVME_SET_IRQ_AFFINITY,
 };
 
 enum {
 	NVME_TEST_IOPS = 0,
+	NVME_TEST_IOPS_MQ,
 };
 
 enum nvme_region {
@@ -192,11 +216,31 @@ struct nvme_prep_sq {
 
 	uint32_t 	contig:1; /* Indicates if SQ is contig or not, 1 = contig */
 	uint32_t	use_cmb:1;
+	uint32_t	use_node:1; /* allocate on @numa_node, not node of device */
+
+	uint16_t	numa_node;
+};
+
+/**
+ * @brief The way to wait for CQ entries when reaping.
+ *
+ * @NVME_CQ_POLL_DEFAULT: Sleep until irq fires, or poll in short interval if
+ *  irq is disabled.
+ * @NVME_CQ_POLL_BUSY: Spin on the phase tag all the time.
+ * @NVME_CQ_POLL_HYBRID: Sleep for about half of the average completion
+ *  latency of the CQ, then spin on the phase tag.
+ */
+enum nvme_cq_poll_mode {
+	NVME_CQ_POLL_DEFAULT = 0,
+	NVME_CQ_POLL_BUSY,
+	NVME_CQ_POLL_HYBRID,
 };
 
 /**
  * Interface structure for allocating CQ memory. The elements are 1 based
  * values and the CC.IOSQES is 2^n based.
+ *
+ * @poll_mode: see enum nvme_cq_poll_mode for details
  */
 struct nvme_prep_cq {
 	uint32_t	elements; /* Total number of entries that need kernal mem */
@@ -206,6 +250,10 @@ struct nvme_prep_cq {
 
 	uint32_t 	contig:1; /* Indicates if SQ is contig or not, 1 = contig */
 	uint32_t	use_cmb:1;
+	uint32_t	use_node:1; /* allocate on @numa_node, not node of device */
+
+	uint8_t		poll_mode;
+	uint16_t	numa_node;
 };
 
 struct nvme_sgl_bit_bucket {
@@ -219,6 +267,10 @@ struct nvme_sgl_bit_bucket {
  *
  * @sqid: Queue ID where the cmd_buf command should go
  * @cid: Command Identifier assigned by driver
+ * @use_reg_buf: Data buffer is a range of the buffer registered by
+ *  NVME_IOCTL_REGISTER_BUFFER, @data_buf_ptr is ignored.
+ * @buf_id: Registered buffer identify, only valid if @use_reg_buf is set
+ * @buf_oft: Offset in registered buffer, only valid if @use_reg_buf is set
  */
 struct nvme_64b_cmd {
 	uint16_t	sqid;
@@ -236,9 +288,56 @@ struct nvme_64b_cmd {
 	uint32_t	meta_id;   /* Meta buffer ID when NVME_MASK_MPTR is set */
 
 	uint32_t	use_bit_bucket:1;
+	uint32_t	use_reg_buf:1;
 
 	uint32_t			nr_bit_bucket;
 	struct nvme_sgl_bit_bucket	*bit_bucket;
+
+	uint32_t	buf_id;
+	uint32_t	buf_oft;
+};
+
+/**
+ * @brief Submit a batch of commands to the same SQ
+ *
+ * @sqid: Queue ID where all commands should go, the @sqid of each command
+ *  in @cmds is ignored.
+ * @nr_cmd: The number of commands in @cmds
+ * @submitted: The number of commands submitted successfully
+ * @ring_db: Ring SQ doorbell after all commands are submitted
+ * @cmds: Command array, the assigned command identifier is saved in @cid of
+ *  each command.
+ * @status: Optional. Save the result of each command, 0 on success or a
+ *  negative errno.
+ */
+struct nvme_64b_cmd_batch {
+	uint16_t	sqid;
+	uint32_t	nr_cmd;
+	uint32_t	submitted;
+
+	uint32_t	ring_db:1;
+
+	struct nvme_64b_cmd	*cmds;
+	int32_t			*status;
+};
+
+/**
+ * @brief Submit a command by io_uring passthrough, it's placed in the command
+ *  area of SQE and @sqe->cmd_op shall be NVME_URING_CMD_SUBMIT_64B.
+ *
+ * @cmd: See NVME_IOCTL_SUBMIT_64B_CMD for details. If IORING_URING_CMD_FIXED
+ *  is set in @sqe->uring_cmd_flags, @cmd->data_buf_ptr is the address in the
+ *  fixed buffer selected by @sqe->buf_index.
+ * @ring_db: Ring SQ doorbell after the command is submitted
+ *
+ * @note The status field of CQ entry is returned in @cqe->res, and the
+ *  command specific result is returned in @cqe->big_cqe[0] if the ring is
+ *  setup with IORING_SETUP_CQE32. Admin commands are not supported. If the
+ *  CQ has no interrupt, the ring shall be setup with IORING_SETUP_IOPOLL.
+ */
+struct nvme_uring_cmd {
+	struct nvme_64b_cmd	*cmd;
+	uint8_t		ring_db;
 };
 
 struct nvme_prp_list {
@@ -305,6 +404,77 @@ struct nvme_inquiry {
 struct nvme_interrupt {
 	uint16_t		num_irqs; /* total no. of irqs req by tnvme */
 	enum nvme_irq_type	irq_type; /* Active IRQ scheme for this dev */
+	/* R: effective CPU of each irq, -1 if unknown. optional, may be NULL */
+	int32_t __user		*eff_cpu;
+};
+
+#define NVME_IRQ_CPUMASK_SIZE		32 /* in dwords, up to 1024 CPUs */
+
+/**
+ * @brief Pin the irq to CPUs.
+ *
+ * @irq_id: Interrupt vector identify
+ * @cpumask: CPUs which the irq is pinned to, bit n of dword m is CPU
+ *  (32 * m + n). If no CPU is set, the affinity is left unchanged.
+ * @eff_mask: Effective affinity of the irq, returned by driver
+ *
+ * @note MSI-X vectors are spread over CPUs when they are allocated, pinning
+ *  overrides it until the irq scheme is changed.
+ */
+struct nvme_irq_affinity {
+	uint16_t	irq_id;
+	uint32_t	cpumask[NVME_IRQ_CPUMASK_SIZE];
+	uint32_t	eff_mask[NVME_IRQ_CPUMASK_SIZE];
+};
+
+/**
+ * @brief Bind an eventfd to the irq, which is signaled every time the irq
+ *  is fired.
+ *
+ * @irq_id: Interrupt vector identify
+ * @fd: eventfd, or -1 to unbind the eventfd
+ *
+ * @note The binding is dropped when the irq scheme is changed.
+ */
+struct nvme_irq_eventfd {
+	uint16_t	irq_id;
+	int32_t		fd;
+};
+
+#define NVME_IRQ_RING_ENTRIES		1024 /* shall be power of 2 */
+
+#define NVME_IRQ_EVENT_NO_CQ		0xffff /* no CQ is bound to the irq */
+
+/**
+ * @brief Event recorded every time the irq fires.
+ *
+ * @ts: ktime in ns when ISR was entered, same clock as CLOCK_MONOTONIC
+ * @cqid: The first CQ bound to the irq, or NVME_IRQ_EVENT_NO_CQ
+ * @head: Head of @cqid when the irq fired. The head moves on by the entries
+ *  reaped since the previous event, which gives CQE per irq.
+ */
+struct nvme_irq_event {
+	uint64_t	ts;
+	uint16_t	cqid;
+	uint16_t	head;
+	uint32_t	rsvd;
+};
+
+/**
+ * @brief Ring of irq events, which is mapped read-only by
+ *  NVME_VMPGOFF_TYPE_IRQ_RING.
+ *
+ * @head: The number of events recorded, the latest one is located at
+ *  event[(head - 1) % NVME_IRQ_RING_ENTRIES].
+ *
+ * @note The ring is written by ISR without lock, and the oldest event is
+ *  overwritten once the ring is full. Read @head before the events, then
+ *  read it again to discard the events which may be overwritten meanwhile.
+ */
+struct nvme_irq_ring {
+	uint64_t	head;
+	uint64_t	rsvd;
+	struct nvme_irq_event	event[NVME_IRQ_RING_ENTRIES];
 };
 
 /**
@@ -320,6 +490,7 @@ struct nvme_cq_public {
 	uint16_t	irq_no; /* idx in list; always 0 based */
 	uint8_t		pbit_new_entry; /* Indicates if a new entry is in CQ */
 	uint8_t		cqes;
+	uint8_t		poll_mode; /* see enum nvme_cq_poll_mode */
 };
 
 /**
@@ -355,6 +526,109 @@ struct nvme_reap {
 	uint32_t	size;
 };
 
+/**
+ * @brief Transfer the ownership of I/O queue between driver and user.
+ *
+ * @qid: I/O queue identify, admin queue is always owned by driver.
+ * @type: NVME_SQ or NVME_CQ
+ * @user_own: 1 - user takes over the queue, driver reports the current
+ *  pointers in @head_ptr, @tail_ptr and @phase; 0 - user gives back the
+ *  queue, driver takes over the pointers passed in.
+ * @head_ptr: SQ head or CQ head
+ * @tail_ptr: SQ tail, it's ignored for CQ
+ * @phase: Phase tag expected for the next CQ entry, it's ignored for SQ
+ *
+ * @note While user owns the queue, driver refuses to submit commands to
+ *  the SQ or reap entries from the CQ. User shall ring the doorbell via
+ *  the region mapped by NVME_VMPGOFF_TYPE_DB, and unmap it before giving
+ *  back the queue. CQ can't be taken over while commands submitted by
+ *  driver to the SQs bound to it are in flight. Queues covered by shadow
+ *  doorbell buffers can't be owned by user, and shadow doorbell buffers
+ *  can't be set while any queue is owned by user.
+ */
+struct nvme_queue_owner {
+	uint16_t	qid;
+	enum nvme_queue_type	type;
+	uint8_t		user_own;
+	uint16_t	head_ptr;
+	uint16_t	tail_ptr;
+	uint8_t		phase;
+};
+
+/**
+ * @brief Wait for CQ entries and reap them
+ *
+ * @cqid: Completion Queue Identify
+ * @expect: The number of CQ entries expected to be reaped
+ * @timeout: Maximum time to wait for @expect entries, in milliseconds. If
+ *  timed out, reap the entries which are ready. Negative value waits
+ *  forever, which is rejected if the CQ is in busy or hybrid poll mode.
+ * @reaped: The number of CQ entries actually reaped
+ * @buf: The buffer holds CQ entries
+ * @size: buffer size
+ */
+struct nvme_reap_wait {
+	uint16_t	cqid;
+	uint32_t	expect;
+	int32_t		timeout;
+	uint32_t	reaped;
+	void		*buf;
+	uint32_t	size;
+};
+
+/**
+ * @brief Select the CQs watched by poll() of the device file, the previous
+ *  selection is replaced.
+ *
+ * @nr_cq: The number of CQ identifiers in @cqid, 0 to clear the selection
+ * @cqid: CQ identifier array
+ *
+ * @note The device file is readable (POLLIN) when any selected CQ has entries
+ *  waiting to be reaped. Only CQs with interrupt enabled wake up the waiter,
+ *  and the selection is dropped when the CQ is deleted.
+ */
+struct nvme_poll_cq {
+	uint16_t	nr_cq;
+	uint16_t	*cqid;
+};
+
+enum nvme_lat_stat_op {
+	NVME_LAT_STAT_GET = 0,
+	NVME_LAT_STAT_ENABLE,
+	NVME_LAT_STAT_DISABLE,
+	NVME_LAT_STAT_RESET,
+};
+
+/**
+ * @brief Latency statistics of the commands in SQ, which is measured from
+ *  ringing SQ doorbell to reaping CQ entry.
+ *
+ * @sqid: Submission Queue Identify
+ * @op: See "enum nvme_lat_stat_op" for details
+ * @count: The number of commands counted
+ * @min: unit: ns
+ * @max: unit: ns
+ * @avg: unit: ns
+ * @p50: 50th percentile, unit: ns
+ * @p99: 99th percentile, unit: ns
+ * @p999: 99.9th percentile, unit: ns
+ *
+ * @note Percentiles are the upper bound of the histogram bucket, the
+ *  relative error is less than 1/16.
+ */
+struct nvme_lat_stat {
+	uint16_t	sqid;
+	uint8_t		op;
+
+	uint64_t	count;
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	avg;
+	uint64_t	p50;
+	uint64_t	p99;
+	uint64_t	p999;
+};
+
 struct nvme_meta_create {
 	uint16_t	id;
 
@@ -364,6 +638,21 @@ struct nvme_meta_create {
 	uint8_t		contig;
 };
 
+/**
+ * @brief Register user buffer which is pinned and mapped for DMA once.
+ *
+ * @id: Buffer identify assigned by user
+ * @buf: User space address, shall be aligned to 4 bytes
+ * @size: Buffer size in bytes
+ * @dir: DMA direction of all commands that refer to this buffer
+ */
+struct nvme_buffer_reg {
+	uint32_t	id;
+	void		*buf;
+	uint32_t	size;
+	enum dma_data_direction	dir;
+};
+
 struct nvme_dev_public {
 	int		devno;
 	int		family;
@@ -376,6 +665,27 @@ struct nvme_hmb_alloc {
 	uint32_t	bsize[0];	/* buffer size, unit: PAGE_SIZE */
 };
 
+/**
+ * @brief Shadow doorbell and EventIdx buffers used by Doorbell Buffer Config
+ *  command.
+ *
+ * @enable: Allocate buffers if it's 1, otherwise release them.
+ * @nr_queue: The number of queue identifiers covered by buffers, admin queue
+ *  included. I/O queues beyond the range always ring doorbell registers.
+ * @dbs_addr: Physical address of shadow doorbell buffer, filled by driver.
+ * @eis_addr: Physical address of EventIdx buffer, filled by driver.
+ *
+ * @note PRP1 and PRP2 of Doorbell Buffer Config command are filled by driver,
+ *  doorbell registers are skipped after the command completes successfully
+ *  until controller is disabled. Don't use it with queues owned by user.
+ */
+struct nvme_dbbuf_cfg {
+	uint8_t		enable;
+	uint32_t	nr_queue;
+	uint64_t	dbs_addr;
+	uint64_t	eis_addr;
+};
+
 struct nt_iops {
 	uint16_t	sqid;
 	uint16_t	cqid;
@@ -383,6 +693,84 @@ struct nt_iops {
 	uint32_t	perf; /* kiops */
 };
 
+enum nt_iops_rw {
+	NT_IOPS_READ = 0,
+	NT_IOPS_WRITE,
+	NT_IOPS_MIX,
+};
+
+/**
+ * @brief A queue pair driven by a kernel thread of IOPS engine
+ *
+ * @sqid: I/O SQ to submit commands, it shall be bound to @cqid
+ * @cqid: I/O CQ to reap entries, it shall not be shared by other jobs
+ * @cpu: The CPU which the thread is bound to, negative means not bound
+ * @ios: The number of commands completed
+ * @errors: The number of commands completed with error status
+ * @lat_min: unit: ns
+ * @lat_max: unit: ns
+ * @lat_avg: unit: ns
+ */
+struct nt_iops_job {
+	uint16_t	sqid;
+	uint16_t	cqid;
+	int32_t		cpu;
+
+	uint64_t	ios;
+	uint32_t	errors;
+	uint64_t	lat_min;
+	uint64_t	lat_max;
+	uint64_t	lat_avg;
+};
+
+/**
+ * @brief In-kernel IOPS engine
+ *
+ * @nsid: Namespace identify
+ * @lba_size: LBA data size, unit: Byte
+ * @nlb: The number of logical blocks per command, 1's based
+ * @slba: The first LBA of the range to access
+ * @nr_lba: The number of LBAs in the range to access
+ * @qdepth: The number of commands in flight per queue pair
+ * @rw: See "enum nt_iops_rw" for details
+ * @rwmix: Percentage of read commands when @rw is NT_IOPS_MIX
+ * @random: Generate LBA randomly, otherwise sequentially
+ * @time: Test duration, unit: ms
+ *
+ * @ios: The number of commands completed by all jobs
+ * @errors: The number of commands completed with error status by all jobs
+ * @iops: IO per second
+ * @bw: Bandwidth, unit: KiB/s
+ * @lat_min: unit: ns
+ * @lat_max: unit: ns
+ * @lat_avg: unit: ns
+ *
+ * @nr_job: The number of elements in @job
+ */
+struct nt_iops_mq {
+	uint32_t	nsid;
+	uint32_t	lba_size;
+	uint32_t	nlb;
+	uint64_t	slba;
+	uint64_t	nr_lba;
+	uint16_t	qdepth;
+	uint8_t		rw;
+	uint8_t		rwmix;
+	uint8_t		random;
+	int		time; /* ms */
+
+	uint64_t	ios;
+	uint32_t	errors;
+	uint64_t	iops;
+	uint64_t	bw;
+	uint64_t	lat_min;
+	uint64_t	lat_max;
+	uint64_t	lat_avg;
+
+	uint16_t	nr_job;
+	struct nt_iops_job	job[0];
+};
+
 #define NVME_IOCTL_GET_SQ_INFO \
 	_IOWR('N', NVME_GET_SQ_INFO, struct nvme_sq_public)
 #define NVME_IOCTL_GET_CQ_INFO \
@@ -419,10 +807,32 @@ struct nt_iops {
 	_IOWR('N', NVME_SUBMIT_64B_CMD, struct nvme_64b_cmd)
 #define NVME_IOCTL_TAMPER_CMD \
 	_IOWR('N', NVME_TAMPER_CMD, struct nvme_cmd_tamper)
+#define NVME_IOCTL_SUBMIT_64B_CMD_BATCH \
+	_IOWR('N', NVME_SUBMIT_64B_CMD_BATCH, struct nvme_64b_cmd_batch)
+
+#define NVME_IOCTL_SET_QUEUE_OWNER \
+	_IOWR('N', NVME_SET_QUEUE_OWNER, struct nvme_queue_owner)
 
 #define NVME_IOCTL_INQUIRY_CQE		_IOWR('N', NVME_INQUIRY_CQE, struct nvme_inquiry)
 #define NVME_IOCTL_REAP_CQE		_IOWR('N', NVME_REAP_CQE, struct nvme_reap)
+#define NVME_IOCTL_REAP_CQE_WAIT \
+	_IOWR('N', NVME_REAP_CQE_WAIT, struct nvme_reap_wait)
 #define NVME_IOCTL_EMPTY_CMD_LIST	_IOW('N', NVME_EMPTY_CMD_LIST, uint16_t) /* SQID */
+#define NVME_IOCTL_SET_POLL_CQ \
+	_IOW('N', NVME_SET_POLL_CQ, struct nvme_poll_cq)
+
+#define NVME_IOCTL_LAT_STAT \
+	_IOWR('N', NVME_LAT_STAT, struct nvme_lat_stat)
+
+/* io_uring command operation, used as @sqe->cmd_op */
+#define NVME_URING_CMD_SUBMIT_64B \
+	_IOWR('N', NVME_URING_SUBMIT_64B_CMD, struct nvme_uring_cmd)
+
+#define NVME_IOCTL_REGISTER_BUFFER \
+	_IOW('N', NVME_REGISTER_BUFFER, struct nvme_buffer_reg)
+/* uint32_t: registered buffer identify */
+#define NVME_IOCTL_UNREGISTER_BUFFER \
+	_IOW('N', NVME_UNREGISTER_BUFFER, uint32_t)
 
 /* uint16_t: assign meta node identify */
 #define NVME_IOCTL_CREATE_META_NODE	_IOW('N', NVME_CREATE_META_NODE, struct nvme_meta_create)
@@ -434,13 +844,21 @@ struct nt_iops {
 #define NVME_IOCTL_MASK_IRQ		_IOW('N', NVME_MASK_IRQ, uint16_t)
 /* uint16_t: specified irq identify */
 #define NVME_IOCTL_UNMASK_IRQ		_IOW('N', NVME_UNMASK_IRQ, uint16_t)
+#define NVME_IOCTL_SET_IRQ_EVENTFD \
+	_IOW('N', NVME_SET_IRQ_EVENTFD, struct nvme_irq_eventfd)
+#define NVME_IOCTL_SET_IRQ_AFFINITY \
+	_IOWR('N', NVME_SET_IRQ_AFFINITY, struct nvme_irq_affinity)
 
 #define NVME_IOCTL_ALLOC_HMB \
 	_IOWR('N', NVME_ALLOC_HMB, struct nvme_hmb_alloc)
 #define NVME_IOCTL_RELEASE_HMB \
 	_IO('N', NVME_RELEASE_HMB)
+#define NVME_IOCTL_SET_DBBUF \
+	_IOWR('N', NVME_SET_DBBUF, struct nvme_dbbuf_cfg)
 
 #define NT_IOCTL_IOPS \
 	_IOWR('T', NVME_TEST_IOPS, struct nt_iops)
+#define NT_IOCTL_IOPS_MQ \
+	_IOWR('T', NVME_TEST_IOPS_MQ, struct nt_iops_mq)
 
 #endif /* !_UAPI_DNVME_H_ */
@@ -41,9 +41,13 @@ struct nvme_rwc_wrapper {
 
 	uint32_t	use_bit_bucket:1;
 	uint32_t	check_none:1; /*< don't check CQ entry data */
+	uint32_t	use_reg_buf:1; /*< use registered buffer instead of @buf */
 
 	uint32_t			nr_bit_bucket;
 	struct nvme_sgl_bit_bucket	*bit_bucket;
+
+	uint32_t	buf_id; /*< registered buffer identify */
+	uint32_t	buf_oft; /*< offset in registered buffer */
 };
 
 struct nvme_verify_wrapper {
@@ -128,11 +132,16 @@ static inline void nvme_cmd_fill_create_cq(struct nvme_create_cq *ccq,
 }
 
 int nvme_submit_64b_cmd(int fd, struct nvme_64b_cmd *cmd);
+int nvme_submit_64b_cmds(int fd, uint16_t sqid, struct nvme_64b_cmd *cmds, 
+	int32_t *status, uint32_t nr_cmd, int ring_db);
 
 int nvme_tamper_cmd(int fd, struct nvme_cmd_tamper *tamper);
 
 int nvme_cmd_keep_alive(int fd);
 
+int nvme_cmd_dbbuf_config(int fd);
+int nvme_dbbuf_config(struct nvme_dev_info *ndev);
+
 int nvme_cmd_create_iosq(int fd, struct nvme_create_sq *csq, uint8_t contig,
 	void *buf, uint32_t size);
 int nvme_cmd_create_iocq(int fd, struct nvme_create_cq *ccq, uint8_t contig,
@@ -148,6 +157,8 @@ int nvme_format_nvm(struct nvme_dev_info *ndev, uint32_t nsid, uint8_t flags,
 int nvme_cmd_io_rw_common(int fd, struct nvme_rwc_wrapper *wrap, uint8_t opcode);
 int nvme_io_rw_common(struct nvme_dev_info *ndev, struct nvme_rwc_wrapper *wrap, 
 	uint8_t opcode);
+int nvme_cmd_io_rw_batch(int fd, struct nvme_rwc_wrapper *wrap, uint8_t opcode,
+	uint32_t nr_cmd);
 
 static inline int nvme_cmd_io_read(int fd, struct nvme_rwc_wrapper *wrap)
 {
@@ -171,6 +182,12 @@ static inline int nvme_io_write(struct nvme_dev_info *ndev,
 	return nvme_io_rw_common(ndev, wrap, nvme_cmd_write);
 }
 
+static inline int nvme_cmd_io_write_batch(int fd, struct nvme_rwc_wrapper *wrap,
+	uint32_t nr_cmd)
+{
+	return nvme_cmd_io_rw_batch(fd, wrap, nvme_cmd_write, nr_cmd);
+}
+
 static inline int nvme_cmd_io_compare(int fd, struct nvme_rwc_wrapper *wrap)
 {
 	return nvme_cmd_io_rw_common(fd, wrap, nvme_cmd_compare);
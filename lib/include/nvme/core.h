@@ -133,10 +133,12 @@ struct nvme_cq_info {
  * 
  * @irq_type: The type of interrupt configured
  * @nr_irq: The number of interrupts configured
+ * @flags: Optional features enabled at initialization, see NVME_INIT_F_*
  */
 struct nvme_dev_info {
 	int		fd;
 	int		sock_fd;
+	uint32_t	flags;
 
 	struct nvme_sq_info	asq;
 	struct nvme_cq_info	acq;
@@ -162,7 +164,11 @@ static inline int nvme_is_maxio_falcon_lite(struct pci_dev_instance *pdev)
 		pdev->device_id == PCI_DEVICE_ID_FALCON_LITE) ? 1 : 0;
 }
 
+/* Use shadow doorbell buffers if controller supports Doorbell Buffer Config */
+#define NVME_INIT_F_DBBUF		(1 << 0)
+
 struct nvme_dev_info *nvme_init(const char *devpath);
+struct nvme_dev_info *nvme_init_flags(const char *devpath, uint32_t flags);
 void nvme_deinit(struct nvme_dev_info *ndev);
 
 int nvme_reinit(struct nvme_dev_info *ndev, uint32_t asqsz, uint32_t acqsz, 
@@ -69,6 +69,31 @@ static inline int nvme_write_ctrl_cc(int fd, uint32_t val)
 	return nvme_write_ctrl_property(fd, NVME_REG_CC, 4, &val);
 }
 
+static inline int nvme_read_ctrl_pmrcap(int fd, uint32_t *val)
+{
+	return nvme_read_ctrl_property(fd, NVME_REG_PMRCAP, 4, val);
+}
+
+static inline int nvme_read_ctrl_pmrsts(int fd, uint32_t *val)
+{
+	return nvme_read_ctrl_property(fd, NVME_REG_PMRSTS, 4, val);
+}
+
+/**
+ * @brief Map PMR, write-combining for stores or uncached for loads. While
+ *  one of them is mapped, mapping the other one fails with EBUSY.
+ */
+static inline void *nvme_map_pmr(int fd, uint32_t size, bool wc)
+{
+	return nvme_mmap(fd, wc ? NVME_PMR_MAP_WC : NVME_PMR_MAP_UC, size, 
+		NVME_VMPGOFF_TYPE_PMR);
+}
+
+static inline int nvme_unmap_pmr(void *pmr, uint32_t size)
+{
+	return munmap(pmr, size);
+}
+
 int nvme_set_device_state(int fd, enum nvme_state state);
 
 static inline int nvme_enable_controller(int fd)
@@ -94,4 +119,16 @@ static inline int nvme_reset_subsystem(int fd)
 int nvme_alloc_host_mem_buffer(int fd, struct nvme_hmb_alloc *alloc);
 int nvme_release_host_mem_buffer(int fd);
 
+int nvme_alloc_dbbuf(int fd, uint32_t nr_queue);
+int nvme_release_dbbuf(int fd);
+
+int nvme_register_buffer(int fd, uint32_t id, void *buf, uint32_t size, 
+	enum dma_data_direction dir);
+int nvme_unregister_buffer(int fd, uint32_t id);
+
+int nvme_lat_stat(int fd, uint16_t sqid, enum nvme_lat_stat_op op,
+	struct nvme_lat_stat *stat);
+
+int nvme_set_poll_cq(int fd, uint16_t *cqid, uint16_t nr_cq);
+
 #endif /* !_UAPI_LIB_NVME_IOCTL_H_ */
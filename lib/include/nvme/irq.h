@@ -13,6 +13,26 @@
 #ifndef _UAPI_LIB_NVME_IRQ_H_
 #define _UAPI_LIB_NVME_IRQ_H_
 
+/**
+ * @brief Statistics of irq events
+ *
+ * @nr_irq: The number of irq events analyzed
+ * @lost: The number of events overwritten before they're analyzed
+ * @nr_cqe: CQ entries reaped between the first and last event, so CQE per
+ *  irq is nr_cqe / (nr_irq - 1)
+ * @span_ns: Time between the first and last event
+ * @gap_*: Inter-arrival time of irq, in ns
+ */
+struct nvme_irq_ring_stat {
+	uint64_t	nr_irq;
+	uint64_t	lost;
+	uint64_t	nr_cqe;
+	uint64_t	span_ns;
+	uint64_t	gap_min;
+	uint64_t	gap_avg;
+	uint64_t	gap_max;
+};
+
 enum nvme_irq_type nvme_select_irq_type_random(void);
 
 int nvme_set_irq(int fd, enum nvme_irq_type type, uint16_t nr_irqs);
@@ -21,4 +41,12 @@ int nvme_switch_irq(int fd, enum nvme_irq_type type, uint16_t nr_irqs);
 int nvme_mask_irq(int fd, uint16_t irq_no);
 int nvme_unmask_irq(int fd, uint16_t irq_no);
 
+int nvme_set_irq_eventfd(int fd, uint16_t irq_no, int efd);
+int nvme_pin_irq_to_cpu(int fd, uint16_t irq_no, uint32_t cpu);
+
+struct nvme_irq_ring *nvme_map_irq_ring(int fd, uint16_t irq_no);
+int nvme_unmap_irq_ring(struct nvme_irq_ring *ring);
+int nvme_irq_ring_stat(const struct nvme_irq_ring *ring, uint64_t start,
+	uint32_t nr_entry, struct nvme_irq_ring_stat *stat);
+
 #endif /* !_UAPI_LIB_NVME_IRQ_H_ */
@@ -25,6 +25,8 @@ struct nvme_csq_wrapper {
 	uint32_t	elements;
 	uint16_t	prio;
 	uint8_t		contig;
+	uint8_t		use_node; /* allocate on @numa_node, not node of device */
+	uint16_t	numa_node;
 	void		*buf;
 	uint32_t	size;
 };
@@ -38,6 +40,9 @@ struct nvme_ccq_wrapper {
 	uint16_t	irq_no;
 	uint8_t		irq_en;
 	uint8_t		contig;
+	uint8_t		poll_mode; /* see enum nvme_cq_poll_mode */
+	uint8_t		use_node; /* allocate on @numa_node, not node of device */
+	uint16_t	numa_node;
 	void		*buf;
 	uint32_t	size;
 };
@@ -71,6 +76,15 @@ static inline int nvme_unmap_sq(void *sq, uint32_t size)
 	return munmap(sq, size);
 }
 
+/**
+ * @brief Map SQ in CMB, which is write-combining. Commands written shall be
+ *  flushed before ringing doorbell.
+ */
+static inline void *nvme_map_cmb_sq(int fd, uint16_t sqid, uint32_t size)
+{
+	return nvme_mmap(fd, sqid, size, NVME_VMPGOFF_TYPE_CMB_SQ);
+}
+
 static inline void *nvme_map_cq(int fd, uint16_t cqid, uint32_t size)
 {
 	return nvme_mmap(fd, cqid, size, NVME_VMPGOFF_TYPE_CQ);
@@ -81,6 +95,35 @@ static inline int nvme_unmap_cq(void *cq, uint32_t size)
 	return munmap(cq, size);
 }
 
+/* Doorbell offset in the region mapped by nvme_map_db() */
+#define NVME_SQ_TAIL_DB_OFFSET(qid, dstrd, pgsz) \
+	((NVME_REG_DBS + (2 * (qid)) * (4 << (dstrd))) & ((pgsz) - 1))
+#define NVME_CQ_HEAD_DB_OFFSET(qid, dstrd, pgsz) \
+	((NVME_REG_DBS + (2 * (qid) + 1) * (4 << (dstrd))) & ((pgsz) - 1))
+
+/**
+ * @brief Map doorbell registers of the I/O queue, the region starts at the
+ *  page which holds its SQ tail doorbell.
+ *
+ * @note Both SQ and CQ of @qid shall be owned by user, so shall be the
+ *  queues whose doorbells share the pages. Thus CAP.DSTRD shall be large
+ *  enough to place the doorbells of each queue in its own page.
+ */
+static inline void *nvme_map_db(int fd, uint16_t qid, uint32_t size)
+{
+	return nvme_mmap(fd, qid, size, NVME_VMPGOFF_TYPE_DB);
+}
+
+static inline int nvme_unmap_db(void *db, uint32_t size)
+{
+	return munmap(db, size);
+}
+
+static inline void nvme_write_db(void *db, uint32_t offset, uint16_t val)
+{
+	*(volatile uint32_t *)((uint8_t *)db + offset) = val;
+}
+
 int nvme_get_sq_info(int fd, struct nvme_sq_public *sq);
 int nvme_get_cq_info(int fd, struct nvme_cq_public *cq);
 
@@ -107,6 +150,8 @@ int nvme_delete_all_ioq(struct nvme_dev_info *ndev);
 
 int nvme_inquiry_cq_entries(int fd, uint16_t cqid);
 int nvme_reap_cq_entries(int fd, struct nvme_reap *rp);
+int nvme_reap_cq_entries_wait(int fd, uint16_t cqid, uint32_t expect, 
+	void *buf, uint32_t size, int timeout);
 
 int nvme_valid_cq_entry(struct nvme_completion *entry, uint16_t sqid, 
 	uint16_t cid, uint16_t status);
@@ -118,6 +163,8 @@ struct nvme_completion *nvme_find_cq_entry(struct nvme_completion *entries,
 int nvme_ring_sq_doorbell(int fd, uint16_t sqid);
 int nvme_empty_sq_cmdlist(int fd, uint16_t sqid);
 
+int nvme_set_queue_owner(int fd, struct nvme_queue_owner *own);
+
 int nvme_init_ioq_info(struct nvme_dev_info *ndev);
 void nvme_deinit_ioq_info(struct nvme_dev_info *ndev);
 
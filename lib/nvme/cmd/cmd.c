@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/ioctl.h>
 #include <errno.h>
 
@@ -46,6 +47,41 @@ int nvme_submit_64b_cmd(int fd, struct nvme_64b_cmd *cmd)
 	return (int)cmd->cid;
 }
 
+/**
+ * @brief Submit a batch of commands to the specified SQ
+ * 
+ * @param fd NVMe device file descriptor
+ * @param sqid The SQ to which all commands are submitted
+ * @param cmds Command array, the assigned command identifier is saved in
+ *  the @cid field of each command.
+ * @param status Optional, save the result of each command.
+ * @param nr_cmd The number of commands in @cmds
+ * @param ring_db Ring SQ doorbell after all commands are submitted
+ * @return The number of commands submitted if success, otherwise a negative
+ *  errno.
+ */
+int nvme_submit_64b_cmds(int fd, uint16_t sqid, struct nvme_64b_cmd *cmds, 
+	int32_t *status, uint32_t nr_cmd, int ring_db)
+{
+	struct nvme_64b_cmd_batch batch = {0};
+	int ret;
+
+	batch.sqid = sqid;
+	batch.nr_cmd = nr_cmd;
+	batch.ring_db = ring_db ? 1 : 0;
+	batch.cmds = cmds;
+	batch.status = status;
+
+	ret = ioctl(fd, NVME_IOCTL_SUBMIT_64B_CMD_BATCH, &batch);
+	if (ret < 0) {
+		pr_err("failed to submit cmds to SQ(%u), %u/%u submitted!(%d)\n", 
+			sqid, batch.submitted, nr_cmd, ret);
+		if (!batch.submitted)
+			return ret;
+	}
+	return (int)batch.submitted;
+}
+
 /**
  * @brief Tamper with commands already added to SQ 
  */
@@ -78,6 +114,44 @@ int nvme_cmd_keep_alive(int fd)
 	return nvme_submit_64b_cmd(fd, &cmd);
 }
 
+/**
+ * @brief Submit Doorbell Buffer Config command, PRP1 and PRP2 are filled by
+ *  driver if shadow doorbell buffers have been allocated.
+ * 
+ * @return The assigned command identifier if success, otherwise a negative
+ *  errno.
+ */
+int nvme_cmd_dbbuf_config(int fd)
+{
+	struct nvme_dbbuf dbbuf = {0};
+	struct nvme_64b_cmd cmd = {0};
+
+	dbbuf.opcode = nvme_admin_dbbuf;
+
+	cmd.sqid = NVME_AQ_ID;
+	cmd.cmd_buf_ptr = &dbbuf;
+
+	return nvme_submit_64b_cmd(fd, &cmd);
+}
+
+int nvme_dbbuf_config(struct nvme_dev_info *ndev)
+{
+	struct nvme_completion entry = {0};
+	uint16_t cid;
+
+	cid = CHK_EXPR_NUM_LT0_RTN(nvme_cmd_dbbuf_config(ndev->fd), -EPERM);
+	CHK_EXPR_NUM_LT0_RTN(
+		nvme_ring_sq_doorbell(ndev->fd, NVME_AQ_ID), -EPERM);
+	CHK_EXPR_NUM_NE_RTN(
+		nvme_gnl_cmd_reap_cqe(ndev, NVME_AQ_ID, 1, &entry, sizeof(entry)),
+		1, -ETIME);
+	CHK_EXPR_NUM_LT0_RTN(
+		nvme_valid_cq_entry(&entry, NVME_AQ_ID, cid, NVME_SC_SUCCESS),
+		-EPERM);
+
+	return 0;
+}
+
 /**
  * @brief Submit command to create a I/O submission queue
  * 
@@ -199,48 +273,97 @@ int nvme_format_nvm(struct nvme_dev_info *ndev, uint32_t nsid, uint8_t flags,
 	return 0;
 }
 
-int nvme_cmd_io_rw_common(int fd, struct nvme_rwc_wrapper *wrap, uint8_t opcode)
+static void nvme_fill_io_rw_cmd(struct nvme_rwc_wrapper *wrap, uint8_t opcode,
+	struct nvme_rw_command *rwc, struct nvme_64b_cmd *cmd)
 {
-	struct nvme_rw_command rwc = {0};
-	struct nvme_64b_cmd cmd = {0};
-
-	rwc.opcode = opcode;
-	rwc.flags = wrap->flags;
-	rwc.nsid = cpu_to_le32(wrap->nsid);
-	rwc.cdw2 = cpu_to_le32(wrap->dw2);
-	rwc.cdw3 = cpu_to_le32(wrap->dw3);
+	rwc->opcode = opcode;
+	rwc->flags = wrap->flags;
+	rwc->nsid = cpu_to_le32(wrap->nsid);
+	rwc->cdw2 = cpu_to_le32(wrap->dw2);
+	rwc->cdw3 = cpu_to_le32(wrap->dw3);
 
 	if (wrap->meta_id) {
-		cmd.meta_id = wrap->meta_id;
-		cmd.bit_mask |= NVME_MASK_MPTR;
+		cmd->meta_id = wrap->meta_id;
+		cmd->bit_mask |= NVME_MASK_MPTR;
 	}
 
-	rwc.slba = cpu_to_le64(wrap->slba);
-	rwc.length = cpu_to_le16((uint16_t)(wrap->nlb - 1)); /* 0'base */
-	rwc.control = cpu_to_le16(wrap->control);
-	rwc.dspec = cpu_to_le16(wrap->dspec);
-	rwc.reftag = cpu_to_le32(wrap->dw14);
-	rwc.apptag = cpu_to_le16(wrap->apptag);
-	rwc.appmask = cpu_to_le16(wrap->appmask);
+	rwc->slba = cpu_to_le64(wrap->slba);
+	rwc->length = cpu_to_le16((uint16_t)(wrap->nlb - 1)); /* 0'base */
+	rwc->control = cpu_to_le16(wrap->control);
+	rwc->dspec = cpu_to_le16(wrap->dspec);
+	rwc->reftag = cpu_to_le32(wrap->dw14);
+	rwc->apptag = cpu_to_le16(wrap->apptag);
+	rwc->appmask = cpu_to_le16(wrap->appmask);
 	
-	cmd.sqid = wrap->sqid;
-	cmd.cmd_buf_ptr = &rwc;
-	cmd.bit_mask |= NVME_MASK_PRP1_PAGE | NVME_MASK_PRP1_LIST |
+	cmd->sqid = wrap->sqid;
+	cmd->cmd_buf_ptr = rwc;
+	cmd->bit_mask |= NVME_MASK_PRP1_PAGE | NVME_MASK_PRP1_LIST |
 		NVME_MASK_PRP2_PAGE | NVME_MASK_PRP2_LIST;
-	cmd.data_buf_ptr = wrap->buf;
-	cmd.data_buf_size = wrap->size;
-	cmd.data_dir = DMA_BIDIRECTIONAL;
+	cmd->data_buf_ptr = wrap->buf;
+	cmd->data_buf_size = wrap->size;
+	cmd->data_dir = DMA_BIDIRECTIONAL;
+
+	if (wrap->use_reg_buf) {
+		cmd->use_reg_buf = 1;
+		cmd->buf_id = wrap->buf_id;
+		cmd->buf_oft = wrap->buf_oft;
+	}
 
 	if (wrap->use_bit_bucket) {
-		cmd.use_bit_bucket = 1;
-		cmd.nr_bit_bucket = wrap->nr_bit_bucket;
-		cmd.bit_bucket = wrap->bit_bucket;
-		BUG_ON(!cmd.nr_bit_bucket || !cmd.bit_bucket);
+		cmd->use_bit_bucket = 1;
+		cmd->nr_bit_bucket = wrap->nr_bit_bucket;
+		cmd->bit_bucket = wrap->bit_bucket;
+		BUG_ON(!cmd->nr_bit_bucket || !cmd->bit_bucket);
 	}
+}
+
+int nvme_cmd_io_rw_common(int fd, struct nvme_rwc_wrapper *wrap, uint8_t opcode)
+{
+	struct nvme_rw_command rwc = {0};
+	struct nvme_64b_cmd cmd = {0};
 
+	nvme_fill_io_rw_cmd(wrap, opcode, &rwc, &cmd);
 	return nvme_submit_64b_cmd(fd, &cmd);
 }
 
+/**
+ * @brief Submit @nr_cmd identical I/O read/write commands in one call
+ * 
+ * @return The number of commands submitted if success, otherwise a negative
+ *  errno.
+ */
+int nvme_cmd_io_rw_batch(int fd, struct nvme_rwc_wrapper *wrap, uint8_t opcode,
+	uint32_t nr_cmd)
+{
+	struct nvme_rw_command *rwc;
+	struct nvme_64b_cmd *cmd;
+	uint32_t i;
+	int ret;
+
+	rwc = calloc(nr_cmd, sizeof(*rwc));
+	if (!rwc) {
+		pr_err("failed to alloc rwc!\n");
+		return -ENOMEM;
+	}
+
+	cmd = calloc(nr_cmd, sizeof(*cmd));
+	if (!cmd) {
+		pr_err("failed to alloc cmd!\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr_cmd; i++)
+		nvme_fill_io_rw_cmd(wrap, opcode, &rwc[i], &cmd[i]);
+
+	ret = nvme_submit_64b_cmds(fd, wrap->sqid, cmd, NULL, nr_cmd, 0);
+
+	free(cmd);
+out:
+	free(rwc);
+	return ret;
+}
+
 int nvme_io_rw_common(struct nvme_dev_info *ndev, struct nvme_rwc_wrapper *wrap, 
 	uint8_t opcode)
 {
@@ -837,6 +837,40 @@ static void deinit_pci_dev_instance(struct nvme_dev_info *ndev)
 	ndev->pdev = NULL;
 }
 
+/**
+ * @brief Setup shadow doorbell buffers if it's required, it shall be done
+ *  before creating I/O queues each time controller is enabled.
+ */
+static int nvme_init_dbbuf(struct nvme_dev_info *ndev)
+{
+	struct nvme_ctrl_instance *ctrl = ndev->ctrl;
+	uint32_t nr_queue;
+	int ret;
+
+	if (!(ndev->flags & NVME_INIT_F_DBBUF))
+		return 0;
+
+	if (!(le16_to_cpu(ctrl->id_ctrl->oacs) & NVME_CTRL_OACS_DBBUF_SUPP)) {
+		pr_warn("Doorbell Buffer Config is not supported!\n");
+		return 0;
+	}
+
+	/* ACQ/ASQ + IOCQ/IOSQ */
+	nr_queue = (ctrl->nr_sq > ctrl->nr_cq ? ctrl->nr_sq : ctrl->nr_cq) + 1;
+
+	ret = nvme_alloc_dbbuf(ndev->fd, nr_queue);
+	if (ret < 0)
+		return ret;
+
+	ret = nvme_dbbuf_config(ndev);
+	if (ret < 0) {
+		nvme_release_dbbuf(ndev->fd);
+		return ret;
+	}
+	pr_info("shadow doorbell is enabled for %u queues!\n", nr_queue);
+	return 0;
+}
+
 /**
  * @brief Try to get the basic information of NVMe device. Eg. queue number,
  *  Identify controller data...
@@ -914,6 +948,8 @@ static int nvme_init_stage2(struct nvme_dev_info *ndev)
 		ret, -EPERM, exit_pci_dev_instance);
 	CHK_EXPR_NUM_LT0_GOTO(nvme_init_ioq_info(ndev), 
 		ret, -EPERM, exit_ctrl_instance);
+	CHK_EXPR_NUM_LT0_GOTO(nvme_init_dbbuf(ndev), 
+		ret, -EPERM, exit_ioq);
 	CHK_EXPR_NUM_LT0_GOTO(init_ns_group(ndev), 
 		ret, -EPERM, exit_ioq);
 
@@ -936,6 +972,16 @@ static void nvme_release_stage2(struct nvme_dev_info *ndev)
 }
 
 struct nvme_dev_info *nvme_init(const char *devpath)
+{
+	return nvme_init_flags(devpath, 0);
+}
+
+/**
+ * @brief Initialize NVMe device with optional features
+ *
+ * @param flags See NVME_INIT_F_* for details
+ */
+struct nvme_dev_info *nvme_init_flags(const char *devpath, uint32_t flags)
 {
 	struct nvme_dev_info *ndev;
 	int ret;
@@ -947,6 +993,7 @@ struct nvme_dev_info *nvme_init(const char *devpath)
 		pr_err("failed to alloc memory!\n");
 		return NULL;
 	}
+	ndev->flags = flags;
 
 	ndev->fd = open(devpath, O_RDWR);
 	if (ndev->fd < 0) {
@@ -1015,6 +1062,7 @@ int nvme_reinit(struct nvme_dev_info *ndev, uint32_t asqsz, uint32_t acqsz,
 
 	CHK_EXPR_NUM_LT0_RTN(
 		nvme_enable_controller(ndev->fd), -EPERM);
+	CHK_EXPR_NUM_LT0_RTN(nvme_init_dbbuf(ndev), -EPERM);
 
 	return 0;
 }
@@ -210,3 +210,107 @@ int nvme_release_host_mem_buffer(int fd)
 	return 0;
 }
 
+/**
+ * @brief Allocate shadow doorbell buffers which cover @nr_queue queue
+ *  identifiers, Doorbell Buffer Config command shall be submitted later.
+ */
+int nvme_alloc_dbbuf(int fd, uint32_t nr_queue)
+{
+	struct nvme_dbbuf_cfg cfg = {
+		.enable = 1,
+		.nr_queue = nr_queue,
+	};
+	int ret;
+
+	ret = ioctl(fd, NVME_IOCTL_SET_DBBUF, &cfg);
+	if (ret < 0) {
+		pr_err("failed to alloc dbbuf!(%d)\n", ret);
+		return ret;
+	}
+	pr_debug("dbs:0x%llx, eis:0x%llx\n", (unsigned long long)cfg.dbs_addr,
+		(unsigned long long)cfg.eis_addr);
+	return 0;
+}
+
+int nvme_release_dbbuf(int fd)
+{
+	struct nvme_dbbuf_cfg cfg = {
+		.enable = 0,
+	};
+	int ret;
+
+	ret = ioctl(fd, NVME_IOCTL_SET_DBBUF, &cfg);
+	if (ret < 0) {
+		pr_err("failed to release dbbuf!(%d)\n", ret);
+		return ret;
+	}
+	return 0;
+}
+
+/**
+ * @brief Pin down @buf and map it for DMA once, commands can refer to it
+ *  by @id later.
+ */
+int nvme_register_buffer(int fd, uint32_t id, void *buf, uint32_t size, 
+	enum dma_data_direction dir)
+{
+	struct nvme_buffer_reg reg = {0};
+	int ret;
+
+	reg.id = id;
+	reg.buf = buf;
+	reg.size = size;
+	reg.dir = dir;
+
+	ret = ioctl(fd, NVME_IOCTL_REGISTER_BUFFER, &reg);
+	if (ret < 0) {
+		pr_err("failed to register buffer(%u)!(%d)\n", id, ret);
+		return ret;
+	}
+	return 0;
+}
+
+int nvme_unregister_buffer(int fd, uint32_t id)
+{
+	int ret;
+
+	ret = ioctl(fd, NVME_IOCTL_UNREGISTER_BUFFER, id);
+	if (ret < 0) {
+		pr_err("failed to unregister buffer(%u)!(%d)\n", id, ret);
+		return ret;
+	}
+	return 0;
+}
+
+int nvme_lat_stat(int fd, uint16_t sqid, enum nvme_lat_stat_op op,
+	struct nvme_lat_stat *stat)
+{
+	int ret;
+
+	stat->sqid = sqid;
+	stat->op = op;
+
+	ret = ioctl(fd, NVME_IOCTL_LAT_STAT, stat);
+	if (ret < 0) {
+		pr_err("failed to do op(%d) of SQ(%u) latency!(%d)\n", 
+			op, sqid, ret);
+		return ret;
+	}
+	return 0;
+}
+
+int nvme_set_poll_cq(int fd, uint16_t *cqid, uint16_t nr_cq)
+{
+	struct nvme_poll_cq poll = {
+		.nr_cq = nr_cq,
+		.cqid = cqid,
+	};
+	int ret;
+
+	ret = ioctl(fd, NVME_IOCTL_SET_POLL_CQ, &poll);
+	if (ret < 0) {
+		pr_err("failed to select %u CQs for poll!(%d)\n", nr_cq, ret);
+		return ret;
+	}
+	return 0;
+}
@@ -12,7 +12,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <errno.h>
 
 #include "libbase.h"
@@ -61,7 +64,7 @@ enum nvme_irq_type nvme_select_irq_type_random(void)
 
 int nvme_set_irq(int fd, enum nvme_irq_type type, uint16_t nr_irqs)
 {
-	struct nvme_interrupt irq;
+	struct nvme_interrupt irq = {0};
 	int ret;
 
 	irq.irq_type = type;
@@ -127,3 +130,150 @@ int nvme_unmask_irq(int fd, uint16_t irq_no)
 	}
 	return 0;
 }
+
+/**
+ * @brief Bind eventfd to specified irq number
+ * 
+ * @param fd NVMe device file descriptor
+ * @param irq_no irq number
+ * @param efd eventfd, or -1 to unbind
+ * @return 0 on success, otherwise a negative errno.
+ */
+int nvme_set_irq_eventfd(int fd, uint16_t irq_no, int efd)
+{
+	struct nvme_irq_eventfd evt;
+	int ret;
+
+	evt.irq_id = irq_no;
+	evt.fd = efd;
+
+	ret = ioctl(fd, NVME_IOCTL_SET_IRQ_EVENTFD, &evt);
+	if (ret < 0) {
+		pr_err("failed to bind eventfd(%d) to irq %u!(%d)\n", 
+			efd, irq_no, ret);
+		return ret;
+	}
+	return 0;
+}
+
+/**
+ * @brief Pin specified irq number to the CPU
+ * 
+ * @param fd NVMe device file descriptor
+ * @param irq_no irq number
+ * @param cpu CPU which the irq is pinned to
+ * @return The first CPU of effective affinity on success, otherwise a
+ *  negative errno.
+ */
+int nvme_pin_irq_to_cpu(int fd, uint16_t irq_no, uint32_t cpu)
+{
+	struct nvme_irq_affinity aff = {0};
+	uint32_t i;
+	int ret;
+
+	if (cpu >= NVME_IRQ_CPUMASK_SIZE * 32) {
+		pr_err("CPU %u is out of range!\n", cpu);
+		return -EINVAL;
+	}
+
+	aff.irq_id = irq_no;
+	aff.cpumask[cpu / 32] = 1U << (cpu % 32);
+
+	ret = ioctl(fd, NVME_IOCTL_SET_IRQ_AFFINITY, &aff);
+	if (ret < 0) {
+		pr_err("failed to pin irq %u to CPU %u!(%d)\n", irq_no, cpu, ret);
+		return ret;
+	}
+
+	for (i = 0; i < NVME_IRQ_CPUMASK_SIZE * 32; i++) {
+		if (aff.eff_mask[i / 32] & (1U << (i % 32)))
+			return i;
+	}
+	return -ENODATA;
+}
+
+/**
+ * @brief Map the event ring of specified irq number, which is read-only.
+ * 
+ * @return The ring on success, otherwise NULL.
+ */
+struct nvme_irq_ring *nvme_map_irq_ring(int fd, uint16_t irq_no)
+{
+	size_t pg_size = sysconf(_SC_PAGE_SIZE);
+	size_t pgoff = NVME_VMPGOFF_FOR_TYPE(NVME_VMPGOFF_TYPE_IRQ_RING) | irq_no;
+	void *addr;
+
+	addr = mmap(NULL, sizeof(struct nvme_irq_ring), PROT_READ, MAP_SHARED, 
+		fd, pg_size * pgoff);
+	if (MAP_FAILED == addr) {
+		pr_err("failed to map irq %u ring!\n", irq_no);
+		return NULL;
+	}
+	return addr;
+}
+
+int nvme_unmap_irq_ring(struct nvme_irq_ring *ring)
+{
+	return munmap(ring, sizeof(struct nvme_irq_ring));
+}
+
+/**
+ * @brief Analyze the events recorded in the ring since @start.
+ * 
+ * @param start The head of ring before the workload starts
+ * @param nr_entry The number of entries in CQ bound to the irq
+ * @return 0 on success, otherwise a negative errno.
+ */
+int nvme_irq_ring_stat(const struct nvme_irq_ring *ring, uint64_t start,
+	uint32_t nr_entry, struct nvme_irq_ring_stat *stat)
+{
+	const struct nvme_irq_event *evt;
+	const struct nvme_irq_event *last = NULL;
+	uint64_t head, first, i;
+	uint64_t first_ts = 0, prev = 0, gap, sum = 0;
+
+	memset(stat, 0, sizeof(*stat));
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (head < start)
+		return -EINVAL;
+
+	/* the events older than the ring size are overwritten already */
+	first = head - start > NVME_IRQ_RING_ENTRIES ? 
+		head - NVME_IRQ_RING_ENTRIES : start;
+	stat->lost = first - start;
+
+	for (i = first; i < head; i++) {
+		evt = &ring->event[i & (NVME_IRQ_RING_ENTRIES - 1)];
+		if (i == first) {
+			first_ts = evt->ts;
+			stat->gap_min = UINT64_MAX;
+		} else {
+			gap = evt->ts - prev;
+			stat->gap_min = min(stat->gap_min, gap);
+			stat->gap_max = max(stat->gap_max, gap);
+			sum += gap;
+		}
+		prev = evt->ts;
+
+		/* head wraps around at the end of CQ */
+		if (last && nr_entry && evt->cqid != NVME_IRQ_EVENT_NO_CQ &&
+			evt->cqid == last->cqid)
+			stat->nr_cqe += (evt->head + nr_entry - last->head) %
+				nr_entry;
+		last = evt;
+		stat->nr_irq++;
+	}
+
+	if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - first > 
+		NVME_IRQ_RING_ENTRIES)
+		pr_warn("irq ring is overwritten while reading!\n");
+
+	if (stat->nr_irq > 1) {
+		stat->span_ns = prev - first_ts;
+		stat->gap_avg = sum / (stat->nr_irq - 1);
+	} else {
+		stat->gap_min = 0;
+	}
+	return 0;
+}
@@ -161,6 +161,8 @@ int nvme_create_iosq(struct nvme_dev_info *ndev, struct nvme_csq_wrapper *wrap)
 
 	nvme_fill_prep_sq(&psq, wrap->sqid, wrap->cqid, wrap->elements, 
 		wrap->contig);
+	psq.use_node = wrap->use_node;
+	psq.numa_node = wrap->numa_node;
 	CHK_EXPR_NUM_LT0_RTN(nvme_prepare_iosq(fd, &psq), -EPERM);
 	
 	nvme_cmd_fill_create_sq(&csq, wrap->sqid, wrap->cqid, wrap->elements,
@@ -260,6 +262,9 @@ int nvme_create_iocq(struct nvme_dev_info *ndev, struct nvme_ccq_wrapper *wrap)
 
 	nvme_fill_prep_cq(&pcq, wrap->cqid, wrap->elements, wrap->contig, 
 		wrap->irq_en, wrap->irq_no);
+	pcq.poll_mode = wrap->poll_mode;
+	pcq.use_node = wrap->use_node;
+	pcq.numa_node = wrap->numa_node;
 	CHK_EXPR_NUM_LT0_RTN(nvme_prepare_iocq(fd, &pcq), -EPERM);
 
 	nvme_cmd_fill_create_cq(&ccq, wrap->cqid, wrap->elements, wrap->contig,
@@ -502,6 +507,32 @@ int nvme_reap_cq_entries(int fd, struct nvme_reap *rp)
 	return 0;
 }
 
+/**
+ * @brief Wait for @expect CQ entries in @timeout milliseconds and reap them.
+ *
+ * @return The number of CQ entries reaped if success, otherwise a negative
+ *  errno.
+ */
+int nvme_reap_cq_entries_wait(int fd, uint16_t cqid, uint32_t expect, 
+	void *buf, uint32_t size, int timeout)
+{
+	struct nvme_reap_wait rw = {0};
+	int ret;
+
+	rw.cqid = cqid;
+	rw.expect = expect;
+	rw.timeout = timeout;
+	rw.buf = buf;
+	rw.size = size;
+
+	ret = ioctl(fd, NVME_IOCTL_REAP_CQE_WAIT, &rw);
+	if (ret < 0) {
+		pr_err("failed to reap CQ(%u)!(%d)\n", cqid, ret);
+		return ret;
+	}
+	return rw.reaped;
+}
+
 int nvme_ring_sq_doorbell(int fd, uint16_t sqid)
 {
 	int ret;
@@ -526,6 +557,19 @@ int nvme_empty_sq_cmdlist(int fd, uint16_t sqid)
 	return 0;
 }
 
+int nvme_set_queue_owner(int fd, struct nvme_queue_owner *own)
+{
+	int ret;
+
+	ret = ioctl(fd, NVME_IOCTL_SET_QUEUE_OWNER, own);
+	if (ret < 0) {
+		pr_err("failed to set %s(%u) owner!(%d)\n", 
+			own->type == NVME_SQ ? "SQ" : "CQ", own->qid, ret);
+		return ret;
+	}
+	return 0;
+}
+
 static int nvme_alloc_iosq_info(struct nvme_dev_info *ndev)
 {
 	struct nvme_sq_info *sq;
@@ -0,0 +1,319 @@
+/**
+ * @file buffer.c
+ * @author yeqiang_xu <yeqiang_xu@maxio-tech.com>
+ * @brief Registered user data buffer.
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/pci.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/version.h>
+
+#include "queue.h"
+#include "core.h"
+
+/*
+ * pin_user_pages_fast() and unpin_user_pages_dirty_lock() are available
+ * since 5.8. Older kernels fall back to get_user_pages_fast(), which can't
+ * migrate the pages out of ZONE_MOVABLE/CMA for long term use.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+static int dnvme_pin_pages(unsigned long addr, int nr_pages, bool write, 
+	struct page **pages)
+{
+	return pin_user_pages_fast(addr, nr_pages, 
+		FOLL_LONGTERM | (write ? FOLL_WRITE : 0), pages);
+}
+
+static void dnvme_unpin_pages(struct page **pages, u32 nr_pages, bool dirty)
+{
+	unpin_user_pages_dirty_lock(pages, nr_pages, dirty);
+}
+#else
+static int dnvme_pin_pages(unsigned long addr, int nr_pages, bool write, 
+	struct page **pages)
+{
+	return get_user_pages_fast(addr, nr_pages, write ? FOLL_WRITE : 0, 
+		pages);
+}
+
+static void dnvme_unpin_pages(struct page **pages, u32 nr_pages, bool dirty)
+{
+	u32 i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (dirty)
+			set_page_dirty_lock(pages[i]);
+		put_page(pages[i]);
+	}
+}
+#endif
+
+static void dnvme_ubuf_unpin(struct nvme_device *ndev, struct nvme_ubuf *ubuf)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	u32 i;
+
+	for (i = 0; i < ubuf->nr_pages; i++) {
+		if (ubuf->dma[i])
+			dma_unmap_page(&pdev->dev, ubuf->dma[i], PAGE_SIZE,
+				ubuf->dir);
+	}
+
+	dnvme_unpin_pages(ubuf->pages, ubuf->nr_pages, 
+		ubuf->dir != DMA_TO_DEVICE);
+}
+
+static void dnvme_delete_ubuf(struct nvme_device *ndev, struct nvme_ubuf *ubuf)
+{
+	xa_erase(&ndev->ubufs, ubuf->id);
+
+	dnvme_ubuf_unpin(ndev, ubuf);
+	kvfree(ubuf->dma);
+	kvfree(ubuf->pages);
+	kfree(ubuf);
+}
+
+/**
+ * @brief Pin down user buffer and map it for DMA once, then commands can
+ *  refer to the buffer by identify without pinning it again.
+ *
+ * @note The pages stay pinned until unregistered, so they're pinned for
+ *  long term and migrated out of ZONE_MOVABLE/CMA if necessary. Pages are
+ *  only required to be writable if device writes to the buffer.
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_register_buffer(struct nvme_device *ndev,
+	struct nvme_buffer_reg __user *ureg)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	struct nvme_buffer_reg reg;
+	struct nvme_ubuf *ubuf;
+	unsigned long addr;
+	int nr_pages;
+	int ret;
+	u32 i;
+
+	if (copy_from_user(&reg, ureg, sizeof(reg))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	addr = (unsigned long)reg.buf;
+	if (!addr || !IS_ALIGNED(addr, 4) || !reg.size) {
+		dnvme_err(ndev, "buf ptr:0x%lx or size:%u is invalid!\n",
+			addr, reg.size);
+		return -EINVAL;
+	}
+
+	if (reg.dir != DMA_TO_DEVICE && reg.dir != DMA_FROM_DEVICE &&
+		reg.dir != DMA_BIDIRECTIONAL) {
+		dnvme_err(ndev, "DMA direction(%d) is invalid!\n", reg.dir);
+		return -EINVAL;
+	}
+
+	ubuf = dnvme_find_ubuf(ndev, reg.id);
+	if (ubuf) {
+		dnvme_err(ndev, "buffer(%u) already exist!\n", reg.id);
+		return -EEXIST;
+	}
+
+	ubuf = kzalloc(sizeof(*ubuf), GFP_KERNEL);
+	if (!ubuf) {
+		dnvme_err(ndev, "failed to alloc buffer node!\n");
+		return -ENOMEM;
+	}
+	ubuf->id = reg.id;
+	ubuf->addr = addr;
+	ubuf->size = reg.size;
+	ubuf->offset = offset_in_page(addr);
+	ubuf->dir = reg.dir;
+	atomic_set(&ubuf->ref, 0);
+
+	nr_pages = DIV_ROUND_UP(ubuf->offset + ubuf->size, PAGE_SIZE);
+
+	ubuf->pages = kvcalloc(nr_pages, sizeof(*ubuf->pages), GFP_KERNEL);
+	ubuf->dma = kvcalloc(nr_pages, sizeof(*ubuf->dma), GFP_KERNEL);
+	if (!ubuf->pages || !ubuf->dma) {
+		dnvme_err(ndev, "failed to alloc pages!\n");
+		ret = -ENOMEM;
+		goto out_free_ubuf;
+	}
+
+	ret = dnvme_pin_pages(addr, nr_pages, ubuf->dir != DMA_TO_DEVICE, 
+		ubuf->pages);
+	if (ret < nr_pages) {
+		dnvme_err(ndev, "failed to pin down user pages!\n");
+		ubuf->nr_pages = max(ret, 0);
+		ret = -EFAULT;
+		goto out_unpin;
+	}
+	ubuf->nr_pages = nr_pages;
+
+	for (i = 0; i < ubuf->nr_pages; i++) {
+		ubuf->dma[i] = dma_map_page(&pdev->dev, ubuf->pages[i], 0,
+			PAGE_SIZE, ubuf->dir);
+		if (dma_mapping_error(&pdev->dev, ubuf->dma[i])) {
+			dnvme_err(ndev, "failed to map page%u for dma!\n", i);
+			ubuf->dma[i] = 0;
+			ret = -ENOMEM;
+			goto out_unpin;
+		}
+	}
+
+	ret = xa_insert(&ndev->ubufs, ubuf->id, ubuf, GFP_KERNEL);
+	if (ret < 0) {
+		dnvme_err(ndev, "failed to insert buffer:%u!(%d)\n",
+			ubuf->id, ret);
+		goto out_unpin;
+	}
+
+	dnvme_dbg(ndev, "buffer(%u) 0x%lx size:0x%x => nr_pages:0x%x\n",
+		ubuf->id, addr, ubuf->size, ubuf->nr_pages);
+	return 0;
+
+out_unpin:
+	dnvme_ubuf_unpin(ndev, ubuf);
+out_free_ubuf:
+	kvfree(ubuf->dma);
+	kvfree(ubuf->pages);
+	kfree(ubuf);
+	return ret;
+}
+
+int dnvme_unregister_buffer(struct nvme_device *ndev, u32 id)
+{
+	struct nvme_ubuf *ubuf;
+
+	ubuf = dnvme_find_ubuf(ndev, id);
+	if (!ubuf) {
+		dnvme_err(ndev, "buffer(%u) doesn't exist!\n", id);
+		return -EBADSLT;
+	}
+
+	if (atomic_read(&ubuf->ref)) {
+		dnvme_err(ndev, "buffer(%u) is used by %d cmds!\n", id,
+			atomic_read(&ubuf->ref));
+		return -EBUSY;
+	}
+
+	dnvme_delete_ubuf(ndev, ubuf);
+	return 0;
+}
+
+void dnvme_unregister_all_buffers(struct nvme_device *ndev)
+{
+	struct nvme_ubuf *ubuf;
+	unsigned long i;
+
+	xa_for_each(&ndev->ubufs, i, ubuf) {
+		WARN_ON(atomic_read(&ubuf->ref));
+		dnvme_delete_ubuf(ndev, ubuf);
+	}
+}
+
+/**
+ * @brief Build scatterlist of the command data from registered buffer.
+ *
+ * @param oft Offset of the command data in registered buffer
+ * @param size Size of the command data
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_map_ubuf(struct nvme_device *ndev, struct nvme_prps *prps,
+	u32 id, u32 oft, u32 size, enum dma_data_direction dir)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	struct nvme_ubuf *ubuf;
+	struct scatterlist *sgl;
+	u32 pg_idx, pg_oft, len;
+	u32 data_size = size;
+	int nr_pages;
+	int i;
+
+	ubuf = dnvme_find_ubuf(ndev, id);
+	if (!ubuf) {
+		dnvme_err(ndev, "buffer(%u) doesn't exist!\n", id);
+		return -EBADSLT;
+	}
+
+	if (!size || oft >= ubuf->size || size > ubuf->size - oft ||
+		!IS_ALIGNED(ubuf->addr + oft, 4)) {
+		dnvme_err(ndev, "buffer(%u) oft:0x%x size:0x%x is invalid!\n",
+			id, oft, size);
+		return -EINVAL;
+	}
+
+	if (dir != ubuf->dir && ubuf->dir != DMA_BIDIRECTIONAL) {
+		dnvme_err(ndev, "buffer(%u) is registered for dir:%d, not %d!\n",
+			id, ubuf->dir, dir);
+		return -EINVAL;
+	}
+
+	pg_idx = (ubuf->offset + oft) >> PAGE_SHIFT;
+	pg_oft = offset_in_page(ubuf->offset + oft);
+	nr_pages = DIV_ROUND_UP(pg_oft + size, PAGE_SIZE);
+
+	sgl = kmalloc_array(nr_pages, sizeof(*sgl), GFP_KERNEL);
+	if (!sgl) {
+		dnvme_err(ndev, "failed to alloc SGL!\n");
+		return -ENOMEM;
+	}
+	sg_init_table(sgl, nr_pages);
+
+	for (i = 0; i < nr_pages; i++, pg_idx++) {
+		len = min_t(u32, size, PAGE_SIZE - pg_oft);
+
+		sg_set_page(&sgl[i], ubuf->pages[pg_idx], len, pg_oft);
+		sg_dma_address(&sgl[i]) = ubuf->dma[pg_idx] + pg_oft;
+		sg_dma_len(&sgl[i]) = len;
+		dma_sync_single_range_for_device(&pdev->dev, ubuf->dma[pg_idx],
+			pg_oft, len, ubuf->dir);
+
+		size -= len;
+		pg_oft = 0;
+	}
+
+	atomic_inc(&ubuf->ref);
+
+	prps->sg = sgl;
+	prps->num_map_pgs = nr_pages;
+	prps->num_dma_segs = nr_pages;
+	prps->buf = NULL;
+	prps->data_dir = dir;
+	prps->data_buf_addr = ubuf->addr + oft;
+	prps->data_buf_size = data_size;
+	prps->ubuf = ubuf;
+
+	return 0;
+}
+
+void dnvme_unmap_ubuf(struct nvme_device *ndev, struct nvme_prps *prps)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	struct nvme_ubuf *ubuf = prps->ubuf;
+	struct scatterlist *sg;
+	u32 pg_idx;
+	int i;
+
+	pg_idx = (ubuf->offset + (prps->data_buf_addr - ubuf->addr)) >>
+		PAGE_SHIFT;
+
+	for_each_sg(prps->sg, sg, prps->num_map_pgs, i) {
+		dma_sync_single_range_for_cpu(&pdev->dev, ubuf->dma[pg_idx + i],
+			sg->offset, sg_dma_len(sg), ubuf->dir);
+	}
+
+	kfree(prps->sg);
+	prps->sg = NULL;
+	prps->ubuf = NULL;
+	atomic_dec(&ubuf->ref);
+}
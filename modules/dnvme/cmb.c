@@ -13,10 +13,8 @@
 #include <linux/module.h>
 #include <linux/pci.h>
 #include <linux/pci_regs.h>
-#include <linux/version.h>
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
-#include <linux/pci-p2pdma.h>
-#endif
+#include <linux/io.h>
+#include <linux/genalloc.h>
 
 #include "nvme.h"
 #include "io.h"
@@ -84,6 +82,16 @@ static int dnvme_cmb_parse_capability(struct nvme_cmb *cmb, u32 cmbsz, u32 cmblo
 	return 0;
 }
 
+/**
+ * @brief Restore the uncached kernel mapping of BAR where CMB is located.
+ */
+static void dnvme_cmb_unmap_wc(struct nvme_device *ndev, struct nvme_cmb *cmb)
+{
+	if (cmb->bar)
+		dnvme_remap_bar(ndev, cmb->bar, NVME_BAR_MAP_UC);
+	cmb->virt = NULL;
+}
+
 static int dnvme_cmb_setup(struct nvme_device *ndev, struct nvme_cmb *cmb)
 {
 	struct pci_dev *pdev = ndev->pdev;
@@ -136,17 +144,72 @@ static int dnvme_cmb_setup(struct nvme_device *ndev, struct nvme_cmb *cmb)
 	if (cmb->size > bar_size - cmb->offset)
 		cmb->size = bar_size - cmb->offset;
 
-	ret = pci_p2pdma_add_resource(pdev, cmb->bar, cmb->size, cmb->offset);
-	if (ret < 0) {
-		dnvme_err(ndev, "failed to add p2pdma resource!(%d)\n", ret);
-		return ret;
+	/*
+	 * Map CMB write-combining, so that commands copied to SQ are posted
+	 * in bursts instead of one uncached store per dword. The BAR is
+	 * remapped rather than aliased, which would stay uncached.
+	 */
+	if (cmb->bar) {
+		ret = dnvme_remap_bar(ndev, cmb->bar, NVME_BAR_MAP_WC);
+		if (ret < 0)
+			return ret;
+	} else {
+		dnvme_warn(ndev, "CMB shares BAR0 with registers, it's uncached!\n");
 	}
+	cmb->virt = ndev->bar[cmb->bar] + cmb->offset;
 
-	if ((cmbsz & (NVME_CMBSZ_WDS | NVME_CMBSZ_RDS)) == 
-				(NVME_CMBSZ_WDS | NVME_CMBSZ_RDS))
-		pci_p2pmem_publish(pdev, true);
+	cmb->pool = gen_pool_create(PAGE_SHIFT, dev_to_node(&pdev->dev));
+	if (!cmb->pool) {
+		dnvme_err(ndev, "failed to create CMB pool!\n");
+		ret = -ENOMEM;
+		goto out_unmap;
+	}
+
+	ret = gen_pool_add_virt(cmb->pool, (unsigned long)cmb->virt,
+		cmb->bus_addr + cmb->offset, cmb->size, dev_to_node(&pdev->dev));
+	if (ret < 0) {
+		dnvme_err(ndev, "failed to add CMB to pool!(%d)\n", ret);
+		goto out_destroy_pool;
+	}
 
 	return 0;
+
+out_destroy_pool:
+	gen_pool_destroy(cmb->pool);
+	cmb->pool = NULL;
+out_unmap:
+	dnvme_cmb_unmap_wc(ndev, cmb);
+	return ret;
+}
+
+/**
+ * @brief Allocate queue memory from CMB, which is mapped write-combining.
+ *
+ * @param dma Bus address of the allocated memory
+ * @return Kernel virtual address on success, otherwise NULL.
+ */
+void __iomem *dnvme_alloc_cmb(struct nvme_device *ndev, size_t size, 
+	dma_addr_t *dma)
+{
+	struct nvme_cmb *cmb = ndev->cmb;
+
+	if (!cmb || !cmb->pool)
+		return NULL;
+
+	return (void __iomem *)gen_pool_dma_alloc(cmb->pool, size, dma);
+}
+
+void dnvme_free_cmb(struct nvme_device *ndev, void __iomem *vaddr, size_t size)
+{
+	gen_pool_free(ndev->cmb->pool, (unsigned long)vaddr, size);
+}
+
+/**
+ * @brief Get the physical address of CMB memory by its bus address.
+ */
+phys_addr_t dnvme_cmb_phys_addr(struct nvme_cmb *cmb, dma_addr_t dma)
+{
+	return cmb->res_addr + (dma - cmb->bus_addr);
 }
 
 int dnvme_map_cmb(struct nvme_device *ndev)
@@ -188,10 +251,14 @@ out_free_cmb:
 
 void dnvme_unmap_cmb(struct nvme_device *ndev)
 {
-	if (!ndev->cmb)
+	struct nvme_cmb *cmb = ndev->cmb;
+
+	if (!cmb)
 		return;
-	
-	/* !TODO: Need do something more?(eg.remove resource) */
-	kfree(ndev->cmb);
+
+	/* queues in CMB shall be released before */
+	gen_pool_destroy(cmb->pool);
+	dnvme_cmb_unmap_wc(ndev, cmb);
+	kfree(cmb);
 	ndev->cmb = NULL;
 }
@@ -15,12 +15,16 @@
 #include <linux/scatterlist.h>
 #include <linux/vmalloc.h>
 #include <linux/sort.h>
+#include <linux/slab.h>
 
 #include "trace.h"
 #include "core.h"
 #include "queue.h"
 #include "debug.h"
 
+struct kmem_cache *dnvme_cmd_cache;
+struct kmem_cache *dnvme_prps_cache;
+
 struct sgl_desc_entry {
 	dma_addr_t	addr;
 	unsigned int	length;
@@ -71,7 +75,7 @@ void dnvme_sgl_set_seg(struct nvme_sgl_desc *sge, dma_addr_t dma_addr,
 	int entries)
 {
 	sge->addr = cpu_to_le64(dma_addr);
-	if (entries < NVME_SGES_PER_PAGE) {
+	if (entries <= NVME_SGES_PER_PAGE) {
 		sge->length = cpu_to_le32(entries * sizeof(*sge));
 		sge->type = NVME_SGL_TYPE_LAST_SEG_DESC << 4;
 	} else {
@@ -188,13 +192,14 @@ int dnvme_map_user_page(struct nvme_device *ndev, struct nvme_prps *prps,
 		goto out3;
 	} else if (ret != nr_pages) {
 		/* some pages may be contiguous */
-		dnvme_warn(ndev, "%d pages => %d sg\n", nr_pages, ret);
+		dnvme_vdbg(ndev, "%d pages => %d sg\n", nr_pages, ret);
 	}
 
 	kfree(pages);
 
 	prps->sg = sgl;
 	prps->num_map_pgs = nr_pages;
+	prps->num_dma_segs = ret;
 	prps->buf = buf;
 	prps->data_dir = dir;
 	prps->data_buf_addr = addr;
@@ -213,20 +218,113 @@ out:
 	return ret;
 }
 
+/**
+ * @brief Build scatterlist of the command data from the bvec iterator which
+ *  is imported from io_uring fixed buffer.
+ *
+ * @note Each page is referenced again, so that it can be released in the
+ *  same way as the page pinned down by dnvme_map_user_page().
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+static int dnvme_map_bvec(struct nvme_device *ndev, struct nvme_prps *prps,
+	struct iov_iter *iter, void __user *data, enum dma_data_direction dir)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	const struct bio_vec *bv = iter->bvec;
+	struct scatterlist *sgl;
+	size_t skip = iter->iov_offset;
+	size_t left = iov_iter_count(iter);
+	size_t len;
+	int nr_sg = 0;
+	int ret;
+	int i;
+
+	if (!iov_iter_is_bvec(iter) || !left || 
+		!IS_ALIGNED((unsigned long)data, 4)) {
+		dnvme_err(ndev, "fixed buffer 0x%lx size:0x%zx is invalid!\n",
+			(unsigned long)data, left);
+		return -EINVAL;
+	}
+
+	sgl = kmalloc_array(iter->nr_segs, sizeof(*sgl), GFP_KERNEL);
+	if (!sgl) {
+		dnvme_err(ndev, "failed to alloc SGL!\n");
+		return -ENOMEM;
+	}
+	sg_init_table(sgl, iter->nr_segs);
+
+	for (; left; bv++) {
+		if (skip >= bv->bv_len) {
+			skip -= bv->bv_len;
+			continue;
+		}
+		len = min_t(size_t, left, bv->bv_len - skip);
+
+		get_page(bv->bv_page);
+		sg_set_page(&sgl[nr_sg++], bv->bv_page, len, bv->bv_offset + skip);
+		left -= len;
+		skip = 0;
+	}
+	sg_mark_end(&sgl[nr_sg - 1]);
+
+	ret = dma_map_sg(&pdev->dev, sgl, nr_sg, dir);
+	if (ret <= 0) {
+		dnvme_err(ndev, "failed to map sg for dma!(%d)\n", ret);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	prps->sg = sgl;
+	prps->num_map_pgs = nr_sg;
+	prps->num_dma_segs = ret;
+	prps->buf = NULL;
+	prps->data_dir = dir;
+	prps->data_buf_addr = (unsigned long)data;
+	prps->data_buf_size = iov_iter_count(iter);
+
+	return 0;
+out:
+	for (i = 0; i < nr_sg; i++)
+		put_page(sg_page(&sgl[i]));
+	kfree(sgl);
+	return ret;
+}
+
 static int dnvme_cmd_map_user_page(struct nvme_device *ndev, 
 		struct nvme_64b_cmd *cmd,
 		struct nvme_common_command *ccmd, 
-		struct nvme_prps *prps)
+		struct nvme_prps *prps, struct iov_iter *iter)
 {
 	bool access = false;
+	int ret;
+
+	trace_dnvme_map_user_page_start(ndev, cmd->sqid, ccmd->command_id, 
+		cmd->data_buf_size);
+
+	if (iter) {
+		ret = dnvme_map_bvec(ndev, prps, iter, cmd->data_buf_ptr,
+				cmd->data_dir);
+		goto out;
+	}
+
+	if (cmd->use_reg_buf) {
+		ret = dnvme_map_ubuf(ndev, prps, cmd->buf_id, cmd->buf_oft, 
+				cmd->data_buf_size, cmd->data_dir);
+		goto out;
+	}
 
 	if (cmd->sqid == NVME_AQ_ID && (ccmd->opcode == nvme_admin_create_sq || 
 		ccmd->opcode == nvme_admin_create_cq)) {
 		access = true;
 	}
 
-	return dnvme_map_user_page(ndev, prps, cmd->data_buf_ptr, 
+	ret = dnvme_map_user_page(ndev, prps, cmd->data_buf_ptr, 
 				cmd->data_buf_size, cmd->data_dir, access);
+out:
+	trace_dnvme_map_user_page_end(ndev, cmd->sqid, ccmd->command_id, 
+		ret < 0 ? 0 : prps->num_dma_segs, ret);
+	return ret;
 }
 
 void dnvme_unmap_user_page(struct nvme_device *ndev, struct nvme_prps *prps)
@@ -238,6 +336,11 @@ void dnvme_unmap_user_page(struct nvme_device *ndev, struct nvme_prps *prps)
 	if (!prps)
 		return;
 
+	if (prps->ubuf) {
+		dnvme_unmap_ubuf(ndev, prps);
+		return;
+	}
+
 	if (prps->buf) {
 		vunmap(prps->buf);
 		prps->buf = NULL;
@@ -294,18 +397,19 @@ static void dnvme_sort_sgl_bit_bucket(struct nvme_device *ndev,
 }
 
 static int dnvme_count_sgl_desc_num(struct nvme_device *ndev, 
-	struct scatterlist *sg, struct nvme_sgl_bit_bucket *bit_bucket, 
-	unsigned int nr_bit_bucket)
+	struct scatterlist *sg, unsigned int nents, 
+	struct nvme_sgl_bit_bucket *bit_bucket, unsigned int nr_bit_bucket)
 {
 	struct scatterlist *sge;
 	unsigned int offset;
 	unsigned int i;
 	int num = 0;
+	int j;
 
 	for (i = 0; i < nr_bit_bucket; i++) {
 		offset = 0;
 
-		for (sge = sg; sge != NULL; sge = sg_next(sge)) {
+		for_each_sg(sg, sge, nents, j) {
 			/* Bit Bucket insert at the beginning or end of SG */
 			if (bit_bucket[i].offset == offset ||
 				bit_bucket[i].offset == (offset + sg_dma_len(sge))) {
@@ -316,21 +420,21 @@ static int dnvme_count_sgl_desc_num(struct nvme_device *ndev,
 		}
 
 		/* Bit Bucket insert in the middle of SG */
-		if (!sge)
+		if (j == nents)
 			num += 2;
 	}
 
-	for (sge = sg; sge != NULL; sge = sg_next(sge)) {
-		num += 1;
-	}
+	/* one data block descriptor per DMA segment */
+	num += nents;
 
 	dnvme_dbg(ndev, "need %d descriptors\n", num);
 	return num;
 }
 
 static struct sgl_desc_list *dnvme_init_sgl_desc_list(struct nvme_device *ndev, 
-	struct scatterlist *sg, struct nvme_sgl_bit_bucket *bit_bucket,
-	unsigned int nr_bit_bucket, unsigned int nr_desc)
+	struct scatterlist *sg, unsigned int nents, 
+	struct nvme_sgl_bit_bucket *bit_bucket, unsigned int nr_bit_bucket, 
+	unsigned int nr_desc)
 {
 	struct scatterlist *sge;
 	struct sgl_desc_list *list;
@@ -341,6 +445,7 @@ static struct sgl_desc_list *dnvme_init_sgl_desc_list(struct nvme_device *ndev,
 	unsigned int desc = 0;
 	unsigned int bit;
 	dma_addr_t sg_addr;
+	int i;
 
 	list = kzalloc(sizeof(struct sgl_desc_list) + 
 		nr_desc * sizeof(struct sgl_desc_entry), GFP_KERNEL);
@@ -361,7 +466,7 @@ static struct sgl_desc_list *dnvme_init_sgl_desc_list(struct nvme_device *ndev,
 		last_bit_offset = bit_bucket[bit].offset;
 	}
 
-	for (sge = sg; sge; sge = sg_next(sge)) {
+	for_each_sg(sg, sge, nents, i) {
 		sg_addr = sg_dma_address(sge);
 		sg_len = sg_dma_len(sge);
 		sg_oft = 0;
@@ -461,7 +566,6 @@ static int dnvme_cmd_setup_sgl(struct nvme_device *ndev,
 		struct nvme_common_command *ccmd, 
 		struct nvme_prps *prps)
 {
-	struct dma_pool *pool = prps->pg_pool;
 	struct nvme_sgl_desc *sgl_desc;
 	struct nvme_sgl_bit_bucket *bit_bucket;
 	struct sgl_desc_list *desc_list;
@@ -469,8 +573,8 @@ static int dnvme_cmd_setup_sgl(struct nvme_device *ndev,
 	dma_addr_t *prp_dma;
 	/* The number of SGL bit bucket descriptors required */
 	unsigned int nr_bit_bucket = cmd->nr_bit_bucket;
-	/* The number of SGL descriptors required */
-	unsigned int nr_desc = prps->num_map_pgs; 
+	/* The number of SGL descriptors required, one per DMA segment */
+	unsigned int nr_desc = prps->num_dma_segs; 
 	unsigned int nr_seg; /* The number of SGL segments required */
 	int ret = -ENOMEM;
 	int i, j, k, m;
@@ -496,19 +600,18 @@ static int dnvme_cmd_setup_sgl(struct nvme_device *ndev,
 		}
 		dnvme_sort_sgl_bit_bucket(ndev, bit_bucket, nr_bit_bucket);
 
-		nr_desc = dnvme_count_sgl_desc_num(ndev, prps->sg, bit_bucket, 
-			nr_bit_bucket);
+		nr_desc = dnvme_count_sgl_desc_num(ndev, prps->sg, 
+			prps->num_dma_segs, bit_bucket, nr_bit_bucket);
 	}
-	desc_list = dnvme_init_sgl_desc_list(ndev, prps->sg, bit_bucket, 
-		nr_bit_bucket, nr_desc);
+	desc_list = dnvme_init_sgl_desc_list(ndev, prps->sg, prps->num_dma_segs,
+		bit_bucket, nr_bit_bucket, nr_desc);
 	if (!desc_list) {
 		ret = -EPERM;
 		goto free_bit_bucket;
 	}
 	prps->nr_entry = nr_desc;
 	
-	nr_seg = DIV_ROUND_UP(sizeof(struct nvme_sgl_desc) * nr_desc, 
-		PAGE_SIZE - sizeof(struct nvme_sgl_desc));
+	nr_seg = dnvme_nr_list_pages(nr_desc, NVME_SGES_PER_PAGE);
 
 	prp_list = kzalloc(sizeof(void *) * nr_seg, GFP_KERNEL);
 	if (!prp_list) {
@@ -523,7 +626,7 @@ static int dnvme_cmd_setup_sgl(struct nvme_device *ndev,
 	}
 
 	for (i = 0; i < nr_seg; i++) {
-		prp_list[i] = dma_pool_alloc(pool, GFP_KERNEL | __GFP_ZERO, &prp_dma[i]);
+		prp_list[i] = dnvme_alloc_prp_page(prps, &prp_dma[i]);
 		if (!prp_list[i]) {
 			dnvme_err(ndev, "failed to alloc for sgl page!\n");
 			goto free_sgl_page;
@@ -541,7 +644,7 @@ static int dnvme_cmd_setup_sgl(struct nvme_device *ndev,
 
 		sgl_desc = prp_list[j];
 
-		if (k == (NVME_SGES_PER_PAGE - 1)) {
+		if (k == (NVME_SGES_PER_PAGE - 1) && nr_desc > 1) {
 			/* SGL segment last descriptor pointer to next SGL segment */
 			j++;
 			dnvme_sgl_set_seg(&sgl_desc[k], prp_dma[j], nr_desc);
@@ -568,7 +671,7 @@ static int dnvme_cmd_setup_sgl(struct nvme_device *ndev,
 	return 0;
 free_sgl_page:
 	for (i--; i >= 0; i--) {
-		dma_pool_free(pool, prp_list[i], prp_dma[i]);
+		dnvme_free_prp_page(prps, prp_list[i], prp_dma[i]);
 	}
 	kfree(prp_dma);
 free_prp_list:
@@ -661,7 +764,6 @@ out:
 #endif
 static void dnvme_free_prp_list(struct nvme_device *ndev, struct nvme_prps *prps)
 {
-	struct dma_pool *pool = prps->pg_pool;
 	int i;
 
 	if (!prps)
@@ -669,7 +771,7 @@ static void dnvme_free_prp_list(struct nvme_device *ndev, struct nvme_prps *prps
 
 	if (prps->prp_list) {
 		for (i = 0; i < prps->nr_pages; i++)
-			dma_pool_free(pool, prps->prp_list[i], prps->pg_addr[i]);
+			dnvme_free_prp_page(prps, prps->prp_list[i], prps->pg_addr[i]);
 
 		kfree(prps->pg_addr);
 		prps->pg_addr = NULL;
@@ -686,7 +788,6 @@ static int dnvme_setup_prps(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
 	struct scatterlist *sg = prps->sg;
 	void **prp_list;
 	dma_addr_t *prp_dma;
-	struct dma_pool *pool = prps->pg_pool;
 	__le64 *prp_entry;
 	int buf_len = prps->data_buf_size;
 	u32 nr_pages, nr_entry, pg_oft;
@@ -749,8 +850,7 @@ static int dnvme_setup_prps(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
 
 prp_list:
 	nr_entry = DIV_ROUND_UP(pg_oft + buf_len, PAGE_SIZE);
-	nr_pages = DIV_ROUND_UP(NVME_PRP_ENTRY_SIZE * nr_entry, 
-		PAGE_SIZE - NVME_PRP_ENTRY_SIZE);
+	nr_pages = dnvme_nr_list_pages(nr_entry, NVME_PRPS_PER_PAGE);
 	
 	prp_list = kzalloc(sizeof(void *) * nr_pages, GFP_KERNEL);
 	if (!prp_list) {
@@ -765,7 +865,7 @@ prp_list:
 	}
 
 	for (i = 0; i < nr_pages; i++) {
-		prp_list[i] = dma_pool_alloc(pool, GFP_KERNEL | __GFP_ZERO, &prp_dma[i]);
+		prp_list[i] = dnvme_alloc_prp_page(prps, &prp_dma[i]);
 		if (!prp_list[i]) {
 			dnvme_err(ndev, "failed to alloc for prp page!\n");
 			goto out2;
@@ -790,7 +890,9 @@ prp_list:
 
 		prp_entry = prp_list[j];
 
-		if (k == (NVME_PRPS_PER_PAGE - 1)) {
+		/* the last slot holds data if only one entry remains */
+		if (k == (NVME_PRPS_PER_PAGE - 1) && 
+			buf_len > (int)(PAGE_SIZE - pg_oft)) {
 			/* PRP list last entry pointer to next PRP list */
 			j++;
 			prp_entry[k] = cpu_to_le64(prp_dma[j]);
@@ -828,7 +930,7 @@ prp_list:
 	return 0;
 out2:
 	for (i--; i >= 0; i--) {
-		dma_pool_free(pool, prp_list[i], prp_dma[i]);
+		dnvme_free_prp_page(prps, prp_list[i], prp_dma[i]);
 	}
 	kfree(prp_dma);
 out:
@@ -850,16 +952,23 @@ static int dnvme_add_cmd_node(struct nvme_device *ndev, struct nvme_64b_cmd *cmd
 		return -EBADSLT;
 	}
 
-	node = kzalloc(sizeof(*node), GFP_KERNEL);
-	if (!node) {
-		dnvme_err(ndev, "failed to alloc cmd node!\n");
-		return -ENOMEM;
+	if (sq->cmd_nodes) {
+		node = &sq->cmd_nodes[ccmd->command_id];
+		memset(node, 0, sizeof(*node));
+	} else {
+		node = kmem_cache_zalloc(dnvme_cmd_cache, GFP_KERNEL);
+		if (!node) {
+			dnvme_err(ndev, "failed to alloc cmd node!\n");
+			return -ENOMEM;
+		}
 	}
 
 	node->cid = ccmd->command_id;
 	node->opcode = ccmd->opcode;
 	node->sqid = cmd->sqid;
 	node->idx = sq->pub.tail_ptr_virt;
+	node->stamp = 0;
+	node->ioucmd = NULL;
 
 	if (cmd->sqid == NVME_AQ_ID) {
 		struct nvme_create_sq *csq;
@@ -907,14 +1016,17 @@ static int dnvme_add_cmd_node(struct nvme_device *ndev, struct nvme_64b_cmd *cmd
 	}
 
 out_add_node:
-	list_add_tail(&node->entry, &sq->cmd_list);
+	sq->cmds[node->cid] = node;
+	sq->next_cid = (node->cid + 1) % sq->pub.elements;
 	return 0;
 }
 
 static int dnvme_prepare_64b_cmd(struct nvme_device *ndev, 
-	struct nvme_64b_cmd *cmd, struct nvme_common_command *ccmd)
+	struct nvme_64b_cmd *cmd, struct nvme_common_command *ccmd,
+	struct iov_iter *iter)
 {
 	struct nvme_prps *prps;
+	struct nvme_sq *sq = NULL;
 	struct dma_pool *pool = NULL;
 	bool need_prp = false;
 	int ret;
@@ -923,6 +1035,10 @@ static int dnvme_prepare_64b_cmd(struct nvme_device *ndev,
 		switch (ccmd->opcode) {
 		case nvme_admin_create_sq:
 		case nvme_admin_create_cq:
+			if (cmd->use_reg_buf) {
+				dnvme_err(ndev, "registered buffer can't be used as queue!\n");
+				return -EINVAL;
+			}
 			if (cmd->data_buf_ptr) { /* discontig */
 				need_prp = true;
 				pool = ndev->queue_pool;
@@ -934,25 +1050,37 @@ static int dnvme_prepare_64b_cmd(struct nvme_device *ndev,
 			break;
 
 		default:
-			if (cmd->data_buf_ptr)
+			if (cmd->data_buf_ptr || cmd->use_reg_buf)
 				need_prp = true;
 		}
 	} else {
-		if (cmd->data_buf_ptr)
+		if (cmd->data_buf_ptr || cmd->use_reg_buf)
 			need_prp = true;
 	}
 
 	if (!need_prp)
 		return dnvme_add_cmd_node(ndev, cmd, ccmd, NULL);
 
-	prps = kzalloc(sizeof(*prps), GFP_KERNEL);
+	/*
+	 * PRPs of discontiguous queue is owned by the waiting queue after
+	 * command completion, so it can't use the slot preallocated by SQ.
+	 */
+	if (!pool)
+		sq = dnvme_find_sq(ndev, cmd->sqid);
+
+	prps = dnvme_alloc_prps(sq, ccmd->command_id);
 	if (!prps) {
 		dnvme_err(ndev, "failed to alloc PRPs!\n");
 		return -ENOMEM;
 	}
-	prps->pg_pool = pool ? pool : ndev->cmd_pool;
+	if (!pool) {
+		pool = ndev->cmd_pool;
+		if (sq)
+			prps->node_pool = sq->node_pool;
+	}
+	prps->pg_pool = pool;
 
-	ret = dnvme_cmd_map_user_page(ndev, cmd, ccmd, prps);
+	ret = dnvme_cmd_map_user_page(ndev, cmd, ccmd, prps, iter);
 	if (ret < 0)
 		goto out_free_prp;
 
@@ -966,6 +1094,7 @@ static int dnvme_prepare_64b_cmd(struct nvme_device *ndev,
 
 	if (ret < 0)
 		goto out_unmap_page;
+	dnvme_sync_prp_pages(prps);
 
 	ret = dnvme_add_cmd_node(ndev, cmd, ccmd, prps);
 	if (ret < 0)
@@ -978,15 +1107,52 @@ out_free_prp_list:
 out_unmap_page:
 	dnvme_unmap_user_page(ndev, prps);
 out_free_prp:
-	kfree(prps);
+	dnvme_free_prps(prps);
 	return ret;	
 }
 
+/**
+ * @brief Allocate PRPs for the command.
+ *
+ * @param sq The submission queue where the command resides. If it's NULL or
+ *  SQ has no preallocated PRPs, allocate from dnvme_prps_cache.
+ * @param cid command identify
+ * @return pointer to the zeroed PRPs on success, otherwise returns NULL.
+ */
+struct nvme_prps *dnvme_alloc_prps(struct nvme_sq *sq, u16 cid)
+{
+	struct nvme_prps *prps;
+
+	if (sq && sq->prps_nodes) {
+		prps = &sq->prps_nodes[cid];
+		memset(prps, 0, sizeof(*prps));
+		prps->pooled = 1;
+		return prps;
+	}
+
+	return kmem_cache_zalloc(dnvme_prps_cache, GFP_KERNEL);
+}
+
+void dnvme_free_prps(struct nvme_prps *prps)
+{
+	if (prps && !prps->pooled)
+		kmem_cache_free(dnvme_prps_cache, prps);
+}
+
 void dnvme_release_prps(struct nvme_device *ndev, struct nvme_prps *prps)
 {
+	if (!prps)
+		return;
+
 	dnvme_free_prp_list(ndev, prps);
 	dnvme_unmap_user_page(ndev, prps);
-	kfree(prps);
+	dnvme_free_prps(prps);
+}
+
+void dnvme_free_cmd_node(struct nvme_sq *sq, struct nvme_cmd *cmd)
+{
+	if (!sq->cmd_nodes)
+		kmem_cache_free(dnvme_cmd_cache, cmd);
 }
 
 /**
@@ -998,18 +1164,45 @@ void dnvme_release_prps(struct nvme_device *ndev, struct nvme_prps *prps)
 void dnvme_delete_cmd_list(struct nvme_device *ndev, struct nvme_sq *sq)
 {
 	struct nvme_cmd *cmd;
-	struct list_head *pos, *tmp;
+	u32 i;
 
-	list_for_each_safe(pos, tmp, &sq->cmd_list) {
-		cmd = list_entry(pos, struct nvme_cmd, entry);
-		list_del(pos);
+	for (i = 0; i < sq->pub.elements; i++) {
+		cmd = sq->cmds[i];
+		if (!cmd)
+			continue;
 
+		sq->cmds[i] = NULL;
+		if (cmd->ioucmd)
+			dnvme_uring_cmd_end(ndev, cmd, -ECANCELED, 0);
 		dnvme_release_prps(ndev, cmd->prps);
 		cmd->prps = NULL;
-		kfree(cmd);
+		dnvme_free_cmd_node(sq, cmd);
 	}
 }
 
+int dnvme_create_cmd_cache(void)
+{
+	dnvme_cmd_cache = KMEM_CACHE(nvme_cmd, 0);
+	if (!dnvme_cmd_cache)
+		return -ENOMEM;
+
+	dnvme_prps_cache = KMEM_CACHE(nvme_prps, 0);
+	if (!dnvme_prps_cache) {
+		kmem_cache_destroy(dnvme_cmd_cache);
+		dnvme_cmd_cache = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void dnvme_destroy_cmd_cache(void)
+{
+	kmem_cache_destroy(dnvme_prps_cache);
+	dnvme_prps_cache = NULL;
+	kmem_cache_destroy(dnvme_cmd_cache);
+	dnvme_cmd_cache = NULL;
+}
+
 static int dnvme_create_iosq(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
 	struct nvme_common_command *ccmd)
 {
@@ -1040,7 +1233,7 @@ static int dnvme_create_iosq(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
 		return -EPERM;
 	}
 
-	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd);
+	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd, NULL);
 	if (ret < 0) {
 		dnvme_err(ndev, "failed to prepare 64-byte cmd!\n");
 		return ret;
@@ -1060,7 +1253,7 @@ static int dnvme_delete_iosq(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
 {
 	int ret;
 
-	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd);
+	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd, NULL);
 	if (ret < 0) {
 		dnvme_err(ndev, "failed to prepare 64-byte cmd!\n");
 		return ret;
@@ -1107,7 +1300,7 @@ static int dnvme_create_iocq(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
 		}
 	}
 
-	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd);
+	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd, NULL);
 	if (ret < 0) {
 		dnvme_err(ndev, "failed to prepare 64-byte cmd!\n");
 		return ret;
@@ -1127,7 +1320,7 @@ static int dnvme_delete_iocq(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
 {
 	int ret;
 
-	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd);
+	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd, NULL);
 	if (ret < 0) {
 		dnvme_err(ndev, "failed to prepare 64-byte cmd!\n");
 		return ret;
@@ -1136,11 +1329,11 @@ static int dnvme_delete_iocq(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
 }
 
 static int dnvme_deal_ccmd(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
-	struct nvme_common_command *ccmd)
+	struct nvme_common_command *ccmd, struct iov_iter *iter)
 {
 	int ret;
 
-	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd);
+	ret = dnvme_prepare_64b_cmd(ndev, cmd, ccmd, iter);
 	if (ret < 0) {
 		dnvme_err(ndev, "failed to prepare 64-byte cmd!\n");
 		return ret;
@@ -1169,134 +1362,245 @@ static int dnvme_fill_mptr(struct nvme_device *ndev,
 	return 0;
 }
 
-int dnvme_submit_64b_cmd(struct nvme_device *ndev, struct nvme_64b_cmd __user *ucmd)
+/**
+ * @brief Copy the command to SQ, and the assigned command identifier is saved
+ *  in @cmd->cid.
+ *
+ * @param iter Data buffer imported from io_uring, NULL if the data buffer
+ *  is specified by @cmd.
+ * @note The caller shall hold SQ lock.
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+int __dnvme_submit_64b_cmd(struct nvme_device *ndev, struct nvme_sq *sq, 
+	struct nvme_64b_cmd *cmd, struct iov_iter *iter)
 {
-	struct nvme_sq *sq;
-	struct nvme_64b_cmd cmd;
 	struct nvme_common_command *ccmd;
-	struct pci_dev *pdev = ndev->pdev;
-	void *cmd_buf;
 	int ret = 0;
 
-	if (copy_from_user(&cmd, ucmd, sizeof(cmd))) {
-		dnvme_err(ndev, "failed to copy from user space!\n");
-		return -EFAULT;
-	}
-
-	if (!cmd.cmd_buf_ptr) {
+	if (!cmd->cmd_buf_ptr) {
 		dnvme_err(ndev, "cmd buf ptr is NULL!\n");
 		return -EFAULT;
 	}
 
-	if ((cmd.data_buf_size && !cmd.data_buf_ptr) || 
-		(!cmd.data_buf_size && cmd.data_buf_ptr)) {
+	if (!cmd->use_reg_buf && ((cmd->data_buf_size && !cmd->data_buf_ptr) || 
+		(!cmd->data_buf_size && cmd->data_buf_ptr))) {
 		dnvme_err(ndev, "data buf size and ptr are inconsistent!\n");
 		return -EINVAL;
 	}
 
-	/* Get the SQ for sending this command */
-	sq = dnvme_find_sq(ndev, cmd.sqid);
-	if (!sq) {
-		dnvme_err(ndev, "SQ(%u) doesn't exist!\n", cmd.sqid);
-		return -EBADSLT;
+	if (sq->user_own) {
+		dnvme_err(ndev, "SQ(%u) is owned by user!\n", cmd->sqid);
+		return -EPERM;
 	}
 
 	if (dnvme_sq_is_full(sq)) {
-		dnvme_err(ndev, "SQ(%u) is full!\n", cmd.sqid);
+		dnvme_err(ndev, "SQ(%u) is full!\n", cmd->sqid);
 		return -EBUSY;
 	}
 
-	cmd_buf = kzalloc(1 << sq->pub.sqes, GFP_KERNEL);
-	if (!cmd_buf) {
-		dnvme_err(ndev, "failed to alloc cmd buf!\n");
-		return -ENOMEM;
-	}
-
-	if (copy_from_user(cmd_buf, cmd.cmd_buf_ptr, 1 << sq->pub.sqes)) {
+	if (copy_from_user(sq->cmd_buf, cmd->cmd_buf_ptr, 1 << sq->pub.sqes)) {
 		dnvme_err(ndev, "failed to copy from user space!\n");
-		ret = -EFAULT;
-		goto out;
+		return -EFAULT;
 	}
 
-	ccmd = (struct nvme_common_command *)cmd_buf;
-
-	cmd.cid = sq->next_cid++;
-	ccmd->command_id = cmd.cid;
+	ccmd = (struct nvme_common_command *)sq->cmd_buf;
 
-	if (copy_to_user(ucmd, &cmd, sizeof(cmd))) {
-		dnvme_err(ndev, "failed to copy to user space!\n");
-		ret = -EFAULT;
-		goto out;
+	ret = dnvme_get_free_cid(sq);
+	if (ret < 0) {
+		dnvme_err(ndev, "SQ(%u) has no free cid!\n", cmd->sqid);
+		return ret;
 	}
+	cmd->cid = ret;
+	ccmd->command_id = cmd->cid;
 
-	if (cmd.bit_mask & NVME_MASK_MPTR) {
-		ret = dnvme_fill_mptr(ndev, ccmd, cmd.meta_id);
+	if (cmd->bit_mask & NVME_MASK_MPTR) {
+		ret = dnvme_fill_mptr(ndev, ccmd, cmd->meta_id);
 		if (ret < 0)
-			goto out;
+			return ret;
 	}
 
-	if (cmd.sqid == NVME_AQ_ID) {
+	if (cmd->sqid == NVME_AQ_ID) {
 		switch (ccmd->opcode) {
 		case nvme_admin_delete_sq:
-			ret = dnvme_delete_iosq(ndev, &cmd, ccmd);
+			ret = dnvme_delete_iosq(ndev, cmd, ccmd);
 			if (ret < 0)
-				goto out2;
+				return ret;
 			break;
 
 		case nvme_admin_create_sq:
-			ret = dnvme_create_iosq(ndev, &cmd, ccmd);
+			ret = dnvme_create_iosq(ndev, cmd, ccmd);
 			if (ret < 0)
-				goto out2;
+				return ret;
 			break;
 
 		case nvme_admin_delete_cq:
-			ret = dnvme_delete_iocq(ndev, &cmd, ccmd);
+			ret = dnvme_delete_iocq(ndev, cmd, ccmd);
 			if (ret < 0)
-				goto out2;
+				return ret;
 			break;
 
 		case nvme_admin_create_cq:
-			ret = dnvme_create_iocq(ndev, &cmd, ccmd);
+			ret = dnvme_create_iocq(ndev, cmd, ccmd);
 			if (ret < 0)
-				goto out2;
+				return ret;
+			break;
+
+		case nvme_admin_dbbuf:
+			ret = dnvme_dbbuf_fill_cmd(ndev, cmd, ccmd);
+			if (ret < 0)
+				return ret;
+			ret = dnvme_deal_ccmd(ndev, cmd, ccmd, NULL);
+			if (ret < 0)
+				return ret;
 			break;
 
 		default:
-			ret = dnvme_deal_ccmd(ndev, &cmd, ccmd);
+			ret = dnvme_deal_ccmd(ndev, cmd, ccmd, NULL);
 			if (ret < 0)
-				goto out2;
+				return ret;
 			break;
 		}
 	} else {
-		ret = dnvme_deal_ccmd(ndev, &cmd, ccmd);
+		ret = dnvme_deal_ccmd(ndev, cmd, ccmd, iter);
 		if (ret < 0)
-			goto out2;
+			return ret;
 	}
-	trace_dnvme_submit_64b_cmd(&ndev->dev, ccmd, cmd.sqid);
+	trace_dnvme_submit_64b_cmd(&ndev->dev, ccmd, cmd->sqid);
 
 	/* Copying the command in to appropriate SQ and handling sync issues */
 	if (sq->contig) {
-		memcpy((sq->buf + ((u32)sq->pub.tail_ptr_virt << sq->pub.sqes)),
-			ccmd, 1 << sq->pub.sqes);
+		dnvme_sq_copy_cmd(sq, sq->pub.tail_ptr_virt, ccmd);
 	} else {
 		struct nvme_prps *prps = sq->prps;
 
 		memcpy((prps->buf + 
 			((u32)sq->pub.tail_ptr_virt << sq->pub.sqes)),
 			ccmd, 1 << sq->pub.sqes);
-		dma_sync_sg_for_device(&pdev->dev, prps->sg, 
-			prps->num_map_pgs, prps->data_dir);
 	}
+	dnvme_sync_sq_entry(sq, sq->pub.tail_ptr_virt);
 
 	/* Increment the Tail pointer and handle roll over conditions */
 	sq->pub.tail_ptr_virt = (u16)(((u32)sq->pub.tail_ptr_virt + 1) % sq->pub.elements);
 
-	kfree(cmd_buf);
 	return 0;
-out2:
-	sq->next_cid--;
+}
+
+int dnvme_submit_64b_cmd(struct nvme_device *ndev, struct nvme_64b_cmd __user *ucmd)
+{
+	struct nvme_64b_cmd cmd;
+	struct nvme_sq *sq;
+	int ret;
+
+	if (copy_from_user(&cmd, ucmd, sizeof(cmd))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	dnvme_lock_device_for_queue(ndev, cmd.sqid);
+
+	/* Get the SQ for sending this command */
+	sq = dnvme_find_sq(ndev, cmd.sqid);
+	if (!sq) {
+		dnvme_err(ndev, "SQ(%u) doesn't exist!\n", cmd.sqid);
+		ret = -EBADSLT;
+		goto out;
+	}
+
+	mutex_lock(&sq->lock);
+	ret = __dnvme_submit_64b_cmd(ndev, sq, &cmd, NULL);
+	mutex_unlock(&sq->lock);
+	if (ret < 0)
+		goto out;
+
+	if (put_user(cmd.cid, &ucmd->cid)) {
+		dnvme_err(ndev, "failed to copy to user space!\n");
+		ret = -EFAULT;
+	}
+out:
+	dnvme_unlock_device_for_queue(ndev, cmd.sqid);
+	return ret;
+}
+
+/**
+ * @brief Submit a batch of commands to the same SQ
+ *
+ * @note Each command is submitted independently, the failure of one command
+ *  doesn't stop submitting the rest. 
+ *
+ * @return 0 if all commands are submitted, otherwise the first negative errno.
+ */
+int dnvme_submit_64b_cmd_batch(struct nvme_device *ndev, 
+	struct nvme_64b_cmd_batch __user *ubatch)
+{
+	struct nvme_64b_cmd_batch batch;
+	struct nvme_64b_cmd cmd;
+	struct nvme_sq *sq;
+	u32 i;
+	int ret = 0;
+	int err;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	if (!batch.nr_cmd || !batch.cmds) {
+		dnvme_err(ndev, "cmd array is empty!\n");
+		return -EINVAL;
+	}
+
+	dnvme_lock_device_for_queue(ndev, batch.sqid);
+
+	sq = dnvme_find_sq(ndev, batch.sqid);
+	if (!sq) {
+		dnvme_err(ndev, "SQ(%u) doesn't exist!\n", batch.sqid);
+		ret = -EBADSLT;
+		goto out;
+	}
+
+	mutex_lock(&sq->lock);
+	batch.submitted = 0;
+
+	for (i = 0; i < batch.nr_cmd; i++) {
+		if (copy_from_user(&cmd, &batch.cmds[i], sizeof(cmd))) {
+			dnvme_err(ndev, "failed to copy from user space!\n");
+			err = -EFAULT;
+			goto next;
+		}
+		cmd.sqid = batch.sqid;
+
+		err = __dnvme_submit_64b_cmd(ndev, sq, &cmd, NULL);
+		if (err < 0)
+			goto next;
+
+		batch.submitted++;
+		if (put_user(cmd.cid, &batch.cmds[i].cid)) {
+			dnvme_err(ndev, "failed to copy to user space!\n");
+			err = -EFAULT;
+		}
+next:
+		if (err < 0 && !ret)
+			ret = err;
+
+		if (batch.status && put_user(err, &batch.status[i])) {
+			dnvme_err(ndev, "failed to copy to user space!\n");
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	if (batch.ring_db && batch.submitted)
+		__dnvme_ring_sq_doorbell(sq);
+
+	mutex_unlock(&sq->lock);
+
+	if (put_user(batch.submitted, &ubatch->submitted)) {
+		dnvme_err(ndev, "failed to copy to user space!\n");
+		ret = -EFAULT;
+	}
 out:
-	kfree(cmd_buf);
+	dnvme_unlock_device_for_queue(ndev, batch.sqid);
 	return ret;
 }
 
@@ -1328,7 +1632,11 @@ static int dnvme_tamper_cmd_fetch_cmd(struct nvme_sq *sq, struct nvme_cmd *cmd,
 	struct nvme_cmd_tamper *tamper)
 {
 	WARN_ON(sizeof(tamper->cmd) != (1 << sq->pub.sqes));
-	if (sq->contig) {
+	if (sq->use_cmb) {
+		memcpy_fromio(&tamper->cmd, 
+			(void __iomem *)(sq->buf + ((u32)cmd->idx << sq->pub.sqes)),
+			sizeof(tamper->cmd));
+	} else if (sq->contig) {
 		memcpy(&tamper->cmd, (sq->buf + ((u32)cmd->idx << sq->pub.sqes)), 
 			sizeof(tamper->cmd));
 	} else {
@@ -1388,20 +1696,16 @@ static int dnvme_tamper_cmd_fetch_sgl_seg(struct nvme_cmd *cmd, void *data)
 static int dnvme_tamper_cmd_modify_cmd(struct nvme_sq *sq, struct nvme_cmd *cmd,
 	struct nvme_cmd_tamper *tamper)
 {
-	struct pci_dev *pdev = sq->ndev->pdev;
-
 	WARN_ON(sizeof(tamper->cmd) != (1 << sq->pub.sqes));
 	if (sq->contig) {
-		memcpy((sq->buf + ((u32)cmd->idx << sq->pub.sqes)), 
-			&tamper->cmd, sizeof(tamper->cmd));
+		dnvme_sq_copy_cmd(sq, cmd->idx, &tamper->cmd);
 	} else {
 		struct nvme_prps *prps = sq->prps;
 
 		memcpy((prps->buf + ((u32)cmd->idx << sq->pub.sqes)), 
 			&tamper->cmd, sizeof(tamper->cmd));
-		dma_sync_sg_for_device(&pdev->dev, prps->sg, 
-			prps->num_map_pgs, prps->data_dir);
 	}
+	dnvme_sync_sq_entry(sq, cmd->idx);
 	return 0;
 }
 
@@ -1421,10 +1725,12 @@ static int dnvme_tamper_cmd_modify_prp_list(struct nvme_cmd *cmd, void *data)
 		for (j = 0; j < NVME_PRPS_PER_PAGE; j++) {
 			ptr[j] = cpu_to_le64(list->entry[cnt]);
 			if (++cnt >= prps->nr_entry)
-				return 0;
+				goto out;
 		}
 	}
 
+out:
+	dnvme_sync_prp_pages(prps);
 	return 0;
 }
 
@@ -1444,10 +1750,12 @@ static int dnvme_tamper_cmd_modify_sgl_seg(struct nvme_cmd *cmd, void *data)
 		for (j = 0; i < NVME_SGES_PER_PAGE; j++) {
 			ptr[j] = seg->desc[cnt];
 			if (++cnt >= prps->nr_entry)
-				return 0;
+				goto out;
 		}
 	}
 
+out:
+	dnvme_sync_prp_pages(prps);
 	return 0;
 }
 
@@ -1612,6 +1920,7 @@ out:
 int dnvme_tamper_cmd(struct nvme_device *ndev, struct nvme_cmd_tamper __user *utamper)
 {
 	struct nvme_cmd_tamper tamper;
+	struct nvme_sq *sq;
 	int ret;
 
 	if (copy_from_user(&tamper, utamper, sizeof(tamper))) {
@@ -1619,6 +1928,22 @@ int dnvme_tamper_cmd(struct nvme_device *ndev, struct nvme_cmd_tamper __user *ut
 		return -EFAULT;
 	}
 
+	dnvme_lock_device_for_queue(ndev, tamper.sqid);
+
+	sq = dnvme_find_sq(ndev, tamper.sqid);
+	if (!sq) {
+		dnvme_err(ndev, "SQ(%u) doesn't exist!\n", tamper.sqid);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (sq->user_own) {
+		dnvme_err(ndev, "SQ(%u) is owned by user!\n", tamper.sqid);
+		ret = -EPERM;
+		goto out;
+	}
+	mutex_lock(&sq->lock);
+
 	switch (tamper.option) {
 	case NVME_TAMPER_OPT_INQUIRY:
 		ret = dnvme_tamper_cmd_inquiry(ndev, &tamper, utamper);
@@ -1637,6 +1962,9 @@ int dnvme_tamper_cmd(struct nvme_device *ndev, struct nvme_cmd_tamper __user *ut
 		ret = -EINVAL;
 	}
 
+	mutex_unlock(&sq->lock);
+out:
+	dnvme_unlock_device_for_queue(ndev, tamper.sqid);
 	return ret;
 }
 
@@ -51,7 +51,7 @@ static struct class *nvme_class;
  *  
  * @return &struct nvme_device on success, or ERR_PTR() on error. 
  */
-static struct nvme_device *find_device(int instance)
+struct nvme_device *dnvme_find_device(int instance)
 {
 	struct nvme_device *ndev;
 
@@ -61,9 +61,16 @@ static struct nvme_device *find_device(int instance)
 			return ndev;
 		}
 	}
+	pr_err("Cannot find the device with instance %d!\n", instance);
 	return ERR_PTR(-ENODEV);
 }
 
+static void __dnvme_lock_device(struct nvme_device *ndev)
+{
+	mutex_lock(&ndev->lock);
+	down_write(&ndev->queue_sem);
+}
+
 /**
  * @brief Lock the mutex if find nvme_device.
  * 
@@ -73,25 +80,62 @@ struct nvme_device *dnvme_lock_device(int instance)
 {
 	struct nvme_device *ndev;
 
-	ndev = find_device(instance);
-	if (IS_ERR(ndev)) {
-		pr_err("Cannot find the device with instance %d!\n", instance);
+	ndev = dnvme_find_device(instance);
+	if (IS_ERR(ndev))
 		return ndev;
-	}
 
-	mutex_lock(&ndev->lock);
+	__dnvme_lock_device(ndev);
 	return ndev;
 }
 
 void dnvme_unlock_device(struct nvme_device *ndev)
 {
 	if (mutex_is_locked(&ndev->lock)) {
+		up_write(&ndev->queue_sem);
 		mutex_unlock(&ndev->lock);
+		dnvme_uring_kick_deferred(ndev);
 	} else {
 		dnvme_warn(ndev, "already unlocked, lock missmatch!\n");
 	}
 }
 
+/**
+ * @brief Lock the device shared, which keeps queues from being created or
+ *  deleted while walking them.
+ */
+void dnvme_lock_device_shared(struct nvme_device *ndev)
+{
+	down_read(&ndev->queue_sem);
+}
+
+void dnvme_unlock_device_shared(struct nvme_device *ndev)
+{
+	up_read(&ndev->queue_sem);
+}
+
+/**
+ * @brief Lock the device before accessing the specified queue.
+ *
+ * @note Commands in admin queue may create or delete other queues, so the
+ *  device is locked exclusively. Otherwise, the device is locked shared and
+ *  the caller shall hold the lock of I/O queue.
+ */
+void dnvme_lock_device_for_queue(struct nvme_device *ndev, u16 qid)
+{
+	if (qid == NVME_AQ_ID)
+		__dnvme_lock_device(ndev);
+	else
+		dnvme_lock_device_shared(ndev);
+}
+
+void dnvme_unlock_device_for_queue(struct nvme_device *ndev, u16 qid)
+{
+	if (qid == NVME_AQ_ID)
+		dnvme_unlock_device(ndev);
+	else
+		dnvme_unlock_device_shared(ndev);
+}
+
 /**
  * @brief Parse vm_paoff in "struct vm_area_struct"
  * 
@@ -120,6 +164,10 @@ static int mmap_parse_vmpgoff(struct nvme_device *ndev, unsigned long vm_pgoff,
 			dnvme_err(ndev, "Cannot map non-contig CQ!\n");
 			return -EOPNOTSUPP;
 		}
+		if (cq->use_cmb) {
+			dnvme_err(ndev, "Cannot map CQ in CMB!\n");
+			return -EOPNOTSUPP;
+		}
 		*kva = cq->buf;
 		*size = cq->size;
 		break;
@@ -135,6 +183,11 @@ static int mmap_parse_vmpgoff(struct nvme_device *ndev, unsigned long vm_pgoff,
 			dnvme_err(ndev, "Cannot map non-contig SQ!\n");
 			return -EOPNOTSUPP;
 		}
+		if (sq->use_cmb) {
+			dnvme_err(ndev, "SQ in CMB shall be mapped by "
+				"NVME_VMPGOFF_TYPE_CMB_SQ!\n");
+			return -EINVAL;
+		}
 		*kva = sq->buf;
 		*size = sq->size;
 		break;
@@ -163,6 +216,244 @@ static int mmap_parse_vmpgoff(struct nvme_device *ndev, unsigned long vm_pgoff,
 	return 0;
 }
 
+/**
+ * @brief Check whether [start, start + len) in BAR0 overlaps MSI-X table
+ *  or PBA, which user shall never access directly.
+ */
+static bool dnvme_overlap_msix(struct nvme_device *ndev, u32 start, u32 len)
+{
+	struct pci_cap_msix *cap = ndev->cap.msix;
+	u32 irqs, oft, size;
+
+	if (!cap)
+		return false;
+
+	irqs = (cap->mc & PCI_MSIX_FLAGS_QSIZE) + 1;
+
+	if ((cap->table & PCI_MSIX_TABLE_BIR) == 0) {
+		oft = cap->table & PCI_MSIX_TABLE_OFFSET;
+		size = irqs * PCI_MSIX_ENTRY_SIZE;
+		if (oft < start + len && start < oft + size)
+			return true;
+	}
+
+	if ((cap->pba & PCI_MSIX_PBA_BIR) == 0) {
+		oft = cap->pba & PCI_MSIX_PBA_OFFSET;
+		size = DIV_ROUND_UP(irqs, 64) * 8;
+		if (oft < start + len && start < oft + size)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Check whether the doorbell belongs to a queue owned by user.
+ *
+ * @param idx Index of doorbell, SQ tail doorbell is even and CQ head
+ *  doorbell is odd.
+ */
+static bool dnvme_db_is_user_own(struct nvme_device *ndev, u32 idx)
+{
+	struct nvme_sq *sq;
+	struct nvme_cq *cq;
+
+	if (idx & 1) {
+		cq = dnvme_find_cq(ndev, idx / 2);
+		return cq && cq->user_own;
+	}
+
+	sq = dnvme_find_sq(ndev, idx / 2);
+	return sq && sq->user_own;
+}
+
+/**
+ * @brief Map doorbell registers of an I/O queue to user space.
+ *
+ * @note Doorbell registers are mapped as uncached I/O memory in pages, the
+ *  region starts at the page which holds the SQ tail doorbell. Every
+ *  doorbell in the region shall belong to queues owned by user, so the
+ *  stride between doorbells decided by CAP.DSTRD shall be large enough to
+ *  keep doorbells of other queues out of the pages.
+ * @return 0 on success, otherwise a negative errno.
+ */
+static int dnvme_mmap_doorbell(struct nvme_device *ndev, 
+	struct vm_area_struct *vma)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	u16 qid = NVME_VMPGOFF_ID(vma->vm_pgoff);
+	u32 stride = 4 * ndev->db_stride;
+	unsigned long start, end, oft;
+	int ret;
+
+	if (qid == NVME_AQ_ID) {
+		dnvme_err(ndev, "admin doorbells are always owned by driver!\n");
+		return -EPERM;
+	}
+
+	start = round_down(NVME_REG_DBS + 2 * qid * stride, PAGE_SIZE);
+	end = PAGE_ALIGN(NVME_REG_DBS + (2 * qid + 2) * stride);
+	if (start < NVME_REG_DBS) {
+		dnvme_err(ndev, "doorbell page of Q(%u) holds controller "
+			"registers!\n", qid);
+		return -EPERM;
+	}
+
+	if (end > pci_resource_len(pdev, 0)) {
+		dnvme_err(ndev, "doorbell page of Q(%u) exceeds BAR0!\n", qid);
+		return -EINVAL;
+	}
+
+	if (vma->vm_end - vma->vm_start > end - start) {
+		dnvme_err(ndev, "map size(0x%lx) exceeds doorbell span(0x%lx)!\n",
+			vma->vm_end - vma->vm_start, end - start);
+		return -EINVAL;
+	}
+
+	if (dnvme_overlap_msix(ndev, start, end - start)) {
+		dnvme_err(ndev, "doorbell page of Q(%u) overlaps MSI-X table "
+			"or PBA!\n", qid);
+		return -EINVAL;
+	}
+
+	for (oft = start; oft < end; oft += stride) {
+		if (!dnvme_db_is_user_own(ndev, (oft - NVME_REG_DBS) / stride)) {
+			dnvme_err(ndev, "doorbell(0x%lx) in the page of Q(%u) isn't "
+				"owned by user!\n", oft, qid);
+			return -EPERM;
+		}
+	}
+
+	/* vm_iomap_memory() take vm_pgoff as offset in the region */
+	vma->vm_pgoff = 0;
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+
+	ret = vm_iomap_memory(vma, pci_resource_start(pdev, 0) + start, 
+		end - start);
+	if (ret < 0)
+		dnvme_err(ndev, "failed to map doorbell!(%d)\n", ret);
+
+	return ret;
+}
+
+/**
+ * @brief Map SQ in CMB to user space.
+ *
+ * @note SQ is mapped write-combining, user shall flush the commands written
+ *  (eg. by sfence) before ringing doorbell.
+ * @return 0 on success, otherwise a negative errno.
+ */
+static int dnvme_mmap_cmb_sq(struct nvme_device *ndev, 
+	struct vm_area_struct *vma)
+{
+	u16 id = NVME_VMPGOFF_ID(vma->vm_pgoff);
+	struct nvme_sq *sq;
+	int ret;
+
+	sq = dnvme_find_sq(ndev, id);
+	if (!sq) {
+		dnvme_err(ndev, "Cannot find SQ(%u)!\n", id);
+		return -EBADSLT;
+	}
+
+	if (!sq->use_cmb) {
+		dnvme_err(ndev, "SQ(%u) isn't in CMB!\n", id);
+		return -EINVAL;
+	}
+	/* vm_iomap_memory() take vm_pgoff as offset in the region */
+	vma->vm_pgoff = 0;
+	vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+
+	ret = vm_iomap_memory(vma, dnvme_cmb_phys_addr(ndev->cmb, sq->dma), 
+		sq->size);
+	if (ret < 0)
+		dnvme_err(ndev, "failed to map SQ(%u) in CMB!(%d)\n", id, ret);
+
+	return ret;
+}
+
+static void dnvme_pmr_vm_open(struct vm_area_struct *vma)
+{
+	struct nvme_pmr *pmr = vma->vm_private_data;
+
+	spin_lock(&pmr->map_lock);
+	pmr->nr_map++;
+	spin_unlock(&pmr->map_lock);
+}
+
+static void dnvme_pmr_vm_close(struct vm_area_struct *vma)
+{
+	struct nvme_pmr *pmr = vma->vm_private_data;
+
+	spin_lock(&pmr->map_lock);
+	pmr->nr_map--;
+	spin_unlock(&pmr->map_lock);
+}
+
+static const struct vm_operations_struct dnvme_pmr_vm_ops = {
+	.open		= dnvme_pmr_vm_open,
+	.close		= dnvme_pmr_vm_close,
+};
+
+/**
+ * @brief Map PMR to user space, write-combining for stores or uncached for
+ *  loads.
+ *
+ * @note Views of different memory types can't coexist, so a view is refused
+ *  while the other one is still mapped. Stores aren't persistent until they
+ *  are flushed and read back as PMRCAP.PMRWBM required.
+ * @return 0 on success, otherwise a negative errno.
+ */
+static int dnvme_mmap_pmr(struct nvme_device *ndev, struct vm_area_struct *vma)
+{
+	struct nvme_pmr *pmr = ndev->pmr;
+	u16 id = NVME_VMPGOFF_ID(vma->vm_pgoff);
+	int ret;
+
+	if (!pmr) {
+		dnvme_err(ndev, "PMR isn't mapped!\n");
+		return -EOPNOTSUPP;
+	}
+
+	switch (id) {
+	case NVME_PMR_MAP_WC:
+		vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+		break;
+	case NVME_PMR_MAP_UC:
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		break;
+	default:
+		dnvme_err(ndev, "PMR map type(%u) is unknown!\n", id);
+		return -EINVAL;
+	}
+	/* vm_iomap_memory() take vm_pgoff as offset in the region */
+	vma->vm_pgoff = 0;
+
+	spin_lock(&pmr->map_lock);
+	if (pmr->nr_map && pmr->map_type != id) {
+		spin_unlock(&pmr->map_lock);
+		dnvme_err(ndev, "PMR is mapped as type(%u) already!\n",
+			pmr->map_type);
+		return -EBUSY;
+	}
+	pmr->map_type = id;
+	pmr->nr_map++;
+	spin_unlock(&pmr->map_lock);
+
+	ret = vm_iomap_memory(vma, pmr->res_addr, pmr->size);
+	if (ret < 0) {
+		dnvme_err(ndev, "failed to map PMR!(%d)\n", ret);
+		spin_lock(&pmr->map_lock);
+		pmr->nr_map--;
+		spin_unlock(&pmr->map_lock);
+		return ret;
+	}
+
+	/* track the VMA until it's unmapped, fork and split included */
+	vma->vm_private_data = pmr;
+	vma->vm_ops = &dnvme_pmr_vm_ops;
+	return 0;
+}
+
 /*
  * Called to clean up the driver data structures
  */
@@ -172,15 +463,19 @@ void dnvme_cleanup_device(struct nvme_device *ndev, enum nvme_state state)
 	/* Clean Up the data structures */
 	dnvme_delete_all_queues(ndev, state);
 	dnvme_delete_meta_nodes(ndev);
+	dnvme_unregister_all_buffers(ndev);
 	dnvme_release_hmb(ndev);
+	dnvme_release_dbbuf(ndev);
 }
 
 /**
  * @brief Maps the contiguous device mapped area to user space.
  * 
  * @param vma
- *   vm_pgoff: bit[19:18] - Type(0: CQ, 1: SQ, 2: meta data)
- *             bit[17:0] - Identify
+ *   vm_pgoff: bit[19:16] - Type(0: CQ, 1: SQ, 2: meta data, 3: doorbell,
+ *                         4: SQ in CMB, 5: PMR,
+ *                         6: irq event ring)
+ *             bit[15:0] - Identify
  * @return 0 on success, otherwise a negative errno.
  */
 static int dnvme_mmap(struct file *filp, struct vm_area_struct *vma)
@@ -202,6 +497,23 @@ static int dnvme_mmap(struct file *filp, struct vm_area_struct *vma)
 #else
 	vma->vm_flags |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
 #endif
+	if (NVME_VMPGOFF_TO_TYPE(vma->vm_pgoff) == NVME_VMPGOFF_TYPE_DB) {
+		ret = dnvme_mmap_doorbell(ndev, vma);
+		goto out;
+	}
+	if (NVME_VMPGOFF_TO_TYPE(vma->vm_pgoff) == NVME_VMPGOFF_TYPE_CMB_SQ) {
+		ret = dnvme_mmap_cmb_sq(ndev, vma);
+		goto out;
+	}
+	if (NVME_VMPGOFF_TO_TYPE(vma->vm_pgoff) == NVME_VMPGOFF_TYPE_PMR) {
+		ret = dnvme_mmap_pmr(ndev, vma);
+		goto out;
+	}
+	if (NVME_VMPGOFF_TO_TYPE(vma->vm_pgoff) == NVME_VMPGOFF_TYPE_IRQ_RING) {
+		ret = dnvme_mmap_irq_ring(ndev, vma);
+		goto out;
+	}
+
 	ret = mmap_parse_vmpgoff(ndev, vma->vm_pgoff, &map_addr, &map_size);
 	if (ret < 0)
 		goto out;
@@ -240,12 +552,38 @@ static long dnvme_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct inode *inode = inode = filp->f_path.dentry->d_inode;
 	void __user *argp = (void __user *)arg;
 
+	ndev = dnvme_find_device(iminor(inode));
+	if (IS_ERR(ndev))
+		return PTR_ERR(ndev);
+
 	dnvme_dbg(ndev, "cmd num:%u, arg:0x%lx (%s)\n", _IOC_NR(cmd), arg,
 		dnvme_ioctl_cmd_string(cmd));
 
-	ndev = dnvme_lock_device(iminor(inode));
-	if (IS_ERR(ndev))
-		return PTR_ERR(ndev);
+	/* These commands lock the device according to the queue accessed */
+	switch (cmd) {
+	case NVME_IOCTL_RING_SQ_DOORBELL:
+		return dnvme_ring_sq_doorbell(ndev, (u16)arg);
+
+	case NVME_IOCTL_SUBMIT_64B_CMD:
+		return dnvme_submit_64b_cmd(ndev, argp);
+
+	case NVME_IOCTL_SUBMIT_64B_CMD_BATCH:
+		return dnvme_submit_64b_cmd_batch(ndev, argp);
+
+	case NVME_IOCTL_TAMPER_CMD:
+		return dnvme_tamper_cmd(ndev, argp);
+
+	case NVME_IOCTL_INQUIRY_CQE:
+		return dnvme_inquiry_cqe(ndev, argp);
+
+	case NVME_IOCTL_REAP_CQE:
+		return dnvme_reap_cqe_legacy(ndev, argp);
+
+	case NVME_IOCTL_REAP_CQE_WAIT:
+		return dnvme_reap_cqe_wait(ndev, argp);
+	}
+
+	__dnvme_lock_device(ndev);
 
 	switch (cmd) {
 	case NVME_IOCTL_GET_SQ_INFO:
@@ -292,16 +630,16 @@ static long dnvme_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		ret = dnvme_prepare_cq(ndev, argp);
 		break;
 
-	case NVME_IOCTL_RING_SQ_DOORBELL:
-		ret = dnvme_ring_sq_doorbell(ndev, (u16)arg);
+	case NVME_IOCTL_SET_QUEUE_OWNER:
+		ret = dnvme_set_queue_owner(ndev, argp);
 		break;
 
-	case NVME_IOCTL_SUBMIT_64B_CMD:
-		ret = dnvme_submit_64b_cmd(ndev, argp);
+	case NVME_IOCTL_LAT_STAT:
+		ret = dnvme_lat_stat(ndev, argp);
 		break;
 
-	case NVME_IOCTL_TAMPER_CMD:
-		ret = dnvme_tamper_cmd(ndev, argp);
+	case NVME_IOCTL_SET_POLL_CQ:
+		ret = dnvme_set_poll_cq(ndev, argp);
 		break;
 
 	case NVME_IOCTL_EMPTY_CMD_LIST:
@@ -316,14 +654,6 @@ static long dnvme_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
-	case NVME_IOCTL_INQUIRY_CQE:
-		ret = dnvme_inquiry_cqe(ndev, argp);
-		break;
-
-	case NVME_IOCTL_REAP_CQE:
-		ret = dnvme_reap_cqe_legacy(ndev, argp);
-		break;
-
 	case NVME_IOCTL_CREATE_META_NODE:
 		ret = dnvme_create_meta_node(ndev, argp);
 		break;
@@ -332,6 +662,14 @@ static long dnvme_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		dnvme_delete_meta_id(ndev, (u32)arg);
 		break;
 
+	case NVME_IOCTL_REGISTER_BUFFER:
+		ret = dnvme_register_buffer(ndev, argp);
+		break;
+
+	case NVME_IOCTL_UNREGISTER_BUFFER:
+		ret = dnvme_unregister_buffer(ndev, (u32)arg);
+		break;
+
 	case NVME_IOCTL_SET_IRQ:
 		ret = dnvme_set_interrupt(ndev, argp);
 		break;
@@ -344,6 +682,14 @@ static long dnvme_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		ret = dnvme_unmask_interrupt(&ndev->irq_set, (u16)arg);
 		break;
 
+	case NVME_IOCTL_SET_IRQ_EVENTFD:
+		ret = dnvme_set_irq_eventfd(ndev, argp);
+		break;
+
+	case NVME_IOCTL_SET_IRQ_AFFINITY:
+		ret = dnvme_set_irq_affinity(ndev, argp);
+		break;
+
 	case NVME_IOCTL_ALLOC_HMB:
 		ret = dnvme_alloc_hmb(ndev, argp);
 		break;
@@ -352,9 +698,17 @@ static long dnvme_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		ret = dnvme_release_hmb(ndev);
 		break;
 
+	case NVME_IOCTL_SET_DBBUF:
+		ret = dnvme_set_dbbuf(ndev, argp);
+		break;
+
 	case NT_IOCTL_IOPS:
 		ret = dnvme_test_iops(ndev, argp);
 		break;
+
+	case NT_IOCTL_IOPS_MQ:
+		ret = dnvme_test_iops_mq(ndev, argp);
+		break;
 	default:
 		dnvme_err(ndev, "cmd(%u) is unknown!\n", _IOC_NR(cmd));
 		ret = -EINVAL;
@@ -406,12 +760,28 @@ static int dnvme_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+static __poll_t dnvme_poll(struct file *filp, poll_table *wait)
+{
+	struct nvme_device *ndev;
+
+	ndev = dnvme_find_device(iminor(file_inode(filp)));
+	if (IS_ERR(ndev))
+		return EPOLLERR;
+
+	return dnvme_poll_cqe(ndev, filp, wait);
+}
+
 static const struct file_operations dnvme_fops = {
 	.owner		= THIS_MODULE,
 	.unlocked_ioctl	= dnvme_ioctl,
 	.open		= dnvme_open,
 	.release	= dnvme_release,
 	.mmap		= dnvme_mmap, /* !TODO: set map or unmap flag? */
+	.poll		= dnvme_poll,
+#ifdef DNVME_HAS_URING_CMD
+	.uring_cmd	= dnvme_uring_cmd,
+	.uring_cmd_iopoll = dnvme_uring_cmd_iopoll,
+#endif
 };
 
 static int dnvme_map_bar(struct nvme_device *ndev, int idx)
@@ -440,6 +810,7 @@ static int dnvme_map_bar(struct nvme_device *ndev, int idx)
 		ret = -ENOMEM;
 		goto out;
 	}
+	ndev->bar_mask |= BIT(idx);
 	dnvme_info(ndev, "BAR%d: 0x%llx + 0x%llx mapped to 0x%p!\n", 
 		idx, pci_resource_start(pdev, idx), pci_resource_len(pdev, idx), 
 		ndev->bar[idx]);
@@ -454,14 +825,59 @@ static void dnvme_unmap_bar(struct nvme_device *ndev, int idx)
 {
 	struct pci_dev *pdev = ndev->pdev;
 
-	if (unlikely(!ndev->bar[idx]))
+	if (unlikely(!(ndev->bar_mask & BIT(idx))))
 		return;
 
-	iounmap(ndev->bar[idx]);
+	if (ndev->bar[idx])
+		iounmap(ndev->bar[idx]);
 	ndev->bar[idx] = NULL;
+	ndev->bar_mask &= ~BIT(idx);
 	pci_release_region(pdev, idx);
 }
 
+/**
+ * @brief Change the kernel mapping of BAR which is memory instead of
+ *  registers, eg. CMB or PMR.
+ *
+ * @note Aliases of different memory types aren't allowed on some arch (eg.
+ *  PAT of x86), the user mapping silently follows the kernel mapping which
+ *  is uncached. The region stays requested even if the mapping is dropped.
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_remap_bar(struct nvme_device *ndev, int idx, enum nvme_bar_map map)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	resource_size_t start = pci_resource_start(pdev, idx);
+	resource_size_t len = pci_resource_len(pdev, idx);
+
+	if (idx == 0 || !(ndev->bar_mask & BIT(idx))) {
+		dnvme_err(ndev, "BAR%d can't be remapped!\n", idx);
+		return -EINVAL;
+	}
+
+	if (ndev->bar[idx]) {
+		iounmap(ndev->bar[idx]);
+		ndev->bar[idx] = NULL;
+	}
+
+	switch (map) {
+	case NVME_BAR_MAP_NONE:
+		return 0;
+	case NVME_BAR_MAP_UC:
+		ndev->bar[idx] = ioremap(start, len);
+		break;
+	case NVME_BAR_MAP_WC:
+		ndev->bar[idx] = ioremap_wc(start, len);
+		break;
+	}
+
+	if (!ndev->bar[idx]) {
+		dnvme_err(ndev, "failed to remap BAR%d!\n", idx);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
 /**
  * @brief map pci device resource
  * 
@@ -551,8 +967,18 @@ static int dnvme_create_pool(struct nvme_device *ndev)
 	}
 	ndev->meta_pool = pool;
 
+	ndev->node_pool = kcalloc(nr_node_ids, sizeof(struct dnvme_node_pool *), 
+		GFP_KERNEL);
+	if (!ndev->node_pool) {
+		dev_err(dev, "failed to alloc node pool table!\n");
+		goto out_destroy_meta_pool;
+	}
+
 	return 0;
 
+out_destroy_meta_pool:
+	dma_pool_destroy(ndev->meta_pool);
+	ndev->meta_pool = NULL;
 out_destroy_queue_pool:
 	dma_pool_destroy(ndev->queue_pool);
 	ndev->queue_pool = NULL;
@@ -562,8 +988,17 @@ out_destroy_cmd_pool:
 	return -ENOMEM;
 }
 
+static void dnvme_destroy_node_pool(struct dnvme_node_pool *pool);
+
 static void dnvme_destroy_pool(struct nvme_device *ndev)
 {
+	int node;
+
+	for (node = 0; node < nr_node_ids; node++)
+		dnvme_destroy_node_pool(ndev->node_pool[node]);
+	kfree(ndev->node_pool);
+	ndev->node_pool = NULL;
+
 	dma_pool_destroy(ndev->meta_pool);
 	ndev->meta_pool = NULL;
 	dma_pool_destroy(ndev->queue_pool);
@@ -572,6 +1007,188 @@ static void dnvme_destroy_pool(struct nvme_device *ndev)
 	ndev->cmd_pool = NULL;
 }
 
+/**
+ * @brief Allocate DMA memory on the given NUMA node.
+ *
+ * @note Coherent DMA memory is always allocated on the node of device, so
+ *  pages on other node are mapped for streaming DMA. The caller shall sync
+ *  the memory explicitly, refer to dnvme_sync_sq_entry().
+ */
+void *dnvme_dma_alloc_node(struct nvme_device *ndev, size_t size, 
+	dma_addr_t *dma, int node)
+{
+	struct device *dev = &ndev->pdev->dev;
+	struct page *page;
+
+	if (!dnvme_is_foreign_node(ndev, node))
+		return dma_alloc_coherent(dev, size, dma, GFP_KERNEL);
+
+	page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO, get_order(size));
+	if (!page)
+		return NULL;
+
+	*dma = dma_map_page(dev, page, 0, size, DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(dev, *dma)) {
+		__free_pages(page, get_order(size));
+		return NULL;
+	}
+	return page_address(page);
+}
+
+void dnvme_dma_free_node(struct nvme_device *ndev, size_t size, void *buf, 
+	dma_addr_t dma, int node)
+{
+	struct device *dev = &ndev->pdev->dev;
+
+	if (!dnvme_is_foreign_node(ndev, node)) {
+		dma_free_coherent(dev, size, buf, dma);
+		return;
+	}
+
+	dma_unmap_page(dev, dma, size, DMA_BIDIRECTIONAL);
+	free_pages((unsigned long)buf, get_order(size));
+}
+
+/* Free pages cached by the PRP list pool of NUMA node at most */
+#define DNVME_NODE_POOL_PAGES		256
+
+struct dnvme_pool_block {
+	struct dnvme_pool_block	*next;
+	dma_addr_t		dma;
+};
+
+static void dnvme_destroy_node_pool(struct dnvme_node_pool *pool)
+{
+	struct dnvme_pool_block *blk;
+
+	if (!pool)
+		return;
+
+	while (pool->free) {
+		blk = pool->free;
+		pool->free = blk->next;
+		dma_unmap_page(pool->dev, blk->dma, PAGE_SIZE, DMA_TO_DEVICE);
+		free_page((unsigned long)blk);
+	}
+	kfree(pool);
+}
+
+/**
+ * @brief Get the PRP list pool whose pages are located on the given node.
+ *
+ * @note The caller shall lock the device exclusively.
+ * @return NULL if the node is the node of device, which uses cmd_pool.
+ */
+struct dnvme_node_pool *dnvme_get_node_pool(struct nvme_device *ndev, 
+	int node)
+{
+	struct dnvme_node_pool *pool;
+
+	if (!dnvme_is_foreign_node(ndev, node))
+		return NULL;
+
+	if (ndev->node_pool[node])
+		return ndev->node_pool[node];
+
+	pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, node);
+	if (!pool) {
+		dnvme_warn(ndev, "failed to alloc PRP list pool for node%d!\n", 
+			node);
+		return NULL;
+	}
+	pool->dev = &ndev->pdev->dev;
+	pool->node = node;
+	spin_lock_init(&pool->lock);
+
+	dnvme_dbg(ndev, "create PRP list pool for node%d\n", node);
+	ndev->node_pool[node] = pool;
+	return pool;
+}
+
+/**
+ * @brief Allocate a zeroed page for PRP list or SGL segment.
+ *
+ * @note Pages of node pool are mapped for streaming DMA, the caller shall
+ *  call dnvme_sync_prp_pages() after filling up the pages.
+ */
+void *dnvme_alloc_prp_page(struct nvme_prps *prps, dma_addr_t *dma)
+{
+	struct dnvme_node_pool *pool = prps->node_pool;
+	struct dnvme_pool_block *blk;
+	struct page *page;
+
+	if (!pool)
+		return dma_pool_alloc(prps->pg_pool, GFP_KERNEL | __GFP_ZERO, dma);
+
+	spin_lock(&pool->lock);
+	blk = pool->free;
+	if (blk) {
+		pool->free = blk->next;
+		pool->nr_free--;
+	}
+	spin_unlock(&pool->lock);
+
+	if (blk) {
+		*dma = blk->dma;
+		memset(blk, 0, PAGE_SIZE);
+		return blk;
+	}
+
+	page = alloc_pages_node(pool->node, GFP_KERNEL | __GFP_ZERO, 0);
+	if (!page)
+		return NULL;
+
+	*dma = dma_map_page(pool->dev, page, 0, PAGE_SIZE, DMA_TO_DEVICE);
+	if (dma_mapping_error(pool->dev, *dma)) {
+		__free_page(page);
+		return NULL;
+	}
+	return page_address(page);
+}
+
+void dnvme_free_prp_page(struct nvme_prps *prps, void *buf, dma_addr_t dma)
+{
+	struct dnvme_node_pool *pool = prps->node_pool;
+	struct dnvme_pool_block *blk = buf;
+
+	if (!pool) {
+		dma_pool_free(prps->pg_pool, buf, dma);
+		return;
+	}
+
+	spin_lock(&pool->lock);
+	if (pool->nr_free < DNVME_NODE_POOL_PAGES) {
+		blk->next = pool->free;
+		blk->dma = dma;
+		pool->free = blk;
+		pool->nr_free++;
+		blk = NULL;
+	}
+	spin_unlock(&pool->lock);
+
+	if (blk) {
+		dma_unmap_page(pool->dev, dma, PAGE_SIZE, DMA_TO_DEVICE);
+		free_page((unsigned long)buf);
+	}
+}
+
+/**
+ * @brief Hand the PRP list or SGL segments over to device after they're
+ *  written by CPU.
+ */
+void dnvme_sync_prp_pages(struct nvme_prps *prps)
+{
+	struct dnvme_node_pool *pool = prps->node_pool;
+	u32 i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < prps->nr_pages; i++)
+		dma_sync_single_for_device(pool->dev, prps->pg_addr[i], 
+			PAGE_SIZE, DMA_TO_DEVICE);
+}
+
 /**
  * @brief Alloc nvme_device and initialize it. 
  *  
@@ -619,11 +1236,16 @@ static struct nvme_device *dnvme_alloc_device(struct pci_dev *pdev)
 	xa_init(&ndev->sqs);
 	xa_init(&ndev->cqs);
 	xa_init(&ndev->meta);
+	xa_init(&ndev->ubufs);
 
 	INIT_LIST_HEAD(&ndev->irq_set.irq_list);
-	INIT_LIST_HEAD(&ndev->irq_set.work_list);
+
+	init_waitqueue_head(&ndev->poll_wait);
+	atomic_set(&ndev->nr_uring, 0);
+	atomic_set(&ndev->uring_defer, 0);
 
 	mutex_init(&ndev->lock);
+	init_rwsem(&ndev->queue_sem);
 	/* Spinlock to protect from kernel preemption in ISR handler */
 	spin_lock_init(&ndev->irq_set.spin_lock);
 
@@ -890,9 +1512,15 @@ static int __init dnvme_init(void)
 {
 	int ret;
 
+	ret = dnvme_create_cmd_cache();
+	if (ret < 0) {
+		pr_err("failed to create cmd cache!(%d)\n", ret);
+		return ret;
+	}
+
 	ret = dnvme_gnl_init();
 	if (ret < 0)
-		return ret;
+		goto out_destroy_cache;
 	nvme_gnl_id = ret;
 
 	ret = alloc_chrdev_region(&nvme_chr_devt, 0, NVME_MINORS, "nvme");
@@ -931,6 +1559,8 @@ out_release_chrdev:
 	unregister_chrdev_region(nvme_chr_devt, NVME_MINORS);
 out_exit_gnl:
 	dnvme_gnl_exit();
+out_destroy_cache:
+	dnvme_destroy_cmd_cache();
 	return ret;
 }
 module_init(dnvme_init);
@@ -942,6 +1572,7 @@ static void __exit dnvme_exit(void)
 	class_destroy(nvme_class);
 	unregister_chrdev_region(nvme_chr_devt, NVME_MINORS);
 	dnvme_gnl_exit();
+	dnvme_destroy_cmd_cache();
 	ida_destroy(&nvme_instance_ida);
 	pr_info("exit ok!\n");
 }
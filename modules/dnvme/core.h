@@ -16,7 +16,12 @@
 #include <linux/cdev.h>
 #include <linux/proc_fs.h>
 #include <linux/xarray.h>
+#include <linux/rwsem.h>
+#include <linux/wait.h>
 #include <linux/pci.h>
+#include <linux/workqueue.h>
+#include <linux/uio.h>
+#include <linux/version.h>
 
 #include "pci_caps.h"
 #include "dnvme.h"
@@ -25,8 +30,27 @@
 #define NVME_SGES_PER_PAGE		(PAGE_SIZE / sizeof(struct nvme_sgl_desc))
 #define NVME_PRPS_PER_PAGE		(PAGE_SIZE / NVME_PRP_ENTRY_SIZE)
 
+/**
+ * @brief Get the number of pages to hold PRP entries or SGL descriptors. The
+ *  last slot of a page points to the next page only if more entries follow.
+ */
+static inline u32 dnvme_nr_list_pages(u32 nr_entry, u32 per_page)
+{
+	if (nr_entry <= per_page)
+		return 1;
+	return DIV_ROUND_UP(nr_entry - 1, per_page - 1);
+}
+
 #define PCI_BAR_MAX_NUM			6
 
+/* CQs selected by NVME_IOCTL_SET_POLL_CQ are marked in nvme_device.cqs */
+#define DNVME_CQ_POLL_MARK		XA_MARK_1
+
+#if IS_ENABLED(CONFIG_IO_URING) && \
+	LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+#define DNVME_HAS_URING_CMD		1
+#endif
+
 #undef pr_fmt
 #define pr_fmt(fmt)			"[%s,%d]" fmt, __func__, __LINE__
 
@@ -48,6 +72,19 @@
 
 #endif
 
+/**
+ * @brief PRP list pages located on a NUMA node other than the device's.
+ *
+ * @free: Free pages which are still mapped, each links to the next one
+ */
+struct dnvme_node_pool {
+	struct device	*dev;
+	spinlock_t	lock;
+	void		*free;
+	u32		nr_free;
+	int		node;
+};
+
 /**
  * @prp_list: If use PRP, this field point to PRP list pages. If use SGL, 
  *  this field point to the first segment of SGLs.
@@ -57,6 +94,7 @@
  */
 struct nvme_prps {
 	struct dma_pool	*pg_pool;
+	struct dnvme_node_pool	*node_pool; /* used instead of @pg_pool if set */
 
 	void		**prp_list;
 	dma_addr_t	*pg_addr;
@@ -68,11 +106,16 @@ struct nvme_prps {
 	u32		nr_entry;
 
 	u32		is_sgl:1;
+	u32		pooled:1; /* preallocated by SQ, never free it */
 
 	u8	*buf; /* K.V.A for pinned down pages */
 
 	struct scatterlist	*sg;
 	u32	num_map_pgs;
+	/* The number of DMA segments, adjacent pages may be merged by mapping */
+	u32	num_dma_segs;
+	/* Registered buffer which @sg refers to, NULL if pinned per command */
+	struct nvme_ubuf	*ubuf;
 	/* Size of data buffer for the specific command */
 	u32	data_buf_size;
 	/* Address of data buffer for the specific command */
@@ -86,7 +129,6 @@ struct nvme_prps {
  * @sqid: Specify the SQ to process the command.
  * @target_qid: Target queue ID used for Create/Delete Q's, never == 0
  * @opcode: Command operation code specified in NVMe specification
- * @entry: @nvme_cmd is managed by @nvme_sq
  * @prps: see @nvme_prps for details
  */
 struct nvme_cmd {
@@ -95,8 +137,25 @@ struct nvme_cmd {
 	u16	target_qid;
 	u16	idx; /**< SQ entry index */
 	u8	opcode;
-	struct list_head	entry;
 	struct nvme_prps	*prps;
+	u64	stamp; /**< time of ringing doorbell in ns, 0 if not rung */
+	struct io_uring_cmd	*ioucmd; /**< NULL if not submitted by io_uring */
+};
+
+/* Each power of two range of latency is split into 2^N linear buckets */
+#define DNVME_LAT_SUB_BITS		4
+#define DNVME_LAT_BUCKETS		((64 - DNVME_LAT_SUB_BITS + 1) << \
+					DNVME_LAT_SUB_BITS)
+
+/*
+ * struct nvme_lat_hist - log-linear histogram of command latency, in ns.
+ */
+struct nvme_lat_hist {
+	u64	count;
+	u64	sum;
+	u64	min;
+	u64	max;
+	u64	bucket[DNVME_LAT_BUCKETS];
 };
 
 /*
@@ -114,20 +173,49 @@ struct nvme_cq {
 	/* For discontiguous queue */
 	struct nvme_prps	*prps;
 
+	int			node; /* NUMA node of queue memory */
+
 	u32 __iomem		*db; /* head doorbell */
+	__le32			*dbbuf_db; /* shadow head doorbell, or NULL */
+	__le32			*dbbuf_ei; /* EventIdx, NULL until dbbuf is active */
+
+	struct mutex		lock; /* serialize reaping CQ entries */
+	wait_queue_head_t	wait; /* woken up when the irq of CQ fires */
+	u64			poll_lat; /* average latency of polling, in ns */
+
+	struct work_struct	uring_work; /* reap entries of io_uring cmds */
+	atomic_t		uring_defer; /* reaping deferred to device unlock */
+
+	/* Ready entries confirmed by the last scan, see dnvme_get_cqe_remain() */
+	u32			nr_ready;
+	u16			scan_head; /* head when @nr_ready was counted */
+	u8			scan_phase; /* phase tag of @scan_head */
 
 	unsigned int		contig:1; /* queue is contiguous? */
 	unsigned int		created:1; /* queue has been created? */
 	unsigned int		use_cmb:1; /* queue is located in CMB? */
+	unsigned int		streaming:1; /* contiguous queue needs explicit sync? */
+	unsigned int		user_own:1; /* queue is owned by user? */
 };
 
 /*
  * struct nvme_sq - representation of a submisssion queue.
+ *
+ * @cmds: Command table indexed by CID, the number of slots is equal to
+ *  @pub.elements. Command identifiers are always allocated within this range.
+ * @cmd_nodes: Preallocated command nodes indexed by CID. If it's NULL, nodes
+ *  are allocated from dnvme_cmd_cache instead.
+ * @prps_nodes: Preallocated PRPs indexed by CID. If it's NULL, PRPs are
+ *  allocated from dnvme_prps_cache instead.
+ * @cmd_buf: Scratch buffer used to build the SQ entry before copying it to SQ.
  */
 struct nvme_sq {
 	struct nvme_sq_public	pub;
 	struct nvme_device	*ndev;
-	struct list_head	cmd_list;
+	struct nvme_cmd		**cmds;
+	struct nvme_cmd		*cmd_nodes;
+	struct nvme_prps	*prps_nodes;
+	void			*cmd_buf;
 
 	/* For contiguous queue */
 	void			*buf; /* store CQ entries */
@@ -137,12 +225,22 @@ struct nvme_sq {
 	/* For discontiguous queue */
 	struct nvme_prps	*prps;
 
+	int			node; /* NUMA node of queue memory */
+	struct dnvme_node_pool	*node_pool; /* PRP list pool on @node, or NULL */
+
 	u32 __iomem		*db; /* tail doorbell */
-	u16			next_cid; /* command identifier */
+	__le32			*dbbuf_db; /* shadow tail doorbell, or NULL */
+	__le32			*dbbuf_ei; /* EventIdx, NULL until dbbuf is active */
+	u16			next_cid; /* next command identifier to try */
+	struct nvme_lat_hist	*lat; /* NULL if latency statistics is off */
+
+	struct mutex		lock; /* serialize submitting and ringing doorbell */
 
 	unsigned int		contig:1; /* queue is contiguous? */
 	unsigned int		created:1; /* queue has been created? */
 	unsigned int		use_cmb:1; /* queue is located in CMB? */
+	unsigned int		streaming:1; /* contiguous queue needs explicit sync? */
+	unsigned int		user_own:1; /* queue is owned by user? */
 };
 
 /*
@@ -152,23 +250,32 @@ struct nvme_sq {
 struct nvme_icq {
 	struct list_head	entry; /* linked list head for irq CQ trk */
 	u16			cq_id; /* Completion Q id */
+	struct rcu_head		rcu;
 };
 
 /**
  * @irq_entry: nvme_irq is managed by nvme_irq_set
- * @icq_list: manage nvme_icq nodes
+ * @icq_list: manage nvme_icq nodes, ISR walks it under RCU
+ * @irq_set: the set which the irq belongs to
  * @irq_id: irq identify, always 0 based
  * @isr_fired: indicate whether the irq is fired
  * @isr_count: count the number of times irq fired
+ * @ring: events recorded by ISR, mapped to user by NVME_VMPGOFF_TYPE_IRQ_RING
+ *
+ * @note nvme_irq is registered as dev_id of its vector, so ISR gets its
+ *  context directly.
  */
 struct nvme_irq {
 	struct list_head	irq_entry;
 	struct list_head	icq_list;
+	struct nvme_irq_set	*irq_set;
 	u16			irq_id;
 	u32			int_vec; /* vec number; assigned by OS */
 
 	atomic_t		isr_fired;
 	atomic_t		isr_count;
+	struct eventfd_ctx	*trigger; /* signaled in ISR, NULL if not bound */
+	struct nvme_irq_ring	*ring;
 };
 
 /*
@@ -188,6 +295,28 @@ struct nvme_meta {
 	unsigned int		contig:1;
 };
 
+/**
+ * @brief User buffer which is pinned and mapped for DMA at registration.
+ *
+ * @offset: Offset of @addr in the first page
+ * @pages: Pinned user pages, the number of array is @nr_pages.
+ * @dma: DMA address of each page in @pages.
+ * @ref: The number of commands which are referring to this buffer.
+ */
+struct nvme_ubuf {
+	u32			id;
+	unsigned long		addr;
+	u32			size;
+	u32			offset;
+
+	struct page		**pages;
+	dma_addr_t		*dma;
+	u32			nr_pages;
+	enum dma_data_direction	dir;
+
+	atomic_t		ref;
+};
+
 struct nvme_capability {
 	struct pci_cap_pm	*pm;
 	struct pci_cap_msi	*msi;
@@ -197,26 +326,16 @@ struct nvme_capability {
 	struct pci_ext_cap_l1ss	*l1ss;
 };
 
-/**
- * @entry: nvme_work is managed by nvme_irq_set
- * @irq_id: see nvme_irq.irq_id for details
- * @int_vec: see nvme_irq.int_vec for details
- */
-struct nvme_work {
-	struct list_head	entry;
-	struct work_struct	work;
-	u16	irq_id;
-	u32	int_vec;
-	struct nvme_irq_set	*irq_set;
-};
-
 /*
  * Irq Processing structure to hold all the irq parameters per device.
  */
 struct nvme_irq_set {
 	struct list_head	irq_list; /* IRQ list; sorted by irq_no */
 
-	/* To resolve contention for ISR's getting scheduled on different cores */
+	/*
+	 * To resolve contention for ISR's sharing INTMS/INTMC on different
+	 * cores, MSI-X vectors are masked individually without it.
+	 */
 	spinlock_t	spin_lock;
 
 	struct {
@@ -228,9 +347,6 @@ struct nvme_irq_set {
 	enum nvme_irq_type	irq_type;
 	const char		*irq_name;
 	u16			nr_irq;
-
-	struct workqueue_struct	*wq;
-	struct list_head	work_list;
 };
 
 /**
@@ -244,6 +360,10 @@ struct nvme_pmr {
 	pci_bus_addr_t bus_addr;
 	resource_size_t size;
 
+	spinlock_t	map_lock; /* protect @nr_map and @map_type */
+	u32		nr_map; /* VMAs of user mapping PMR */
+	u16		map_type; /* NVME_PMR_MAP_*, valid if @nr_map isn't 0 */
+
 	unsigned int	cmss:1;
 };
 
@@ -258,6 +378,9 @@ struct nvme_cmb {
 	u64		size;
 	u64		offset;
 
+	void __iomem	*virt; /* mapped write-combining */
+	struct gen_pool	*pool; /* allocate queues from CMB */
+
 	/* CMBSZ Capability */
 	unsigned int	sqs:1;
 	unsigned int	cqs:1;
@@ -288,6 +411,23 @@ struct nvme_hmb {
 	struct nvme_hmb_buffer	buf[0];
 };
 
+/**
+ * @brief Shadow doorbell and EventIdx buffers of Doorbell Buffer Config
+ *
+ * @nr_queue: The number of queue identifiers covered by the buffers
+ * @active: Doorbell Buffer Config command has completed successfully
+ */
+struct nvme_shadow_db {
+	__le32		*dbs;
+	dma_addr_t	dbs_dma;
+	__le32		*eis;
+	dma_addr_t	eis_dma;
+	size_t		size;
+	u32		nr_queue;
+
+	unsigned int	active:1;
+};
+
 /**
  * @brief Representation of a NVMe device
  * 
@@ -295,6 +435,11 @@ struct nvme_hmb {
  * @cmb_size: Actually mapped CMB size, may less than CMBSZ which is indicated
  *  in Controller Properities. 
  * @cmb_use_sqes: If true, use controller's memory buffer for I/O SQes.
+ * @lock: Device lock, serialize operations which may create or delete queues,
+ *  reset controller or setup interrupts.
+ * @queue_sem: Held for write together with @lock. Operations on I/O queues
+ *  hold it for read, so that they can run concurrently under the lock of 
+ *  each queue while queues can't be deleted.
  */
 struct nvme_device {
 	struct list_head	entry;
@@ -306,44 +451,124 @@ struct nvme_device {
 	struct xarray	sqs;
 	struct xarray	cqs;
 	struct xarray	meta;
+	struct xarray	ubufs;
 
 	struct mutex	lock;
+	struct rw_semaphore	queue_sem;
 
 	int	instance; /* dev_t minor */
 
 	void __iomem	*bar[PCI_BAR_MAX_NUM];
+	u8		bar_mask; /* BARs requested, may be not mapped */
 	u32 __iomem	*dbs;
 
 	struct dma_pool	*cmd_pool;
 	struct dma_pool	*queue_pool;
 	struct dma_pool *meta_pool;
+	struct dnvme_node_pool	**node_pool; /* PRP list pool of each NUMA node */
 
 	struct nvme_irq_set	irq_set;
 	struct nvme_capability	cap;
 	struct nvme_hmb		*hmb;
 	struct nvme_pmr		*pmr;
 	struct nvme_cmb		*cmb;
+	struct nvme_shadow_db	*dbbuf;
 
 	u64	reg_cap;
 	u32	q_depth;
 	u32	db_stride;
 
+	wait_queue_head_t	poll_wait; /**< poll() on CQs marked for poll */
+
+	atomic_t	nr_uring; /**< io_uring commands in flight */
+	atomic_t	uring_defer; /**< some CQ deferred reaping io_uring cmds */
+
 	unsigned int	opened:1;
 };
 
 extern struct list_head nvme_dev_list;
 extern int nvme_gnl_id;
+extern struct kmem_cache *dnvme_cmd_cache;
+extern struct kmem_cache *dnvme_prps_cache;
 
 static inline struct nvme_device *dnvme_irq_to_device(struct nvme_irq_set *irq_set)
 {
 	return container_of(irq_set, struct nvme_device, irq_set);
 }
 
+struct nvme_device *dnvme_find_device(int instance);
 struct nvme_device *dnvme_lock_device(int instance);
 void dnvme_unlock_device(struct nvme_device *ndev);
 
+void dnvme_lock_device_shared(struct nvme_device *ndev);
+void dnvme_unlock_device_shared(struct nvme_device *ndev);
+
+void dnvme_lock_device_for_queue(struct nvme_device *ndev, u16 qid);
+void dnvme_unlock_device_for_queue(struct nvme_device *ndev, u16 qid);
+
 void dnvme_cleanup_device(struct nvme_device *ndev, enum nvme_state state);
 
+/* Memory type of BAR mapped in kernel, see dnvme_remap_bar() */
+enum nvme_bar_map {
+	NVME_BAR_MAP_NONE = 0,
+	NVME_BAR_MAP_UC,
+	NVME_BAR_MAP_WC,
+};
+
+int dnvme_remap_bar(struct nvme_device *ndev, int idx, enum nvme_bar_map map);
+
+/**
+ * @brief Whether memory on the NUMA node can't be allocated by coherent DMA.
+ */
+static inline bool dnvme_is_foreign_node(struct nvme_device *ndev, int node)
+{
+	return node != NUMA_NO_NODE && node != dev_to_node(&ndev->pdev->dev);
+}
+
+void *dnvme_dma_alloc_node(struct nvme_device *ndev, size_t size, 
+	dma_addr_t *dma, int node);
+void dnvme_dma_free_node(struct nvme_device *ndev, size_t size, void *buf, 
+	dma_addr_t dma, int node);
+struct dnvme_node_pool *dnvme_get_node_pool(struct nvme_device *ndev, 
+	int node);
+void *dnvme_alloc_prp_page(struct nvme_prps *prps, dma_addr_t *dma);
+void dnvme_free_prp_page(struct nvme_prps *prps, void *buf, dma_addr_t dma);
+void dnvme_sync_prp_pages(struct nvme_prps *prps);
+
+/* ==================== Related to "buffer.c" ==================== */
+
+int dnvme_register_buffer(struct nvme_device *ndev, 
+	struct nvme_buffer_reg __user *ureg);
+int dnvme_unregister_buffer(struct nvme_device *ndev, u32 id);
+void dnvme_unregister_all_buffers(struct nvme_device *ndev);
+
+int dnvme_map_ubuf(struct nvme_device *ndev, struct nvme_prps *prps, 
+	u32 id, u32 oft, u32 size, enum dma_data_direction dir);
+void dnvme_unmap_ubuf(struct nvme_device *ndev, struct nvme_prps *prps);
+
+/* ==================== Related to "dbbuf.c" ==================== */
+
+void dnvme_dbbuf_init_sq(struct nvme_sq *sq);
+void dnvme_dbbuf_init_cq(struct nvme_cq *cq);
+int dnvme_dbbuf_fill_cmd(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
+	struct nvme_common_command *ccmd);
+void dnvme_dbbuf_activate(struct nvme_device *ndev);
+
+int dnvme_set_dbbuf(struct nvme_device *ndev, struct nvme_dbbuf_cfg __user *ucfg);
+void dnvme_release_dbbuf(struct nvme_device *ndev);
+
+/* ==================== Related to "latency.c" ==================== */
+
+void dnvme_lat_stamp_cmds(struct nvme_sq *sq);
+void dnvme_lat_record(struct nvme_sq *sq, struct nvme_cmd *cmd);
+void dnvme_lat_get_stat(struct nvme_lat_hist *hist, struct nvme_lat_stat *stat);
+int dnvme_lat_stat(struct nvme_device *ndev, struct nvme_lat_stat __user *ustat);
+
+/* ==================== Related to "iops.c" ==================== */
+
+int dnvme_test_iops_mq(struct nvme_device *ndev, 
+	struct nt_iops_mq __user *uiops);
+
 /* ==================== Related to "cmb.c" ==================== */
 
 bool dnvme_cmb_support_sq(struct nvme_cmb *cmb);
@@ -352,6 +577,11 @@ bool dnvme_cmb_support_cq(struct nvme_cmb *cmb);
 int dnvme_map_cmb(struct nvme_device *ndev);
 void dnvme_unmap_cmb(struct nvme_device *ndev);
 
+void __iomem *dnvme_alloc_cmb(struct nvme_device *ndev, size_t size, 
+	dma_addr_t *dma);
+void dnvme_free_cmb(struct nvme_device *ndev, void __iomem *vaddr, size_t size);
+phys_addr_t dnvme_cmb_phys_addr(struct nvme_cmb *cmb, dma_addr_t dma);
+
 /* ==================== Related to "cmd.c" ==================== */
 
 void dnvme_sgl_set_data(struct nvme_sgl_desc *sge, struct scatterlist *sg);
@@ -363,13 +593,46 @@ int dnvme_map_user_page(struct nvme_device *ndev, struct nvme_prps *prps,
 	enum dma_data_direction dir, bool access);
 void dnvme_unmap_user_page(struct nvme_device *ndev, struct nvme_prps *prps);
 
+struct nvme_prps *dnvme_alloc_prps(struct nvme_sq *sq, u16 cid);
+void dnvme_free_prps(struct nvme_prps *prps);
 void dnvme_release_prps(struct nvme_device *ndev, struct nvme_prps *prps);
 
+void dnvme_free_cmd_node(struct nvme_sq *sq, struct nvme_cmd *cmd);
 void dnvme_delete_cmd_list(struct nvme_device *ndev, struct nvme_sq *sq);
 
+int dnvme_create_cmd_cache(void);
+void dnvme_destroy_cmd_cache(void);
+
+int __dnvme_submit_64b_cmd(struct nvme_device *ndev, struct nvme_sq *sq, 
+	struct nvme_64b_cmd *cmd, struct iov_iter *iter);
 int dnvme_submit_64b_cmd(struct nvme_device *ndev, struct nvme_64b_cmd __user *ucmd);
+int dnvme_submit_64b_cmd_batch(struct nvme_device *ndev, 
+	struct nvme_64b_cmd_batch __user *ubatch);
 int dnvme_tamper_cmd(struct nvme_device *ndev, struct nvme_cmd_tamper __user *utamper);
 
+/* ==================== Related to "uring.c" ==================== */
+
+#ifdef DNVME_HAS_URING_CMD
+int dnvme_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+void dnvme_uring_cmd_end(struct nvme_device *ndev, struct nvme_cmd *cmd, 
+	int status, u64 result);
+int dnvme_uring_cmd_iopoll(struct io_uring_cmd *ioucmd,
+	struct io_comp_batch *iob, unsigned int poll_flags);
+void dnvme_uring_reap_work(struct work_struct *work);
+void dnvme_uring_kick_deferred(struct nvme_device *ndev);
+#else
+static inline void dnvme_uring_cmd_end(struct nvme_device *ndev, 
+	struct nvme_cmd *cmd, int status, u64 result)
+{
+}
+static inline void dnvme_uring_reap_work(struct work_struct *work)
+{
+}
+static inline void dnvme_uring_kick_deferred(struct nvme_device *ndev)
+{
+}
+#endif
+
 /* ==================== Related to "meta.c" ==================== */
 
 int dnvme_create_meta_node(struct nvme_device *ndev, 
@@ -0,0 +1,256 @@
+/**
+ * @file dbbuf.c
+ * @author yeqiang_xu <yeqiang_xu@maxio-tech.com>
+ * @brief Shadow doorbell buffers for Doorbell Buffer Config command.
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/dma-mapping.h>
+#include <linux/uaccess.h>
+
+#include "nvme.h"
+#include "core.h"
+#include "queue.h"
+
+/**
+ * @brief Point the queue to its shadow doorbell, which starts from the
+ *  current value of doorbell register.
+ */
+static void dnvme_dbbuf_attach(struct nvme_shadow_db *dbbuf, u32 idx,
+	u16 value, __le32 **db, __le32 **ei)
+{
+	dbbuf->dbs[idx] = cpu_to_le32(value);
+	dbbuf->eis[idx] = 0;
+	*db = &dbbuf->dbs[idx];
+	*ei = dbbuf->active ? &dbbuf->eis[idx] : NULL;
+}
+
+void dnvme_dbbuf_init_sq(struct nvme_sq *sq)
+{
+	struct nvme_device *ndev = sq->ndev;
+	struct nvme_shadow_db *dbbuf = ndev->dbbuf;
+	u16 qid = sq->pub.sq_id;
+
+	/* admin queue always uses doorbell register */
+	if (!dbbuf || qid == NVME_AQ_ID || qid >= dbbuf->nr_queue)
+		return;
+
+	dnvme_dbbuf_attach(dbbuf, qid * 2 * ndev->db_stride, sq->pub.tail_ptr,
+		&sq->dbbuf_db, &sq->dbbuf_ei);
+}
+
+void dnvme_dbbuf_init_cq(struct nvme_cq *cq)
+{
+	struct nvme_device *ndev = cq->ndev;
+	struct nvme_shadow_db *dbbuf = ndev->dbbuf;
+	u16 qid = cq->pub.q_id;
+
+	if (!dbbuf || qid == NVME_AQ_ID || qid >= dbbuf->nr_queue)
+		return;
+
+	dnvme_dbbuf_attach(dbbuf, (qid * 2 + 1) * ndev->db_stride,
+		cq->pub.head_ptr, &cq->dbbuf_db, &cq->dbbuf_ei);
+}
+
+/**
+ * @brief Fill buffer pointers of Doorbell Buffer Config command.
+ *
+ * @note If buffers aren't allocated, the command is submitted as is. It's
+ *  useful to test the controller with invalid pointers.
+ */
+int dnvme_dbbuf_fill_cmd(struct nvme_device *ndev, struct nvme_64b_cmd *cmd,
+	struct nvme_common_command *ccmd)
+{
+	struct nvme_shadow_db *dbbuf = ndev->dbbuf;
+	struct nvme_dbbuf *dbc = (struct nvme_dbbuf *)ccmd;
+
+	if (!dbbuf)
+		return 0;
+
+	if (cmd->data_buf_ptr || cmd->use_reg_buf) {
+		dnvme_err(ndev, "dbbuf is allocated by driver, data buffer "
+			"shall not be specified!\n");
+		return -EINVAL;
+	}
+
+	dbc->prp1 = cpu_to_le64(dbbuf->dbs_dma);
+	dbc->prp2 = cpu_to_le64(dbbuf->eis_dma);
+	return 0;
+}
+
+/**
+ * @brief Doorbell Buffer Config command completed successfully, doorbell
+ *  registers are only written when EventIdx requires it from now on.
+ *
+ * @note The caller shall lock the device exclusively.
+ */
+void dnvme_dbbuf_activate(struct nvme_device *ndev)
+{
+	struct nvme_shadow_db *dbbuf = ndev->dbbuf;
+	struct nvme_sq *sq;
+	struct nvme_cq *cq;
+	unsigned long i;
+
+	if (!dbbuf) {
+		dnvme_warn(ndev, "dbbuf is released before cmd completion!\n");
+		return;
+	}
+	dbbuf->active = 1;
+
+	xa_for_each(&ndev->sqs, i, sq) {
+		if (sq->dbbuf_db)
+			sq->dbbuf_ei = &dbbuf->eis[sq->dbbuf_db - dbbuf->dbs];
+	}
+
+	xa_for_each(&ndev->cqs, i, cq) {
+		if (cq->dbbuf_db)
+			cq->dbbuf_ei = &dbbuf->eis[cq->dbbuf_db - dbbuf->dbs];
+	}
+	dnvme_info(ndev, "dbbuf is active for %u queues!\n", dbbuf->nr_queue);
+}
+
+static int dnvme_alloc_dbbuf(struct nvme_device *ndev, u32 nr_queue)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	struct nvme_shadow_db *dbbuf;
+	struct nvme_sq *sq;
+	struct nvme_cq *cq;
+	unsigned long i;
+
+	dbbuf = kzalloc(sizeof(*dbbuf), GFP_KERNEL);
+	if (!dbbuf) {
+		dnvme_err(ndev, "failed to alloc nvme_shadow_db!\n");
+		return -ENOMEM;
+	}
+	dbbuf->nr_queue = nr_queue;
+	dbbuf->size = PAGE_ALIGN((size_t)nr_queue * 8 * ndev->db_stride);
+
+	dbbuf->dbs = dma_alloc_coherent(&pdev->dev, dbbuf->size,
+		&dbbuf->dbs_dma, GFP_KERNEL);
+	if (!dbbuf->dbs) {
+		dnvme_err(ndev, "failed to alloc shadow doorbell!\n");
+		goto free_dbbuf;
+	}
+	memset(dbbuf->dbs, 0, dbbuf->size);
+
+	dbbuf->eis = dma_alloc_coherent(&pdev->dev, dbbuf->size,
+		&dbbuf->eis_dma, GFP_KERNEL);
+	if (!dbbuf->eis) {
+		dnvme_err(ndev, "failed to alloc EventIdx!\n");
+		goto free_dbs;
+	}
+	memset(dbbuf->eis, 0, dbbuf->size);
+
+	dnvme_dbg(ndev, "dbs:0x%llx, eis:0x%llx, size:0x%zx\n",
+		dbbuf->dbs_dma, dbbuf->eis_dma, dbbuf->size);
+	ndev->dbbuf = dbbuf;
+
+	/* queues which already exist are covered too */
+	xa_for_each(&ndev->sqs, i, sq)
+		dnvme_dbbuf_init_sq(sq);
+	xa_for_each(&ndev->cqs, i, cq)
+		dnvme_dbbuf_init_cq(cq);
+
+	return 0;
+free_dbs:
+	dma_free_coherent(&pdev->dev, dbbuf->size, dbbuf->dbs, dbbuf->dbs_dma);
+free_dbbuf:
+	kfree(dbbuf);
+	return -ENOMEM;
+}
+
+void dnvme_release_dbbuf(struct nvme_device *ndev)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	struct nvme_shadow_db *dbbuf = ndev->dbbuf;
+	struct nvme_sq *sq;
+	struct nvme_cq *cq;
+	unsigned long i;
+
+	if (!dbbuf)
+		return;
+
+	xa_for_each(&ndev->sqs, i, sq) {
+		sq->dbbuf_db = NULL;
+		sq->dbbuf_ei = NULL;
+	}
+
+	xa_for_each(&ndev->cqs, i, cq) {
+		cq->dbbuf_db = NULL;
+		cq->dbbuf_ei = NULL;
+	}
+
+	dma_free_coherent(&pdev->dev, dbbuf->size, dbbuf->eis, dbbuf->eis_dma);
+	dma_free_coherent(&pdev->dev, dbbuf->size, dbbuf->dbs, dbbuf->dbs_dma);
+	kfree(dbbuf);
+	ndev->dbbuf = NULL;
+}
+
+int dnvme_set_dbbuf(struct nvme_device *ndev, struct nvme_dbbuf_cfg __user *ucfg)
+{
+	struct nvme_dbbuf_cfg cfg;
+	struct nvme_sq *sq;
+	struct nvme_cq *cq;
+	unsigned long i;
+	int ret;
+
+	if (copy_from_user(&cfg, ucfg, sizeof(cfg))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	if (!cfg.enable) {
+		/* controller keeps accessing buffers until it's disabled */
+		if (ndev->dbbuf && ndev->dbbuf->active) {
+			dnvme_err(ndev, "dbbuf is in use! please disable "
+				"controller first!\n");
+			return -EBUSY;
+		}
+		dnvme_release_dbbuf(ndev);
+		return 0;
+	}
+
+	if (ndev->dbbuf) {
+		dnvme_err(ndev, "dbbuf already exist! please release it first!\n");
+		return -EPERM;
+	}
+
+	/* user rings doorbell registers only, shadow doorbell would be stale */
+	xa_for_each(&ndev->sqs, i, sq) {
+		if (sq->user_own) {
+			dnvme_err(ndev, "SQ(%u) is owned by user!\n", sq->pub.sq_id);
+			return -EBUSY;
+		}
+	}
+	xa_for_each(&ndev->cqs, i, cq) {
+		if (cq->user_own) {
+			dnvme_err(ndev, "CQ(%u) is owned by user!\n", cq->pub.q_id);
+			return -EBUSY;
+		}
+	}
+
+	if (cfg.nr_queue < 2 || cfg.nr_queue > U16_MAX + 1) {
+		dnvme_err(ndev, "The number(%u) of queues is invalid!\n",
+			cfg.nr_queue);
+		return -EINVAL;
+	}
+
+	ret = dnvme_alloc_dbbuf(ndev, cfg.nr_queue);
+	if (ret < 0)
+		return ret;
+
+	cfg.dbs_addr = ndev->dbbuf->dbs_dma;
+	cfg.eis_addr = ndev->dbbuf->eis_dma;
+	if (copy_to_user(ucfg, &cfg, sizeof(cfg))) {
+		dnvme_err(ndev, "failed to copy to user space!\n");
+		dnvme_release_dbbuf(ndev);
+		return -EFAULT;
+	}
+	return 0;
+}
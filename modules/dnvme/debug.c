@@ -86,11 +86,31 @@ const char *dnvme_ioctl_cmd_string(unsigned int cmd)
 
 	case NVME_IOCTL_SUBMIT_64B_CMD:
 		return "NVME_SUBMIT_64B_CMD";
+	case NVME_IOCTL_SUBMIT_64B_CMD_BATCH:
+		return "NVME_SUBMIT_64B_CMD_BATCH";
+	case NVME_IOCTL_SET_QUEUE_OWNER:
+		return "NVME_SET_QUEUE_OWNER";
+	case NVME_IOCTL_REGISTER_BUFFER:
+		return "NVME_REGISTER_BUFFER";
+	case NVME_IOCTL_UNREGISTER_BUFFER:
+		return "NVME_UNREGISTER_BUFFER";
 
 	case NVME_IOCTL_INQUIRY_CQE:
 		return "NVME_INQUIRY_CQE";
 	case NVME_IOCTL_REAP_CQE:
 		return "NVME_REAP_CQE";
+	case NVME_IOCTL_REAP_CQE_WAIT:
+		return "NVME_REAP_CQE_WAIT";
+	case NVME_IOCTL_LAT_STAT:
+		return "NVME_LAT_STAT";
+	case NVME_IOCTL_SET_POLL_CQ:
+		return "NVME_SET_POLL_CQ";
+	case NVME_IOCTL_SET_IRQ_EVENTFD:
+		return "NVME_SET_IRQ_EVENTFD";
+	case NVME_IOCTL_SET_IRQ_AFFINITY:
+		return "NVME_SET_IRQ_AFFINITY";
+	case NVME_IOCTL_SET_DBBUF:
+		return "NVME_SET_DBBUF";
 
 	case NVME_IOCTL_CREATE_META_NODE:
 		return "NVME_CREATE_META_NODE";
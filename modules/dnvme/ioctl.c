@@ -373,6 +373,13 @@ int dnvme_prepare_sq(struct nvme_device *ndev, struct nvme_prep_sq __user *uprep
 		return -EINVAL;
 	}
 
+	if (prep.use_node && (prep.numa_node >= nr_node_ids || 
+		!node_online(prep.numa_node))) {
+		dnvme_err(ndev, "NUMA node(%u) of SQ is offline!\n", 
+			prep.numa_node);
+		return -EINVAL;
+	}
+
 	sq = dnvme_alloc_sq(ndev, &prep, NVME_NVM_IOSQES);
 	if (!sq)
 		return -ENOMEM;
@@ -405,6 +412,18 @@ int dnvme_prepare_cq(struct nvme_device *ndev, struct nvme_prep_cq __user *uprep
 		return -EINVAL;
 	}
 
+	if (prep.use_node && (prep.numa_node >= nr_node_ids || 
+		!node_online(prep.numa_node))) {
+		dnvme_err(ndev, "NUMA node(%u) of CQ is offline!\n", 
+			prep.numa_node);
+		return -EINVAL;
+	}
+
+	if (prep.poll_mode > NVME_CQ_POLL_HYBRID) {
+		dnvme_err(ndev, "CQ poll mode(%u) is invalid!\n", prep.poll_mode);
+		return -EINVAL;
+	}
+
 	cq = dnvme_alloc_cq(ndev, &prep, NVME_NVM_IOCQES);
 	if (!cq)
 		return -ENOMEM;
@@ -471,6 +490,149 @@ int dnvme_get_cq_info(struct nvme_device *ndev, struct nvme_cq_public __user *uc
 	return 0;
 }
 
+static bool dnvme_sq_has_cmd(struct nvme_sq *sq)
+{
+	u32 i;
+
+	for (i = 0; i < sq->pub.elements; i++) {
+		if (sq->cmds[i])
+			return true;
+	}
+	return false;
+}
+
+static int dnvme_set_sq_owner(struct nvme_device *ndev, 
+	struct nvme_queue_owner *own)
+{
+	struct nvme_sq *sq;
+
+	sq = dnvme_find_sq(ndev, own->qid);
+	if (!sq) {
+		dnvme_err(ndev, "SQ(%u) doesn't exist!\n", own->qid);
+		return -EBADSLT;
+	}
+
+	if (own->user_own) {
+		if (sq->dbbuf_db) {
+			dnvme_err(ndev, "SQ(%u) uses shadow doorbell!\n", own->qid);
+			return -EPERM;
+		}
+		if (dnvme_sq_has_cmd(sq)) {
+			dnvme_err(ndev, "SQ(%u) has cmd in flight!\n", own->qid);
+			return -EBUSY;
+		}
+		/* tail_ptr_virt may be ahead if doorbell hasn't been rung */
+		own->tail_ptr = sq->pub.tail_ptr_virt;
+		own->head_ptr = sq->pub.head_ptr;
+		sq->user_own = 1;
+		return 0;
+	}
+
+	if (own->tail_ptr >= sq->pub.elements || 
+		own->head_ptr >= sq->pub.elements) {
+		dnvme_err(ndev, "SQ(%u) head(%u) or tail(%u) is out of range!\n",
+			own->qid, own->head_ptr, own->tail_ptr);
+		return -EINVAL;
+	}
+	sq->pub.tail_ptr = own->tail_ptr;
+	sq->pub.tail_ptr_virt = own->tail_ptr;
+	sq->pub.head_ptr = own->head_ptr;
+	sq->user_own = 0;
+	return 0;
+}
+
+static int dnvme_set_cq_owner(struct nvme_device *ndev, 
+	struct nvme_queue_owner *own)
+{
+	struct nvme_cq *cq;
+	struct nvme_sq *sq;
+	unsigned long i;
+
+	cq = dnvme_find_cq(ndev, own->qid);
+	if (!cq) {
+		dnvme_err(ndev, "CQ(%u) doesn't exist!\n", own->qid);
+		return -EBADSLT;
+	}
+
+	if (own->user_own) {
+		if (cq->dbbuf_db) {
+			dnvme_err(ndev, "CQ(%u) uses shadow doorbell!\n", own->qid);
+			return -EPERM;
+		}
+		/* entries of commands submitted by driver shall be reaped first */
+		xa_for_each(&ndev->sqs, i, sq) {
+			if (sq->pub.cq_id == own->qid && dnvme_sq_has_cmd(sq)) {
+				dnvme_err(ndev, "SQ(%u) bound to CQ(%u) has cmd in "
+					"flight!\n", sq->pub.sq_id, own->qid);
+				return -EBUSY;
+			}
+		}
+		own->head_ptr = cq->pub.head_ptr;
+		own->tail_ptr = cq->pub.tail_ptr;
+		own->phase = cq->pub.pbit_new_entry;
+		cq->user_own = 1;
+		return 0;
+	}
+
+	if (own->head_ptr >= cq->pub.elements || own->phase > 1) {
+		dnvme_err(ndev, "CQ(%u) head(%u) or phase(%u) is invalid!\n",
+			own->qid, own->head_ptr, own->phase);
+		return -EINVAL;
+	}
+	cq->pub.head_ptr = own->head_ptr;
+	cq->pub.tail_ptr = own->head_ptr;
+	cq->pub.pbit_new_entry = own->phase;
+	cq->nr_ready = 0;
+	cq->user_own = 0;
+	return 0;
+}
+
+/**
+ * @brief Transfer the ownership of I/O queue between driver and user.
+ *
+ * @note The caller shall hold the device lock exclusively, so no one is
+ *  accessing the queue while the pointers are handed over.
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_set_queue_owner(struct nvme_device *ndev, 
+	struct nvme_queue_owner __user *uown)
+{
+	struct nvme_queue_owner own;
+	int ret;
+
+	if (copy_from_user(&own, uown, sizeof(own))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	if (own.qid == NVME_AQ_ID) {
+		dnvme_err(ndev, "admin queue is always owned by driver!\n");
+		return -EPERM;
+	}
+
+	switch (own.type) {
+	case NVME_SQ:
+		ret = dnvme_set_sq_owner(ndev, &own);
+		break;
+	case NVME_CQ:
+		ret = dnvme_set_cq_owner(ndev, &own);
+		break;
+	default:
+		dnvme_err(ndev, "queue type(%d) is invalid!\n", own.type);
+		return -EINVAL;
+	}
+
+	if (ret < 0)
+		return ret;
+
+	if (copy_to_user(uown, &own, sizeof(own))) {
+		dnvme_err(ndev, "failed to copy to user space!\n");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static int dnvme_get_pci_capability(struct nvme_device *ndev, 
 	struct nvme_get_cap *gcap)
 {
@@ -842,12 +1004,13 @@ static u32 __dnvme_test_iops_polling(struct nvme_sq *sq, struct nvme_cq *cq)
 		cq_head = cq_head % cq->pub.elements;
 	}
 	cq->pub.head_ptr = (u16)cq_head;
-	dnvme_writel(cq->db, 0, cq->pub.head_ptr);
+	cq->nr_ready = 0;
+	dnvme_write_cq_db(cq, cq->pub.head_ptr);
 
 	if (sq_head) {
-		dnvme_writel(sq->db, 0, sq_head - 1);
+		dnvme_write_sq_db(sq, sq_head - 1);
 	} else {
-		dnvme_writel(sq->db, 0, sq->pub.elements - 1);
+		dnvme_write_sq_db(sq, sq->pub.elements - 1);
 	}
 
 	return remain;
@@ -881,6 +1044,12 @@ int dnvme_test_iops(struct nvme_device *ndev, struct nt_iops __user *uiops)
 		return -EBADSLT;
 	}
 
+	/* queues in CMB are I/O memory, which are only accessed by helpers */
+	if (sq->use_cmb || cq->use_cmb) {
+		dnvme_err(ndev, "not support queue in CMB!");
+		return -EPERM;
+	}
+
 	/* SQ has filled (sq->elements - 1) cmds, now fill last entry */
 	if (sq->contig) {
 		memcpy((sq->buf + ((u32)(sq->pub.elements - 1) << sq->pub.sqes)), 
@@ -893,7 +1062,7 @@ int dnvme_test_iops(struct nvme_device *ndev, struct nt_iops __user *uiops)
 	cmd = sq->buf + ((u32)sq->pub.tail_ptr_virt << sq->pub.sqes);
 	cmd->common.command_id = sq->pub.elements;
 
-	dnvme_writel(sq->db, 0, sq->pub.elements - 1);
+	dnvme_write_sq_db(sq, sq->pub.elements - 1);
 	start = ktime_get();
 	end = ktime_add_ms(start, iops.time);
 	while (ktime_before(ktime_get(), end)) {
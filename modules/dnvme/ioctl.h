@@ -30,6 +30,9 @@ int dnvme_create_admin_queue(struct nvme_device *ndev,
 int dnvme_prepare_sq(struct nvme_device *ndev, struct nvme_prep_sq __user *uprep);
 int dnvme_prepare_cq(struct nvme_device *ndev, struct nvme_prep_cq __user *uprep);
 
+int dnvme_set_queue_owner(struct nvme_device *ndev, 
+	struct nvme_queue_owner __user *uown);
+
 int dnvme_alloc_hmb(struct nvme_device *ndev, struct nvme_hmb_alloc __user *uhmb);
 int dnvme_release_hmb(struct nvme_device *ndev);
 
@@ -0,0 +1,541 @@
+/**
+ * @file iops.c
+ * @author yeqiang_xu <yeqiang_xu@maxio-tech.com>
+ * @brief In-kernel IOPS engine.
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/pci.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/sched/task.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/uaccess.h>
+
+#include "nvme.h"
+#include "core.h"
+#include "io.h"
+#include "ioctl.h"
+#include "queue.h"
+
+/* Time to wait for the commands in flight after test finished */
+#define DNVME_IOPS_DRAIN_MS		5000
+
+/*
+ * struct dnvme_iops_job - runtime context of a queue pair
+ *
+ * @stamp: Submission time of the command, indexed by CID
+ * @buf: Data buffer shared by all the commands of the job
+ * @prp_list: PRP list shared by all the commands of the job
+ */
+struct dnvme_iops_job {
+	struct nvme_device	*ndev;
+	struct nt_iops_mq	*cfg;
+	struct nt_iops_job	*res;
+	struct nvme_sq		*sq;
+	struct nvme_cq		*cq;
+	struct task_struct	*task;
+	struct completion	done;
+
+	ktime_t			*stamp;
+	void			*buf;
+	dma_addr_t		dma;
+	u32			size;
+	__le64			*prp_list;
+	dma_addr_t		prp_dma;
+
+	u64			seed; /* xorshift state */
+	u64			next_lba; /* index of next sequential access */
+	u64			lat_sum;
+	ktime_t			deadline;
+	ktime_t			cost;
+	int			ret;
+};
+
+static inline u64 dnvme_iops_rand(struct dnvme_iops_job *job)
+{
+	u64 x = job->seed;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	job->seed = x;
+	return x;
+}
+
+static inline void *dnvme_iops_sq_entry(struct nvme_sq *sq, u16 idx)
+{
+	void *base = sq->contig ? sq->buf : sq->prps->buf;
+
+	return base + ((u32)idx << sq->pub.sqes);
+}
+
+static void dnvme_iops_fill_cmd(struct dnvme_iops_job *job, u16 cid)
+{
+	struct nt_iops_mq *cfg = job->cfg;
+	struct nvme_sq *sq = job->sq;
+	struct nvme_rw_command *rw;
+	u64 span = div_u64(cfg->nr_lba, cfg->nlb);
+	u64 idx;
+	bool write;
+
+	if (cfg->random) {
+		div64_u64_rem(dnvme_iops_rand(job), span, &idx);
+	} else {
+		idx = job->next_lba;
+		job->next_lba = (job->next_lba + 1 == span) ? 0 : job->next_lba + 1;
+	}
+
+	if (cfg->rw == NT_IOPS_MIX)
+		write = (dnvme_iops_rand(job) % 100) >= cfg->rwmix;
+	else
+		write = (cfg->rw == NT_IOPS_WRITE);
+
+	/* command for SQ in CMB is built aside and copied in a burst */
+	if (sq->use_cmb)
+		rw = sq->cmd_buf;
+	else
+		rw = dnvme_iops_sq_entry(sq, sq->pub.tail_ptr_virt);
+	memset(rw, 0, 1 << sq->pub.sqes);
+	rw->opcode = write ? nvme_cmd_write : nvme_cmd_read;
+	rw->command_id = cid;
+	rw->nsid = cpu_to_le32(cfg->nsid);
+	rw->slba = cpu_to_le64(cfg->slba + idx * cfg->nlb);
+	rw->length = cpu_to_le16(cfg->nlb - 1);
+	rw->dptr.prp1 = cpu_to_le64(job->dma);
+	if (job->size > 2 * PAGE_SIZE)
+		rw->dptr.prp2 = cpu_to_le64(job->prp_dma);
+	else if (job->size > PAGE_SIZE)
+		rw->dptr.prp2 = cpu_to_le64(job->dma + PAGE_SIZE);
+
+	if (sq->use_cmb)
+		dnvme_sq_copy_cmd(sq, sq->pub.tail_ptr_virt, rw);
+	dnvme_sync_sq_entry(sq, sq->pub.tail_ptr_virt);
+
+	job->stamp[cid] = ktime_get();
+	sq->pub.tail_ptr_virt = (u16)(((u32)sq->pub.tail_ptr_virt + 1) %
+		sq->pub.elements);
+}
+
+/**
+ * @brief Reap all ready CQ entries and resubmit the completed commands
+ *  if @resubmit is true.
+ *
+ * @return The number of CQ entries reaped.
+ */
+static u32 dnvme_iops_reap(struct dnvme_iops_job *job, bool resubmit)
+{
+	struct nt_iops_job *res = job->res;
+	struct nvme_sq *sq = job->sq;
+	struct nvme_cq *cq = job->cq;
+	struct nvme_completion entry;
+	ktime_t now;
+	u64 lat;
+	u32 reaped = 0;
+	u16 cid;
+
+	dnvme_sync_cq_entry(cq, cq->pub.head_ptr);
+	while (NVME_CQE_STATUS_TO_PHASE(dnvme_cqe_status(cq, 
+		cq->pub.head_ptr)) == cq->pub.pbit_new_entry) {
+		dma_rmb();
+		now = ktime_get();
+		/* CQ in CMB is I/O memory, so the entry is copied */
+		dnvme_cqe_copy(cq, cq->pub.head_ptr, &entry);
+		cid = entry.command_id;
+		if (cid >= job->cfg->qdepth) {
+			dnvme_err(job->ndev, "CQ(%u) entry with invalid cid:%u!\n",
+				cq->pub.q_id, cid);
+			job->ret = -EIO;
+			break;
+		}
+
+		if (NVME_CQE_STATUS_TO_STATE(entry.status))
+			res->errors++;
+
+		lat = ktime_to_ns(ktime_sub(now, job->stamp[cid]));
+		job->lat_sum += lat;
+		res->lat_min = min(res->lat_min, lat);
+		res->lat_max = max(res->lat_max, lat);
+		res->ios++;
+
+		sq->pub.head_ptr = le16_to_cpu(entry.sq_head);
+		if (++cq->pub.head_ptr >= cq->pub.elements) {
+			cq->pub.head_ptr = 0;
+			cq->pub.pbit_new_entry = !cq->pub.pbit_new_entry;
+		}
+		if (resubmit)
+			dnvme_iops_fill_cmd(job, cid);
+
+		reaped++;
+		dnvme_sync_cq_entry(cq, cq->pub.head_ptr);
+	}
+
+	if (reaped) {
+		/* head is moved directly, drop entries confirmed by inquiry */
+		cq->nr_ready = 0;
+		dnvme_write_cq_db(cq, cq->pub.head_ptr);
+		if (resubmit) {
+			sq->pub.tail_ptr = sq->pub.tail_ptr_virt;
+			dnvme_write_sq_db(sq, sq->pub.tail_ptr);
+		}
+	}
+	return reaped;
+}
+
+static int dnvme_iops_thread(void *data)
+{
+	struct dnvme_iops_job *job = data;
+	struct nvme_sq *sq = job->sq;
+	ktime_t start, end;
+	u32 inflight = job->cfg->qdepth;
+	u16 cid;
+
+	start = ktime_get();
+	for (cid = 0; cid < job->cfg->qdepth; cid++)
+		dnvme_iops_fill_cmd(job, cid);
+	sq->pub.tail_ptr = sq->pub.tail_ptr_virt;
+	dnvme_write_sq_db(sq, sq->pub.tail_ptr);
+
+	while (!job->ret && ktime_before(ktime_get(), job->deadline)) {
+		if (!dnvme_iops_reap(job, true))
+			cpu_relax();
+		cond_resched();
+	}
+	end = ktime_get();
+
+	/* wait for the commands in flight, and don't submit any more */
+	job->deadline = ktime_add_ms(end, DNVME_IOPS_DRAIN_MS);
+	while (!job->ret && inflight) {
+		inflight -= dnvme_iops_reap(job, false);
+		if (inflight && ktime_after(ktime_get(), job->deadline)) {
+			dnvme_err(job->ndev, "SQ(%u) %u cmds timeout!\n",
+				sq->pub.sq_id, inflight);
+			job->ret = -ETIMEDOUT;
+		}
+		cond_resched();
+	}
+
+	job->cost = ktime_sub(end, start);
+	complete(&job->done);
+	return job->ret;
+}
+
+static int dnvme_iops_check_job(struct nvme_device *ndev,
+	struct nt_iops_mq *cfg, u16 idx)
+{
+	struct nt_iops_job *res = &cfg->job[idx];
+	struct nvme_sq *sq;
+	struct nvme_cq *cq;
+	u32 i;
+
+	sq = dnvme_find_sq(ndev, res->sqid);
+	cq = dnvme_find_cq(ndev, res->cqid);
+	if (!res->sqid || !sq || !cq) {
+		dnvme_err(ndev, "SQ(%u) or CQ(%u) doesn't exist!\n",
+			res->sqid, res->cqid);
+		return -EBADSLT;
+	}
+
+	if (sq->pub.cq_id != res->cqid) {
+		dnvme_err(ndev, "SQ(%u) is bound to CQ(%u), not CQ(%u)!\n",
+			res->sqid, sq->pub.cq_id, res->cqid);
+		return -EINVAL;
+	}
+
+	if (sq->user_own || cq->user_own) {
+		dnvme_err(ndev, "SQ(%u) or CQ(%u) is owned by user!\n",
+			res->sqid, res->cqid);
+		return -EPERM;
+	}
+
+	if (cfg->qdepth >= sq->pub.elements || cfg->qdepth >= cq->pub.elements) {
+		dnvme_err(ndev, "qdepth(%u) shall be less than SQ(%u) and "
+			"CQ(%u) size!\n", cfg->qdepth, res->sqid, res->cqid);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < sq->pub.elements; i++) {
+		if (sq->cmds[i]) {
+			dnvme_err(ndev, "SQ(%u) has cmd(%u) in flight!\n",
+				res->sqid, i);
+			return -EBUSY;
+		}
+	}
+
+	for (i = 0; i < idx; i++) {
+		if (cfg->job[i].cqid == res->cqid) {
+			dnvme_err(ndev, "CQ(%u) is shared by job%u and job%u!\n",
+				res->cqid, i, idx);
+			return -EINVAL;
+		}
+	}
+
+	if (res->cpu >= 0 && (res->cpu >= nr_cpu_ids || !cpu_online(res->cpu))) {
+		dnvme_err(ndev, "CPU%d is offline!\n", res->cpu);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int dnvme_iops_check(struct nvme_device *ndev, struct nt_iops_mq *cfg)
+{
+	u64 size = (u64)cfg->lba_size * cfg->nlb;
+	int ret;
+	u16 i;
+
+	if (!size || size > U32_MAX || DIV_ROUND_UP_ULL(size, PAGE_SIZE) - 1 >
+		PAGE_SIZE / NVME_PRP_ENTRY_SIZE) {
+		dnvme_err(ndev, "lba_size(%u) or nlb(%u) is invalid!\n",
+			cfg->lba_size, cfg->nlb);
+		return -EINVAL;
+	}
+
+	if (cfg->nlb > 0x10000 || cfg->nr_lba < cfg->nlb) {
+		dnvme_err(ndev, "nr_lba(%llu) or nlb(%u) is invalid!\n",
+			cfg->nr_lba, cfg->nlb);
+		return -EINVAL;
+	}
+
+	if (cfg->rw > NT_IOPS_MIX || cfg->rwmix > 100 || !cfg->qdepth ||
+		cfg->time <= 0) {
+		dnvme_err(ndev, "rw(%u), rwmix(%u), qdepth(%u) or time(%d) is "
+			"invalid!\n", cfg->rw, cfg->rwmix, cfg->qdepth, cfg->time);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < cfg->nr_job; i++) {
+		ret = dnvme_iops_check_job(ndev, cfg, i);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static void dnvme_iops_release_job(struct dnvme_iops_job *job)
+{
+	struct pci_dev *pdev = job->ndev->pdev;
+
+	if (job->prp_list)
+		dma_free_coherent(&pdev->dev, PAGE_SIZE, job->prp_list,
+			job->prp_dma);
+	if (job->buf)
+		dma_free_coherent(&pdev->dev, job->size, job->buf, job->dma);
+	kfree(job->stamp);
+}
+
+static int dnvme_iops_init_job(struct nvme_device *ndev,
+	struct nt_iops_mq *cfg, struct dnvme_iops_job *job, u16 idx)
+{
+	struct pci_dev *pdev = ndev->pdev;
+	u32 i;
+
+	job->ndev = ndev;
+	job->cfg = cfg;
+	job->res = &cfg->job[idx];
+	job->sq = dnvme_find_sq(ndev, job->res->sqid);
+	job->cq = dnvme_find_cq(ndev, job->res->cqid);
+	job->size = cfg->lba_size * cfg->nlb;
+	job->seed = get_random_u64() | 1;
+	init_completion(&job->done);
+
+	job->res->ios = 0;
+	job->res->errors = 0;
+	job->res->lat_min = U64_MAX;
+	job->res->lat_max = 0;
+
+	job->stamp = kcalloc(cfg->qdepth, sizeof(*job->stamp), GFP_KERNEL);
+	if (!job->stamp) {
+		dnvme_err(ndev, "failed to alloc timestamp!\n");
+		return -ENOMEM;
+	}
+
+	job->buf = dma_alloc_coherent(&pdev->dev, job->size, &job->dma,
+		GFP_KERNEL);
+	if (!job->buf) {
+		dnvme_err(ndev, "failed to alloc data buffer!\n");
+		goto out;
+	}
+
+	if (job->size > 2 * PAGE_SIZE) {
+		job->prp_list = dma_alloc_coherent(&pdev->dev, PAGE_SIZE,
+			&job->prp_dma, GFP_KERNEL);
+		if (!job->prp_list) {
+			dnvme_err(ndev, "failed to alloc PRP list!\n");
+			goto out;
+		}
+
+		for (i = 1; i < DIV_ROUND_UP(job->size, PAGE_SIZE); i++)
+			job->prp_list[i - 1] = cpu_to_le64(job->dma + i * PAGE_SIZE);
+	}
+	return 0;
+out:
+	dnvme_iops_release_job(job);
+	return -ENOMEM;
+}
+
+static void dnvme_iops_summary(struct nt_iops_mq *cfg,
+	struct dnvme_iops_job *jobs)
+{
+	struct nt_iops_job *res;
+	u64 lat_sum = 0;
+	s64 cost = 0;
+	u16 i;
+
+	cfg->ios = 0;
+	cfg->errors = 0;
+	cfg->lat_min = U64_MAX;
+	cfg->lat_max = 0;
+
+	for (i = 0; i < cfg->nr_job; i++) {
+		res = jobs[i].res;
+		res->lat_avg = res->ios ? div64_u64(jobs[i].lat_sum, res->ios) : 0;
+		if (!res->ios)
+			res->lat_min = 0;
+
+		cfg->ios += res->ios;
+		cfg->errors += res->errors;
+		lat_sum += jobs[i].lat_sum;
+		if (res->ios)
+			cfg->lat_min = min(cfg->lat_min, res->lat_min);
+		cfg->lat_max = max(cfg->lat_max, res->lat_max);
+		cost = max(cost, ktime_to_us(jobs[i].cost));
+	}
+
+	if (!cfg->ios)
+		cfg->lat_min = 0;
+	cfg->lat_avg = cfg->ios ? div64_u64(lat_sum, cfg->ios) : 0;
+	cfg->iops = cost ? div64_u64(cfg->ios * USEC_PER_SEC, cost) : 0;
+	cfg->bw = cost ? div64_u64(div_u64(cfg->ios * cfg->lba_size * cfg->nlb,
+		SZ_1K) * USEC_PER_SEC, cost) : 0;
+}
+
+/**
+ * @brief Drive the I/O queue pairs by kernel threads, each thread keeps
+ *  @qdepth commands in flight until the test duration expires.
+ *
+ * @attention All the commands of a job share one data buffer, so the data
+ *  read back is meaningless. If any job fails, commands may be left in
+ *  flight, so the controller is disabled and I/O queues are deleted.
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_test_iops_mq(struct nvme_device *ndev, struct nt_iops_mq __user *uiops)
+{
+	struct nt_iops_mq head;
+	struct nt_iops_mq *cfg;
+	struct dnvme_iops_job *jobs;
+	ktime_t deadline;
+	size_t size;
+	bool leak = false;
+	int ret;
+	u16 i, nr_init = 0, nr_run = 0;
+
+	if (copy_from_user(&head, uiops, sizeof(head))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	if (!head.nr_job) {
+		dnvme_err(ndev, "nr_job is zero!\n");
+		return -EINVAL;
+	}
+
+	size = struct_size(&head, job, head.nr_job);
+	cfg = memdup_user(uiops, size);
+	if (IS_ERR(cfg)) {
+		dnvme_err(ndev, "failed to copy %u jobs from user space!\n",
+			head.nr_job);
+		return PTR_ERR(cfg);
+	}
+	cfg->nr_job = head.nr_job;
+
+	ret = dnvme_iops_check(ndev, cfg);
+	if (ret < 0)
+		goto out_free_cfg;
+
+	jobs = kcalloc(cfg->nr_job, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs) {
+		dnvme_err(ndev, "failed to alloc %u jobs!\n", cfg->nr_job);
+		ret = -ENOMEM;
+		goto out_free_cfg;
+	}
+
+	for (nr_init = 0; nr_init < cfg->nr_job; nr_init++) {
+		ret = dnvme_iops_init_job(ndev, cfg, &jobs[nr_init], nr_init);
+		if (ret < 0)
+			goto out_release_job;
+	}
+
+	for (nr_run = 0; nr_run < cfg->nr_job; nr_run++) {
+		struct dnvme_iops_job *job = &jobs[nr_run];
+
+		job->task = kthread_create(dnvme_iops_thread, job, "dnvme_iops/%u",
+			job->res->sqid);
+		if (IS_ERR(job->task)) {
+			dnvme_err(ndev, "failed to create thread for SQ(%u)!\n",
+				job->res->sqid);
+			ret = PTR_ERR(job->task);
+			goto out_stop_job;
+		}
+		get_task_struct(job->task);
+
+		if (job->res->cpu >= 0)
+			kthread_bind(job->task, job->res->cpu);
+	}
+
+	deadline = ktime_add_ms(ktime_get(), cfg->time);
+	for (i = 0; i < cfg->nr_job; i++) {
+		jobs[i].deadline = deadline;
+		wake_up_process(jobs[i].task);
+	}
+
+	for (i = 0; i < cfg->nr_job; i++) {
+		wait_for_completion(&jobs[i].done);
+		if (jobs[i].ret < 0 && ret == 0)
+			ret = jobs[i].ret;
+	}
+
+	/*
+	 * Commands may be still in flight if job failed, stop the controller
+	 * before freeing the buffers which commands refer to. If it can't be
+	 * stopped, leak the buffers rather than let device DMA into them.
+	 */
+	if (ret < 0 && dnvme_set_device_state(ndev, NVME_ST_DISABLE) < 0) {
+		dnvme_warn(ndev, "failed to disable controller, leak the "
+			"buffers of %u jobs!\n", cfg->nr_job);
+		leak = true;
+	}
+
+	dnvme_iops_summary(cfg, jobs);
+	dnvme_info(ndev, "Performance: %llu IOPS, %llu KiB/s, lat(ns) "
+		"min:%llu avg:%llu max:%llu\n", cfg->iops, cfg->bw,
+		cfg->lat_min, cfg->lat_avg, cfg->lat_max);
+
+	if (!ret && copy_to_user(uiops, cfg, size)) {
+		dnvme_err(ndev, "failed to copy to user space!\n");
+		ret = -EFAULT;
+	}
+
+out_stop_job:
+	for (i = 0; i < nr_run; i++) {
+		/* thread which hasn't been woken up won't run at all */
+		kthread_stop(jobs[i].task);
+		put_task_struct(jobs[i].task);
+	}
+out_release_job:
+	for (i = 0; i < nr_init && !leak; i++)
+		dnvme_iops_release_job(&jobs[i]);
+	kfree(jobs);
+out_free_cfg:
+	kfree(cfg);
+	return ret;
+}
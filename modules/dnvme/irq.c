@@ -16,7 +16,11 @@
 #include <linux/msi.h>
 #include <linux/list.h>
 #include <linux/interrupt.h>
-#include <linux/workqueue.h>
+#include <linux/irq.h>
+#include <linux/rculist.h>
+#include <linux/eventfd.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include <linux/spinlock.h>
 #include <linux/version.h>
 
@@ -241,35 +245,6 @@ static struct nvme_irq *find_irq_node_by_id(struct nvme_irq_set *irq_set,
 	return NULL;
 }
 
-/**
- * @brief Find the work node in the given work list
- * 
- * @return pointer to the work node on success. Otherwise returns NULL.
- */
-static struct nvme_work *find_work_node_by_vec(struct nvme_irq_set *irq_set,
-	 u32 int_vec)
-{
-	struct nvme_work *node;
-
-	list_for_each_entry(node, &irq_set->work_list, entry) {
-		if (int_vec == node->int_vec)
-			return node;
-	}
-	return NULL;
-}
-
-static struct nvme_work *find_work_node_by_id(struct nvme_irq_set *irq_set,
-	u16 irq_id)
-{
-	struct nvme_work *node;
-
-	list_for_each_entry(node, &irq_set->work_list, entry) {
-		if (irq_id == node->irq_id)
-			return node;
-	}
-	return NULL;
-}
-
 /**
  * @brief Create a icq node and add it to the specified linked list
  * 
@@ -294,7 +269,7 @@ static int create_icq_node(struct nvme_irq *irq, u16 cq_id)
 	}
 	icq->cq_id = cq_id;
 
-	list_add_tail(&icq->entry, &irq->icq_list);
+	list_add_tail_rcu(&icq->entry, &irq->icq_list);
 	return 0;
 }
 
@@ -322,8 +297,8 @@ static void delete_icq_node(struct nvme_icq *icq)
 	if (unlikely(!icq))
 		return;
 
-	list_del(&icq->entry);
-	kfree(icq);
+	list_del_rcu(&icq->entry);
+	kfree_rcu(icq, rcu);
 }
 
 void dnvme_delete_icq_node(struct nvme_irq_set *irq_set, u16 cq_id, u16 irq_no)
@@ -340,6 +315,8 @@ void dnvme_delete_icq_node(struct nvme_irq_set *irq_set, u16 cq_id, u16 irq_no)
 		return;
 
 	delete_icq_node(icq);
+	/* ISR may still be waking up the CQ which is about to be released */
+	synchronize_irq(irq->int_vec);
 }
 
 /**
@@ -361,34 +338,39 @@ static void delete_icq_list(struct nvme_irq *irq)
  *
  * @return 0 on success, otherwise a negative errno. 
  */
-static int create_irq_node(struct nvme_irq_set *irq_set, u32 int_vec, u16 irq_id)
+static struct nvme_irq *create_irq_node(struct nvme_irq_set *irq_set,
+	u32 int_vec, u16 irq_id)
 {
 	struct nvme_device *ndev = dnvme_irq_to_device(irq_set);
 	struct nvme_irq *irq;
 
 	irq = find_irq_node_by_id(irq_set, irq_id);
 	if (irq) {
-		if (irq->int_vec == int_vec) {
-			dnvme_warn(ndev, "irq node(%u:%u) already exist! skip\n",
-				irq_id, int_vec);
-			return 0;
-		}
-		dnvme_err(ndev, "irq node already exist! int_vec mismatch!\n");
-		return -EINVAL;
+		dnvme_err(ndev, "irq node(%u:%u) already exist!\n",
+			irq_id, irq->int_vec);
+		return ERR_PTR(-EEXIST);
 	}
 
 	irq = find_irq_node_by_vec(irq_set, int_vec);
 	if (irq) {
 		dnvme_err(ndev, "irq node already exist! irq_id mismatch!\n");
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	irq = kzalloc(sizeof(*irq), GFP_KERNEL);
 	if (irq == NULL) {
 		dnvme_err(ndev, "failed to alloc irq node!\n");
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
+	}
+
+	irq->ring = vmalloc_user(PAGE_ALIGN(sizeof(struct nvme_irq_ring)));
+	if (!irq->ring) {
+		dnvme_err(ndev, "failed to alloc irq event ring!\n");
+		kfree(irq);
+		return ERR_PTR(-ENOMEM);
 	}
 
+	irq->irq_set = irq_set;
 	irq->int_vec = int_vec; /* int vector number   */
 	irq->irq_id = irq_id;
 	atomic_set(&irq->isr_fired, 0);
@@ -396,7 +378,7 @@ static int create_irq_node(struct nvme_irq_set *irq_set, u32 int_vec, u16 irq_id
 	INIT_LIST_HEAD(&irq->icq_list);
 
 	list_add_tail(&irq->irq_entry, &irq_set->irq_list);
-	return 0;
+	return irq;
 }
 
 static void delete_irq_node(struct nvme_irq *irq)
@@ -406,6 +388,10 @@ static void delete_irq_node(struct nvme_irq *irq)
 
 	delete_icq_list(irq);
 	list_del(&irq->irq_entry);	
+	if (irq->trigger)
+		eventfd_ctx_put(irq->trigger);
+	/* pages mapped to user are freed after they're unmapped */
+	vfree(irq->ring);
 	kfree(irq);
 }
 
@@ -423,169 +409,52 @@ static void delete_irq_list(struct nvme_irq_set *irq_set)
 	}
 }
 
-static void inc_isr_count(struct nvme_irq_set *irq_set, u16 irq_id)
-{
-	struct nvme_device *ndev = dnvme_irq_to_device(irq_set);
-	struct nvme_irq *node;
-
-	node = find_irq_node_by_id(irq_set, irq_id);
-	if (!node) {
-		dnvme_err(ndev, "irq node(ID:%u) not found!\n", irq_id);
-		return;
-	}
-
-	atomic_set(&node->isr_fired, 1);
-	atomic_add(1, &node->isr_count);
-
-	dnvme_vdbg(ndev, "irq node(ID:%u) count is %u\n", node->irq_id, 
-		atomic_read(&node->isr_count));
-}
-
-/**
- * @brief ISR bottom half
- */
-static void update_irq_flag(struct work_struct *wk)
-{
-	struct nvme_work *pwork = container_of(wk, struct nvme_work, work);
-
-	inc_isr_count(pwork->irq_set, pwork->irq_id);
-}
-
-/**
- * @brief Create a work node and add to list.
- * 
- * @return 0 on success, otherwise a negative errno.
- */
-static int create_work_node(struct nvme_irq_set *irq_set, u32 int_vec, 
-	u16 irq_id)
-{
-	struct nvme_device *ndev = dnvme_irq_to_device(irq_set);
-	struct nvme_work *node;
-
-	/* Sanity check */
-	node = find_work_node_by_id(irq_set, irq_id);
-	if (node) {
-		if (node->int_vec == int_vec) {
-			dnvme_warn(ndev, "work node(%u:%u) already exist! skip\n", 
-				irq_id, int_vec);
-			return 0;
-		}
-		dnvme_err(ndev, "work node already exist! int_vec mismatch!\n");
-		return -EINVAL;
-	}
-
-	node = find_work_node_by_vec(irq_set, int_vec);
-	if (node) {
-		dnvme_err(ndev, "work node already exist! irq_id mismatch!\n");
-		return -EINVAL;
-	}
-
-	node = kzalloc(sizeof(struct nvme_work), GFP_KERNEL);
-	if (!node) {
-		dnvme_err(ndev, "failed to alloc work node!\n");
-		return -ENOMEM;
-	}
-
-	/* Initialize the bottom half call back with the work struct */
-	INIT_WORK(&node->work, update_irq_flag);
-	node->irq_set = irq_set;
-	node->int_vec = int_vec;
-	node->irq_id = irq_id;
-	/* Add work item to work items list */
-	list_add_tail(&node->entry, &irq_set->work_list);
-	return 0;
-}
-
-static void delete_work_node(struct nvme_work *wk)
-{
-	if (unlikely(!wk))
-		return;
-
-	list_del(&wk->entry);
-	kfree(wk);
-}
-
-/**
- * @brief Delete all the work nodes in the list and free memory.
- */
-static void delete_work_list(struct nvme_irq_set *irq_set)
-{
-	struct nvme_work *node;
-	struct nvme_work *tmp;
-
-	list_for_each_entry_safe(node, tmp, &irq_set->work_list, entry) {
-		delete_work_node(node);
-	}
-}
-
-static int create_irq_work_queue(struct nvme_irq_set *irq_set)
-{
-	struct nvme_device *ndev = dnvme_irq_to_device(irq_set);
-
-	if (irq_set->wq) {
-		dnvme_warn(ndev, "work queue already exist! skip\n");
-		return 0;
-	}
-
-	irq_set->wq = create_workqueue("irq_wq");
-	if (!irq_set->wq) {
-		dnvme_err(ndev, "failed to create work queue!\n");
-		return -ENOMEM;
-	}
-
-	return 0;
-}
-
-static void destroy_irq_work_queue(struct nvme_irq_set *irq_set)
-{
-	if (!irq_set->wq)
-		return;
-
-	/* Flush the WQ and wait till all work's are executed */
-	flush_workqueue(irq_set->wq);
-	destroy_workqueue(irq_set->wq);
-	irq_set->wq = NULL;
-}
-
 /**
- * @brief Create irq and work node. If necessary, create icq node at the
- *  same time.
+ * @brief Create irq node and register irq handler with the node as its
+ *  context. If necessary, create icq node at the same time.
  * 
  * @return 0 on success, otherwise a negative errno.
  * @note if irq_id = 0, create an icq node and bind to the irq node.
  *  Otherwise, it won't to create an icq node.
  */
-static int create_irq_work_pair(struct nvme_irq_set *irq_set, u32 int_vec,
-	u16 irq_id)
+static int request_irq_node(struct nvme_irq_set *irq_set, u32 int_vec,
+	u16 irq_id, unsigned long flags, const char *name)
 {
+	struct nvme_device *ndev = dnvme_irq_to_device(irq_set);
+	struct nvme_irq *irq;
 	int ret;
 
-	ret = create_irq_node(irq_set, int_vec, irq_id);
-	if (ret < 0)
-		return ret;
+	irq = create_irq_node(irq_set, int_vec, irq_id);
+	if (IS_ERR(irq))
+		return PTR_ERR(irq);
 
-	ret = create_work_node(irq_set, int_vec, irq_id);
-	if (ret < 0)
-		goto out;
-	
 	if (irq_id == 0) {
-		ret = create_icq_node(find_irq_node_by_id(irq_set, irq_id), 0);
+		ret = create_icq_node(irq, 0);
 		if (ret < 0)
-			goto out2;
+			goto out;
+	}
+
+	ret = request_irq(int_vec, dnvme_interrupt, flags, name, irq);
+	if (ret < 0) {
+		dnvme_err(ndev, "failed to request irq(%u)!\n", int_vec);
+		goto out;
 	}
 	return 0;
-out2:
-	delete_work_node(find_work_node_by_id(irq_set, irq_id));
 out:
-	delete_irq_node(find_irq_node_by_id(irq_set, irq_id));
+	delete_irq_node(irq);
 	return ret;
 }
 
-static void destroy_irq_work_pair(struct nvme_irq_set *irq_set, u32 int_vec, 
-	u16 irq_id)
+static void free_irq_node(struct nvme_irq_set *irq_set, u16 irq_id)
 {
-	delete_work_node(find_work_node_by_id(irq_set, irq_id));
-	delete_irq_node(find_irq_node_by_id(irq_set, irq_id));
+	struct nvme_irq *irq;
+
+	irq = find_irq_node_by_id(irq_set, irq_id);
+	if (!irq)
+		return;
+
+	free_irq(irq->int_vec, irq);
+	delete_irq_node(irq);
 }
 
 /**
@@ -599,25 +468,15 @@ static int set_int_pin(struct nvme_device *ndev)
 	void __iomem *bar0 = ndev->bar[0];
 	int ret;
 
-	ret = request_irq(pdev->irq, dnvme_interrupt, IRQF_SHARED, "pin-base",
-		&ndev->irq_set);
-	if (ret < 0) {
-		dnvme_err(ndev, "failed to request irq(%u)!\n", pdev->irq);
+	ret = request_irq_node(&ndev->irq_set, pdev->irq, 0, IRQF_SHARED,
+		"pin-base");
+	if (ret < 0)
 		return ret;
-	}
 	dnvme_vdbg(ndev, "Pin-Base Interrupt Vector(%u)\n", pdev->irq);
 
-	ret = create_irq_work_pair(&ndev->irq_set, pdev->irq, 0);
-	if (ret < 0) {
-		dnvme_err(ndev, "failed to create irq work pair!\n");
-		goto out;
-	}
 	clear_int_mask(bar0, UINT_MAX);
 	pci_enable_int_pin(pdev);
 	return 0;
-out:
-	free_irq(pdev->irq, &ndev->irq_set);
-	return ret;
 }
 
 /**
@@ -644,23 +503,13 @@ static int set_int_msi_single(struct nvme_device *ndev)
 		goto out;
 	}
 
-	ret = request_irq(pdev->irq, dnvme_interrupt, IRQF_SHARED,
-		"msi-single", &ndev->irq_set);
-	if (ret < 0) {
-		dnvme_err(ndev, "failed to request irq(%u)!\n", pdev->irq);
+	ret = request_irq_node(&ndev->irq_set, pdev->irq, 0, IRQF_SHARED,
+		"msi-single");
+	if (ret < 0)
 		goto out2;
-	}
 	dnvme_vdbg(ndev, "MSI-Single Interrupt Vector(%u)\n", pdev->irq);
 
-	ret = create_irq_work_pair(&ndev->irq_set, pdev->irq, 0);
-	if (ret < 0) {
-		dnvme_err(ndev, "failed to create irq work pair!\n");
-		goto out3;
-	}
-
 	return 0;
-out3:
-	free_irq(pdev->irq, &ndev->irq_set);
 out2:
 	pci_disable_msi(pdev);
 out:
@@ -677,7 +526,7 @@ static int set_int_msi_multi(struct nvme_device *ndev, u16 num_irqs)
 {
 	struct pci_dev *pdev = ndev->pdev;
 	void __iomem *bar0 = ndev->bar[0];
-	int ret, i, j;
+	int ret, i;
 
 	clear_int_mask(bar0, UINT_MAX);
 
@@ -693,34 +542,39 @@ static int set_int_msi_multi(struct nvme_device *ndev, u16 num_irqs)
 
 	/* Request irq on each interrupt vector */
 	for (i = 0; i < num_irqs; i++) {
-		ret = request_irq(pdev->irq + i, dnvme_interrupt, IRQF_SHARED,
-			"msi-multi", &ndev->irq_set);
-		if (ret < 0) {
-			dnvme_err(ndev, "failed to request irq(%u)!\n", pdev->irq + i);
+		ret = request_irq_node(&ndev->irq_set, pdev->irq + i, i,
+			IRQF_SHARED, "msi-multi");
+		if (ret < 0)
 			goto out2;
-		}
-	}
-
-	for (j = 0; j < num_irqs; j++) {
-		ret = create_irq_work_pair(&ndev->irq_set, pdev->irq + j, j);
-		if (ret < 0) {
-			dnvme_err(ndev, "failed to create irq work pair(%d)!\n", j);
-			goto out3;
-		}
 	}
 
 	return 0;
-out3:
-	for (j--; j >= 0; j--)
-		destroy_irq_work_pair(&ndev->irq_set, pdev->irq + j, j);
 out2:
 	for (i--; i >= 0; i--)
-		free_irq(pdev->irq + i, &ndev->irq_set);
+		free_irq_node(&ndev->irq_set, i);
 out:
 	set_int_mask(bar0, UINT_MAX);
 	return ret;
 }
 
+/**
+ * @brief irq_set_affinity() is exported since v5.12. Older kernels apply the
+ *  affinity when setting the hint, which is cleared right after so that
+ *  it doesn't refer to the mask of caller.
+ */
+static int dnvme_irq_set_affinity(unsigned int irq, const struct cpumask *mask)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 12, 0)
+	return irq_set_affinity(irq, mask);
+#else
+	int ret;
+
+	ret = irq_set_affinity_hint(irq, mask);
+	irq_set_affinity_hint(irq, NULL);
+	return ret;
+#endif
+}
+
 /**
  * @brief Alloc and enable msi irq, Register irq handler, Create irq node.
  *
@@ -732,6 +586,9 @@ out:
  *  if the adding of node fails it cleans up and exits with invalid return
  *  code.
  *
+ * @note Vector 0 is left for admin queue, the others are spread over CPUs
+ *  so that the completion of each I/O queue can land on its own CPU. The
+ *  vectors aren't managed by kernel, so that they can be pinned by user.
  * @return 0 on success, otherwise a negative errno
  */
 static int set_int_msix(struct nvme_device *ndev, u16 num_irqs)
@@ -739,7 +596,8 @@ static int set_int_msix(struct nvme_device *ndev, u16 num_irqs)
 	struct nvme_irq_set *irq = &ndev->irq_set;
 	struct pci_dev *pdev = ndev->pdev;
 	struct msix_entry *entries;
-	int ret, i, j;
+	int node = dev_to_node(&pdev->dev);
+	int ret, i;
 
 	entries = kcalloc(num_irqs, sizeof(*entries), GFP_KERNEL);
 	if (!entries) {
@@ -747,10 +605,7 @@ static int set_int_msix(struct nvme_device *ndev, u16 num_irqs)
 		return -ENOMEM;
 	}
 
-	for (i = 0; i < num_irqs; i++)
-		entries[i].entry = i;
-
-	ret = pci_enable_msix_range(pdev, entries, num_irqs, num_irqs);
+	ret = pci_alloc_irq_vectors(pdev, num_irqs, num_irqs, PCI_IRQ_MSIX);
 	if (ret != num_irqs) {
 		dnvme_err(ndev, "failed to enable msix!(%d)\n", ret);
 		ret = -EPERM;
@@ -758,44 +613,40 @@ static int set_int_msix(struct nvme_device *ndev, u16 num_irqs)
 	}
 
 	for (i = 0; i < num_irqs; i++) {
-		ret = request_irq(entries[i].vector, dnvme_interrupt, 
-			IRQF_SHARED, "msi-x", &ndev->irq_set);
-		if (ret < 0) {
-			dnvme_err(ndev, "failed to request vec(%u)!\n", 
-				entries[i].vector);
+		entries[i].entry = i;
+		entries[i].vector = pci_irq_vector(pdev, i);
+	}
+
+	for (i = 0; i < num_irqs; i++) {
+		ret = request_irq_node(&ndev->irq_set, entries[i].vector,
+			entries[i].entry, IRQF_SHARED, "msi-x");
+		if (ret < 0)
 			goto out2;
-		}
 	}
 
-	for (j = 0; j < num_irqs; j++) {
-		ret = create_irq_work_pair(&ndev->irq_set, entries[j].vector, 
-			entries[j].entry);
-		if (ret < 0) {
-			dnvme_err(ndev, "failed to create irq work pair(%u)!\n", 
-				entries[j].entry);
-			goto out3;
-		}
+	for (i = 1; i < num_irqs; i++) {
+		ret = dnvme_irq_set_affinity(entries[i].vector,
+			cpumask_of(cpumask_local_spread(i - 1, node)));
+		if (ret < 0)
+			dnvme_warn(ndev, "failed to spread irq(ID:%u)!(%d)\n", 
+				entries[i].entry, ret);
 	}
 
 	if (pba_bits_is_set(irq->msix.pba, entries, num_irqs)) {
 		dnvme_err(ndev, "PBA bit is set at IRQ init, shall set none!\n");
 		ret = -EINVAL;
-		goto out3;
+		goto out2;
 	}
 
 	set_msix_mask(irq->msix.tb, entries, num_irqs);
 
 	kfree(entries);
 	return 0;
-out3:
-	for (j--; j >= 0; j--)
-		destroy_irq_work_pair(&ndev->irq_set, entries[j].vector, 
-			entries[j].entry);
 out2:
 	for (i--; i >= 0; i--)
-		free_irq(entries[i].vector, &ndev->irq_set);
+		free_irq_node(&ndev->irq_set, entries[i].entry);
 
-	pci_disable_msix(pdev);
+	pci_free_irq_vectors(pdev);
 out:
 	kfree(entries);
 	return ret;
@@ -944,7 +795,7 @@ void dnvme_clean_interrupt(struct nvme_device *ndev)
 	enum nvme_irq_type irq_type = ndev->irq_set.irq_type;
 
 	list_for_each_entry(irq, &ndev->irq_set.irq_list, irq_entry) {
-		free_irq(irq->int_vec, &ndev->irq_set);
+		free_irq(irq->int_vec, irq);
 	}
 
 	switch (irq_type) {
@@ -966,10 +817,7 @@ void dnvme_clean_interrupt(struct nvme_device *ndev)
 		break; /* Nothing to do */
 	}
 
-	destroy_irq_work_queue(&ndev->irq_set);
-
 	delete_irq_list(&ndev->irq_set);
-	delete_work_list(&ndev->irq_set);
 
 	/* update active irq info */
 	ndev->irq_set.irq_type = NVME_INT_NONE;
@@ -977,6 +825,40 @@ void dnvme_clean_interrupt(struct nvme_device *ndev)
 }
 
 
+/**
+ * @return The first CPU of effective affinity, or -1 if it's unknown.
+ */
+static int dnvme_irq_effective_cpu(u32 int_vec)
+{
+	const struct cpumask *mask = irq_get_effective_affinity_mask(int_vec);
+	unsigned int cpu;
+
+	if (!mask)
+		return -1;
+
+	cpu = cpumask_first(mask);
+	return cpu < nr_cpu_ids ? cpu : -1;
+}
+
+static int dnvme_report_effective_cpu(struct nvme_device *ndev,
+	struct nvme_interrupt *irq)
+{
+	struct nvme_irq *node;
+	int cpu;
+
+	list_for_each_entry(node, &ndev->irq_set.irq_list, irq_entry) {
+		if (node->irq_id >= irq->num_irqs)
+			continue;
+
+		cpu = dnvme_irq_effective_cpu(node->int_vec);
+		if (put_user(cpu, &irq->eff_cpu[node->irq_id])) {
+			dnvme_err(ndev, "failed to copy to user space!\n");
+			return -EFAULT;
+		}
+	}
+	return 0;
+}
+
 /**
  * @brief Set new interrupt scheme for this device
  *
@@ -1008,12 +890,6 @@ int dnvme_set_interrupt(struct nvme_device *ndev, struct nvme_interrupt __user *
 	if (act_irq != NVME_INT_NONE)
 		dnvme_clean_interrupt(ndev);
 
-	ret = create_irq_work_queue(irq_set);
-	if (ret < 0) {
-		dnvme_err(ndev, "Failed to initialize resources for work queue/items");
-		return ret;
-	}
-
 	switch (irq.irq_type) {
 	case NVME_INT_MSI_SINGLE:
 		ret = set_int_msi_single(ndev);
@@ -1037,7 +913,7 @@ int dnvme_set_interrupt(struct nvme_device *ndev, struct nvme_interrupt __user *
 
 	if (ret < 0) {
 		dnvme_err(ndev, "failed to set irq_type:%d!\n",irq.irq_type);
-		goto out_destroy_wq;
+		return ret;
 	}
 
 	/* update active irq info */
@@ -1045,10 +921,114 @@ int dnvme_set_interrupt(struct nvme_device *ndev, struct nvme_interrupt __user *
 	irq_set->irq_name = dnvme_irq_type_name(irq.irq_type);
 	irq_set->nr_irq = irq.num_irqs;
 
+	if (irq.eff_cpu)
+		return dnvme_report_effective_cpu(ndev, &irq);
+	return 0;
+}
+
+/**
+ * @brief Bind or unbind the eventfd which is signaled when the irq fired.
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_set_irq_eventfd(struct nvme_device *ndev, 
+	struct nvme_irq_eventfd __user *uevt)
+{
+	struct nvme_irq_eventfd evt;
+	struct eventfd_ctx *trigger = NULL;
+	struct eventfd_ctx *old;
+	struct nvme_irq *irq;
+
+	if (copy_from_user(&evt, uevt, sizeof(evt))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	irq = find_irq_node_by_id(&ndev->irq_set, evt.irq_id);
+	if (!irq) {
+		dnvme_err(ndev, "failed to find irq node(ID:%u)!\n", evt.irq_id);
+		return -EINVAL;
+	}
+
+	if (evt.fd >= 0) {
+		trigger = eventfd_ctx_fdget(evt.fd);
+		if (IS_ERR(trigger)) {
+			dnvme_err(ndev, "fd(%d) isn't an eventfd!\n", evt.fd);
+			return PTR_ERR(trigger);
+		}
+	}
+
+	old = irq->trigger;
+	WRITE_ONCE(irq->trigger, trigger);
+
+	if (old) {
+		/* wait for the ISR which may still signal the old one */
+		synchronize_irq(irq->int_vec);
+		eventfd_ctx_put(old);
+	}
 	return 0;
+}
+
+/**
+ * @brief Pin the irq to CPUs, and report its effective affinity.
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_set_irq_affinity(struct nvme_device *ndev, 
+	struct nvme_irq_affinity __user *uaff)
+{
+	struct nvme_irq_affinity aff;
+	struct nvme_irq *irq;
+	const struct cpumask *eff;
+	cpumask_var_t mask;
+	unsigned int nbits = min_t(unsigned int, nr_cpu_ids, 
+		NVME_IRQ_CPUMASK_SIZE * 32);
+	int ret = 0;
+
+	if (copy_from_user(&aff, uaff, sizeof(aff))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	irq = find_irq_node_by_id(&ndev->irq_set, aff.irq_id);
+	if (!irq) {
+		dnvme_err(ndev, "failed to find irq node(ID:%u)!\n", aff.irq_id);
+		return -EINVAL;
+	}
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL)) {
+		dnvme_err(ndev, "failed to alloc cpumask!\n");
+		return -ENOMEM;
+	}
+	bitmap_from_arr32(cpumask_bits(mask), aff.cpumask, nbits);
+
+	if (!cpumask_empty(mask)) {
+		if (!cpumask_intersects(mask, cpu_online_mask)) {
+			dnvme_err(ndev, "CPUs to pin irq(ID:%u) are offline!\n",
+				aff.irq_id);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		ret = dnvme_irq_set_affinity(irq->int_vec, mask);
+		if (ret < 0) {
+			dnvme_err(ndev, "failed to pin irq(ID:%u)!(%d)\n", 
+				aff.irq_id, ret);
+			goto out;
+		}
+	}
 
-out_destroy_wq:
-	destroy_irq_work_queue(irq_set);
+	memset(aff.eff_mask, 0, sizeof(aff.eff_mask));
+	eff = irq_get_effective_affinity_mask(irq->int_vec);
+	if (eff)
+		bitmap_to_arr32(aff.eff_mask, cpumask_bits(eff), nbits);
+
+	if (copy_to_user(uaff, &aff, sizeof(aff))) {
+		dnvme_err(ndev, "failed to copy to user space!\n");
+		ret = -EFAULT;
+	}
+out:
+	free_cpumask_var(mask);
 	return ret;
 }
 
@@ -1058,11 +1038,10 @@ out_destroy_wq:
  */
 int dnvme_reset_isr_flag(struct nvme_device *ndev, u16 irq_no)
 {
-	struct pci_dev *pdev = ndev->pdev;
 	struct nvme_irq *irq;
 	struct nvme_icq *icq;
 	struct nvme_cq *cq;
-	u32 remain = 0;
+	bool pending = false;
 
 	irq = find_irq_node_by_id(&ndev->irq_set, irq_no);
 	if (!irq) {
@@ -1077,44 +1056,144 @@ int dnvme_reset_isr_flag(struct nvme_device *ndev, u16 irq_no)
 			return -EBADSLT;
 		}
 
-		remain = dnvme_get_cqe_remain(cq, &pdev->dev);
-		if (remain)
+		/* CQs sharing the irq may be reaped by others concurrently */
+		pending = dnvme_cqe_is_pending(cq);
+		if (pending)
 			break;
 	}
 
 	/* reset the isr flag */
-	if (remain == 0) {
+	if (!pending) {
 		atomic_set(&irq->isr_fired, 0);
 	}
 	return 0;
 }
 
+/**
+ * @brief Map the event ring of irq to user space, which is read-only.
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_mmap_irq_ring(struct nvme_device *ndev, struct vm_area_struct *vma)
+{
+	u16 id = NVME_VMPGOFF_ID(vma->vm_pgoff);
+	struct nvme_irq *irq;
+	int ret;
+
+	irq = find_irq_node_by_id(&ndev->irq_set, id);
+	if (!irq) {
+		dnvme_err(ndev, "failed to find irq node(ID:%u)!\n", id);
+		return -EINVAL;
+	}
+
+	if (vma->vm_flags & VM_WRITE) {
+		dnvme_err(ndev, "irq event ring shall be mapped read-only!\n");
+		return -EPERM;
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	ret = remap_vmalloc_range(vma, irq->ring, 0);
+	if (ret < 0)
+		dnvme_err(ndev, "failed to map irq(ID:%u) ring!(%d)\n", id, ret);
+
+	return ret;
+}
+
+/**
+ * @brief Record the event in the ring, ISR is the only writer of the ring.
+ */
+static void dnvme_record_irq_event(struct nvme_irq *irq, u64 ts, u16 cqid,
+	u16 head)
+{
+	struct nvme_irq_ring *ring = irq->ring;
+	u64 head = ring->head;
+	struct nvme_irq_event *evt;
+
+	evt = &ring->event[head & (NVME_IRQ_RING_ENTRIES - 1)];
+	evt->ts = ts;
+	evt->cqid = cqid;
+	evt->head = head;
+	/* event shall be visible before head moves on */
+	smp_store_release(&ring->head, head + 1);
+}
+
+/**
+ * @brief ISR, the irq node is passed in as context.
+ *
+ * @note Mask the vector and mark the irq node fired directly in the hard irq
+ *  context, then wake up the reapers waiting for CQs associated with the irq.
+ */
 irqreturn_t dnvme_interrupt(int int_vec, void *data)
 {
-	struct nvme_irq_set *irq_set = (struct nvme_irq_set *)data;
+	struct nvme_irq *irq = (struct nvme_irq *)data;
+	struct nvme_irq_set *irq_set = irq->irq_set;
 	struct nvme_device *ndev = dnvme_irq_to_device(irq_set);
-	struct nvme_work *wk_node;
+	struct nvme_icq *icq;
+	struct nvme_cq *cq;
+	struct eventfd_ctx *trigger;
+	bool msix = irq_set->irq_type == NVME_INT_MSIX;
+	bool polled = false;
+	u64 ts = ktime_get_ns();
+	u16 cqid = NVME_IRQ_EVENT_NO_CQ;
+	u16 head = 0;
 
 	trace_dnvme_interrupt(irq_set, int_vec);
 
-	wk_node = find_work_node_by_vec(irq_set, int_vec);
-	if (!wk_node) {
-		dnvme_err(ndev, "spurious irq with int_vec(%d)", int_vec);
-		return IRQ_NONE;
+	/*
+	 * INTMS is shared by all vectors, so serialize ISR's getting fired on
+	 * different cores. MSI-X vector is masked in its own table entry.
+	 */
+	if (!msix)
+		spin_lock(&irq_set->spin_lock);
+
+	/* Mask this interrupt until we have reaped all CQ entries */
+	dnvme_mask_interrupt(irq_set, irq->irq_id);
+
+	if (!msix)
+		spin_unlock(&irq_set->spin_lock);
+
+	atomic_set(&irq->isr_fired, 1);
+	atomic_inc(&irq->isr_count);
+
+	trigger = READ_ONCE(irq->trigger);
+	if (trigger) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+		eventfd_signal(trigger);
+#else
+		eventfd_signal(trigger, 1);
+#endif
 	}
 
-	/* To resolve contention between ISR's getting fired on different cores */
-	spin_lock(&irq_set->spin_lock);
-	dnvme_vdbg(ndev, "TH:IRQNO = %d is serviced", wk_node->irq_id);
+	rcu_read_lock();
+	list_for_each_entry_rcu(icq, &irq->icq_list, entry) {
+		cq = dnvme_find_cq(ndev, icq->cq_id);
+		if (cq) {
+			if (cqid == NVME_IRQ_EVENT_NO_CQ) {
+				cqid = cq->pub.q_id;
+				head = READ_ONCE(cq->pub.head_ptr);
+			}
+			wake_up_interruptible(&cq->wait);
+			/* CQ entries of io_uring commands are reaped by driver */
+			if (cq->pub.q_id != NVME_AQ_ID &&
+				atomic_read(&ndev->nr_uring))
+				queue_work(system_highpri_wq, &cq->uring_work);
+		}
+		if (xa_get_mark(&ndev->cqs, icq->cq_id, DNVME_CQ_POLL_MARK))
+			polled = true;
+	}
+	rcu_read_unlock();
 
-	/* Mask this interrupt until we have reaped all CQ entries */
-	dnvme_mask_interrupt(irq_set, wk_node->irq_id);
+	dnvme_record_irq_event(irq, ts, cqid, head);
 
-	if (queue_work(irq_set->wq, &wk_node->work) == 0)
-		dnvme_vdbg(ndev, "work node(%u:%u) already in queue!\n",
-			wk_node->irq_id, wk_node->int_vec);
+	if (polled)
+		wake_up_interruptible(&ndev->poll_wait);
 
-	spin_unlock(&irq_set->spin_lock);
+	dnvme_vdbg(ndev, "irq node(ID:%u) count is %u\n", irq->irq_id,
+		atomic_read(&irq->isr_count));
 	return IRQ_HANDLED;
 }
 
@@ -25,6 +25,12 @@ void dnvme_delete_icq_node(struct nvme_irq_set *irq_set, u16 cq_id, u16 irq_no);
 int dnvme_set_interrupt(struct nvme_device *ndev, struct nvme_interrupt __user *uirq);
 void dnvme_clean_interrupt(struct nvme_device *ndev);
 
+int dnvme_set_irq_eventfd(struct nvme_device *ndev, 
+	struct nvme_irq_eventfd __user *uevt);
+int dnvme_set_irq_affinity(struct nvme_device *ndev, 
+	struct nvme_irq_affinity __user *uaff);
+int dnvme_mmap_irq_ring(struct nvme_device *ndev, struct vm_area_struct *vma);
+
 int dnvme_mask_interrupt(struct nvme_irq_set *irq, u16 irq_no);
 int dnvme_unmask_interrupt(struct nvme_irq_set *irq, u16 irq_no);
 
@@ -0,0 +1,209 @@
+/**
+ * @file latency.c
+ * @author yeqiang_xu <yeqiang_xu@maxio-tech.com>
+ * @brief Latency statistics of commands.
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+#include <linux/uaccess.h>
+
+#include "nvme.h"
+#include "core.h"
+#include "queue.h"
+
+#define DNVME_LAT_SUB_MASK		(BIT(DNVME_LAT_SUB_BITS) - 1)
+
+/**
+ * @brief Get the bucket index of latency value.
+ *
+ * @note Values less than 2^DNVME_LAT_SUB_BITS have their own buckets, the
+ *  others are grouped by the most significant bit, then split linearly.
+ */
+static u32 dnvme_lat_index(u64 val)
+{
+	u32 shift;
+
+	if (val <= DNVME_LAT_SUB_MASK)
+		return val;
+
+	shift = fls64(val) - 1 - DNVME_LAT_SUB_BITS;
+	return ((shift + 1) << DNVME_LAT_SUB_BITS) +
+		((val >> shift) & DNVME_LAT_SUB_MASK);
+}
+
+/**
+ * @brief Get the largest latency value in the bucket.
+ */
+static u64 dnvme_lat_bucket_max(u32 idx)
+{
+	u32 shift;
+
+	if (idx <= DNVME_LAT_SUB_MASK)
+		return idx;
+
+	shift = (idx >> DNVME_LAT_SUB_BITS) - 1;
+	return ((BIT_ULL(DNVME_LAT_SUB_BITS) + (idx & DNVME_LAT_SUB_MASK) + 1)
+		<< shift) - 1;
+}
+
+static void dnvme_lat_reset(struct nvme_lat_hist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+	hist->min = U64_MAX;
+}
+
+/**
+ * @brief Get the latency value at the permille of the histogram.
+ */
+static u64 dnvme_lat_percentile(struct nvme_lat_hist *hist, u32 permille)
+{
+	u64 target = div_u64(hist->count * permille + 999, 1000);
+	u64 sum = 0;
+	u32 i;
+
+	for (i = 0; i < DNVME_LAT_BUCKETS; i++) {
+		sum += hist->bucket[i];
+		if (sum >= target)
+			return min(dnvme_lat_bucket_max(i), hist->max);
+	}
+	return hist->max;
+}
+
+/**
+ * @brief Stamp the commands between SQ tail doorbell and the virtual tail,
+ *  the caller shall hold SQ lock before ringing doorbell.
+ */
+void dnvme_lat_stamp_cmds(struct nvme_sq *sq)
+{
+	struct nvme_common_command *ccmd;
+	struct nvme_cmd *cmd;
+	void *base = sq->contig ? sq->buf : sq->prps->buf;
+	u64 now = ktime_get_ns();
+	u32 idx;
+	u16 cid;
+
+	for (idx = sq->pub.tail_ptr; idx != sq->pub.tail_ptr_virt;
+		idx = (idx + 1) % sq->pub.elements) {
+		ccmd = base + (idx << sq->pub.sqes);
+		/* SQ in CMB is I/O memory */
+		if (sq->use_cmb)
+			cid = readw((void __iomem *)&ccmd->command_id);
+		else
+			cid = ccmd->command_id;
+
+		cmd = dnvme_find_cmd(sq, cid);
+		if (cmd && cmd->idx == idx)
+			cmd->stamp = now;
+	}
+}
+
+/**
+ * @brief Count the latency of the completed command, the caller shall hold
+ *  SQ lock.
+ */
+void dnvme_lat_record(struct nvme_sq *sq, struct nvme_cmd *cmd)
+{
+	struct nvme_lat_hist *hist = sq->lat;
+	u64 lat;
+
+	if (!hist || !cmd->stamp)
+		return;
+
+	lat = ktime_get_ns() - cmd->stamp;
+	hist->bucket[dnvme_lat_index(lat)]++;
+	hist->count++;
+	hist->sum += lat;
+	hist->min = min(hist->min, lat);
+	hist->max = max(hist->max, lat);
+}
+
+void dnvme_lat_get_stat(struct nvme_lat_hist *hist, struct nvme_lat_stat *stat)
+{
+	if (!hist || !hist->count) {
+		stat->count = 0;
+		stat->min = stat->max = stat->avg = 0;
+		stat->p50 = stat->p99 = stat->p999 = 0;
+		return;
+	}
+
+	stat->count = hist->count;
+	stat->min = hist->min;
+	stat->max = hist->max;
+	stat->avg = div64_u64(hist->sum, hist->count);
+	stat->p50 = dnvme_lat_percentile(hist, 500);
+	stat->p99 = dnvme_lat_percentile(hist, 990);
+	stat->p999 = dnvme_lat_percentile(hist, 999);
+}
+
+int dnvme_lat_stat(struct nvme_device *ndev, struct nvme_lat_stat __user *ustat)
+{
+	struct nvme_lat_stat stat;
+	struct nvme_sq *sq;
+	int ret = 0;
+
+	if (copy_from_user(&stat, ustat, sizeof(stat))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	sq = dnvme_find_sq(ndev, stat.sqid);
+	if (!sq) {
+		dnvme_err(ndev, "SQ(%u) doesn't exist!\n", stat.sqid);
+		return -EBADSLT;
+	}
+
+	mutex_lock(&sq->lock);
+
+	switch (stat.op) {
+	case NVME_LAT_STAT_GET:
+		break;
+
+	case NVME_LAT_STAT_ENABLE:
+		if (sq->lat)
+			break;
+
+		sq->lat = kvmalloc(sizeof(*sq->lat), GFP_KERNEL);
+		if (!sq->lat) {
+			dnvme_err(ndev, "failed to alloc histogram!\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+		dnvme_lat_reset(sq->lat);
+		break;
+
+	case NVME_LAT_STAT_DISABLE:
+		kvfree(sq->lat);
+		sq->lat = NULL;
+		break;
+
+	case NVME_LAT_STAT_RESET:
+		if (sq->lat)
+			dnvme_lat_reset(sq->lat);
+		break;
+
+	default:
+		dnvme_err(ndev, "op(%u) is unknown!\n", stat.op);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	dnvme_lat_get_stat(sq->lat, &stat);
+out:
+	mutex_unlock(&sq->lock);
+
+	if (!ret && copy_to_user(ustat, &stat, sizeof(stat))) {
+		dnvme_err(ndev, "failed to copy to user space!\n");
+		ret = -EFAULT;
+	}
+	return ret;
+}
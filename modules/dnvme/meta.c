@@ -27,14 +27,13 @@ static int dnvme_meta_setup_sgl(struct nvme_device *ndev, struct nvme_prps *prps
 	void **prp_list;
 	dma_addr_t *prp_dma;
 	/* The number of SGL data block descriptors required */
-	unsigned int nr_desc = prps->num_map_pgs; 
+	unsigned int nr_desc = prps->num_dma_segs; 
 	unsigned int nr_seg; /* The number of SGL segments required */
 	int ret = -ENOMEM;
 	int i, j, k;
 	
-	nr_seg = (nr_desc == 1) ? 1 : (DIV_ROUND_UP(
-			sizeof(struct nvme_sgl_desc) * nr_desc, 
-			PAGE_SIZE - sizeof(struct nvme_sgl_desc)) + 1);
+	nr_seg = (nr_desc == 1) ? 1 : 
+		(dnvme_nr_list_pages(nr_desc, NVME_SGES_PER_PAGE) + 1);
 
 	prp_list = kzalloc(sizeof(void *) * nr_seg, GFP_KERNEL);
 	if (!prp_list) {
@@ -72,7 +71,7 @@ static int dnvme_meta_setup_sgl(struct nvme_device *ndev, struct nvme_prps *prps
 
 		sgl_desc = prp_list[j];
 
-		if (k == (NVME_SGES_PER_PAGE - 1)) {
+		if (k == (NVME_SGES_PER_PAGE - 1) && nr_desc > 1) {
 			/* SGL segment last descriptor pointer to next SGL segment */
 			j++;
 			dnvme_sgl_set_seg(&sgl_desc[k], prp_dma[j], nr_desc);
@@ -103,7 +102,7 @@ static int dnvme_meta_prepare_sgl(struct nvme_device *ndev,
 	struct nvme_prps *prps;
 	int ret;
 
-	prps = kzalloc(sizeof(*prps), GFP_KERNEL);
+	prps = dnvme_alloc_prps(NULL, 0);
 	if (!prps) {
 		dnvme_err(ndev, "failed to alloc prps!\n");
 		return -ENOMEM;
@@ -124,7 +123,7 @@ static int dnvme_meta_prepare_sgl(struct nvme_device *ndev,
 out_unmap_page:
 	dnvme_unmap_user_page(ndev, prps);
 out_free_prp:
-	kfree(prps);
+	dnvme_free_prps(prps);
 	return ret;
 }
 
@@ -12,7 +12,6 @@
 #include <linux/kernel.h>
 #include <linux/skbuff.h>
 #include <linux/limits.h>
-#include <linux/delay.h>
 #include <linux/pci.h>
 #include <net/genetlink.h>
 #include <net/sock.h>
@@ -26,7 +25,6 @@ static struct genl_family nvme_gnl_family;
 static int dnvme_gnl_cmd_reap_cqe(struct sk_buff *skb, struct genl_info *info)
 {
 	struct nvme_device *ndev;
-	struct pci_dev *pdev;
 	struct nvme_cq *cq;
 	struct sk_buff *msg;
 	void *hdr;
@@ -57,32 +55,24 @@ static int dnvme_gnl_cmd_reap_cqe(struct sk_buff *skb, struct genl_info *info)
 
 	if (info->attrs[NVME_GNL_ATTR_TIMEOUT]) {
 		timeout = nla_get_s32(info->attrs[NVME_GNL_ATTR_TIMEOUT]);
-		if (timeout < 0)
-			timeout = S32_MAX;
 	}
 
-	ndev = dnvme_lock_device(instance);
+	ndev = dnvme_find_device(instance);
 	if (IS_ERR(ndev)) {
 		status = PTR_ERR(ndev);
 		goto out_response;
 	}
-	pdev = ndev->pdev;
 
-	cq = dnvme_find_cq(ndev, cqid);
-	if (!cq) {
-		dnvme_err(ndev, "failed to find CQ(%u)!\n", cqid);
-		status = -ENOENT;
+	status = dnvme_lock_wait_cqe(ndev, cqid, expect, timeout, &cq);
+	if (!cq)
+		goto out_response;
+	if (status < 0) {
+		/* netlink reply can't be restarted, report it as interrupted */
+		if (status == -ERESTARTSYS)
+			status = -EINTR;
 		goto out_unlock;
 	}
-
-	do {
-		actual = dnvme_get_cqe_remain(cq, &pdev->dev);
-		if (actual >= expect)
-			break;
-
-		msleep(1);
-		timeout--;
-	} while (timeout > 0);
+	actual = status;
 
 	if (actual >= expect)
 		status = dnvme_reap_cqe(cq, expect, (void *)buf_ptr, buf_size);
@@ -97,7 +87,7 @@ static int dnvme_gnl_cmd_reap_cqe(struct sk_buff *skb, struct genl_info *info)
 	}
 
 out_unlock:
-	dnvme_unlock_device(ndev);
+	dnvme_unlock_cq_for_reap(ndev, cq);
 
 out_response:
 	msg = genlmsg_new(GENLMSG_DEFAULT_SIZE, GFP_KERNEL);
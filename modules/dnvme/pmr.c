@@ -20,6 +20,7 @@
 
 static int dnvme_pmr_parse_capability(struct nvme_device *ndev, struct nvme_pmr *pmr)
 {
+	struct pci_dev *pdev = ndev->pdev;
 	void __iomem *bar0 = ndev->bar[0];
 	u32 pmrcap;
 
@@ -39,13 +40,16 @@ static int dnvme_pmr_parse_capability(struct nvme_device *ndev, struct nvme_pmr
 	pmr->timeout = NVME_PMRCAP_PMRTO(pmrcap) * (NVME_PMRCAP_PMRTU(pmrcap) ? 
 		(60 * 1000) : 500);
 	pmr->cmss = (pmrcap & NVME_PMRCAP_CMSS) ? 1 : 0;
+
+	pmr->res_addr = pci_resource_start(pdev, pmr->bir);
+	pmr->bus_addr = pci_bus_address(pdev, pmr->bir);
+	pmr->size = pci_resource_len(pdev, pmr->bir);
 	
 	return 0;
 }
 
 static int dnvme_pmr_enable_cba(struct nvme_device *ndev, struct nvme_pmr *pmr)
 {
-	struct pci_dev *pdev = ndev->pdev;
 	void __iomem *bar0 = ndev->bar[0];
 	u32 pmrmscl, pmrmscu, pmrsts;
 
@@ -54,9 +58,6 @@ static int dnvme_pmr_enable_cba(struct nvme_device *ndev, struct nvme_pmr *pmr)
 		return 0;
 	}
 
-	pmr->res_addr = pci_resource_start(pdev, pmr->bir);
-	pmr->bus_addr = pci_bus_address(pdev, pmr->bir);
-	pmr->size = pci_resource_len(pdev, pmr->bir);
 	pmrmscu = upper_32_bits(pmr->bus_addr);
 	pmrmscl = lower_32_bits(pmr->bus_addr) | NVME_PMRMSCL_CMSE;
 
@@ -160,6 +161,8 @@ int dnvme_map_pmr(struct nvme_device *ndev)
 		return -ENOMEM;
 	}
 
+	spin_lock_init(&pmr->map_lock);
+
 	ret = dnvme_pmr_parse_capability(ndev, pmr);
 	if (ret < 0)
 		goto out_free_pmr;
@@ -172,6 +175,16 @@ int dnvme_map_pmr(struct nvme_device *ndev)
 	if (ret < 0)
 		goto out_disable_cba;
 
+	/*
+	 * Kernel never accesses PMR, drop its uncached mapping so that user
+	 * is free to map PMR write-combining or uncached.
+	 */
+	if (ndev->cmb && ndev->cmb->bar == pmr->bir)
+		dnvme_warn(ndev, "PMR shares BAR%u with CMB, user mapping "
+			"follows CMB!\n", pmr->bir);
+	else
+		dnvme_remap_bar(ndev, pmr->bir, NVME_BAR_MAP_NONE);
+
 	dnvme_info(ndev, "PMR BIR:%u, Addr:0x%llx, Size:0x%llx\n", pmr->bir,
 		pmr->bus_addr, pmr->size);
 
@@ -190,6 +203,9 @@ void dnvme_unmap_pmr(struct nvme_device *ndev)
 	if (!ndev->pmr)
 		return;
 
+	if (!ndev->bar[ndev->pmr->bir])
+		dnvme_remap_bar(ndev, ndev->pmr->bir, NVME_BAR_MAP_UC);
+
 	dnvme_disable_pmr(ndev, ndev->pmr);
 	dnvme_pmr_disable_cba(ndev, ndev->pmr);
 	kfree(ndev->pmr);
@@ -173,6 +173,33 @@ static int cmd_dump_queue(struct nvme_device *ndev)
 	return 0;
 }
 
+static int cmd_dump_latency(struct nvme_device *ndev)
+{
+	struct nvme_lat_stat stat;
+	struct nvme_sq *sq;
+	unsigned long i;
+
+	dnvme_lock_device_shared(ndev);
+
+	xa_for_each(&ndev->sqs, i, sq) {
+		mutex_lock(&sq->lock);
+		if (!sq->lat) {
+			mutex_unlock(&sq->lock);
+			continue;
+		}
+		dnvme_lat_get_stat(sq->lat, &stat);
+		mutex_unlock(&sq->lock);
+
+		dnvme_info(ndev, "SQ%u cnt:%llu lat(ns) min:%llu avg:%llu "
+			"max:%llu p50:%llu p99:%llu p99.9:%llu\n", sq->pub.sq_id,
+			stat.count, stat.min, stat.avg, stat.max, stat.p50,
+			stat.p99, stat.p999);
+	}
+
+	dnvme_unlock_device_shared(ndev);
+	return 0;
+}
+
 static int cmd_dump(struct nvme_device *ndev, char *argv[], int argc)
 {
 	if (argc < 1)
@@ -184,6 +211,8 @@ static int cmd_dump(struct nvme_device *ndev, char *argv[], int argc)
 		cmd_dump_metadata(ndev, &argv[1], argc - 1);
 	else if (!strncmp(argv[0], "queue", strlen("queue")))
 		cmd_dump_queue(ndev);
+	else if (!strncmp(argv[0], "lat", strlen("lat")))
+		cmd_dump_latency(ndev);
 
 	return 0;
 }
@@ -317,6 +346,8 @@ static ssize_t dnvme_proc_read(struct file *file, char __user *buf,
 		":dump meta data\n", dev_name(dev));
 	dnvme_info(ndev, "echo \"dump queue\" > /proc/nvme/%s "
 		":dump queue info in a concise manner", dev_name(dev));
+	dnvme_info(ndev, "echo \"dump lat\" > /proc/nvme/%s "
+		":dump latency statistics of SQs\n", dev_name(dev));
 	dnvme_info(ndev, "echo \"read bar [bar] [offset] [len]\" > /proc/nvme/%s "
 		":read bar space data\n", dev_name(dev));
 
@@ -15,10 +15,13 @@
 #include <linux/init.h>
 #include <linux/timer.h>
 #include <linux/jiffies.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/sched/signal.h>
 #include <linux/uaccess.h>
 #include <linux/errno.h>
 #include <linux/interrupt.h>
-#include <linux/pci-p2pdma.h>
 
 #include "nvme.h"
 #include "core.h"
@@ -56,7 +59,7 @@ int dnvme_check_qid_unique(struct nvme_device *ndev,
 }
 
 /**
- * @brief Find the cmd node in SQ list by the given ID
+ * @brief Find the cmd node in SQ command table by the given ID
  * 
  * @param sq submission queue
  * @param cid command identify
@@ -64,46 +67,98 @@ int dnvme_check_qid_unique(struct nvme_device *ndev,
  */
 struct nvme_cmd *dnvme_find_cmd(struct nvme_sq *sq, u16 cid)
 {
-	struct nvme_cmd *cmd;
+	if (unlikely(cid >= sq->pub.elements))
+		return NULL;
+
+	return sq->cmds[cid];
+}
+
+/**
+ * @brief Get a free command identifier of the SQ.
+ *
+ * @note Start searching from @next_cid, so the CID is assigned in turn. It's
+ *  possible that the command which occupies the slot has been fetched but not
+ *  reaped yet, skip it in that case.
+ *
+ * @return free command identifier on success, otherwise returns -EBUSY.
+ */
+int dnvme_get_free_cid(struct nvme_sq *sq)
+{
+	u32 elements = sq->pub.elements;
+	u32 cid = sq->next_cid;
+	u32 i;
+
+	for (i = 0; i < elements; i++) {
+		if (!sq->cmds[cid])
+			return cid;
 
-	list_for_each_entry(cmd, &sq->cmd_list, entry) {
-		if (cid == cmd->cid)
-			return cmd;
+		cid = (cid + 1) % elements;
 	}
-	return NULL;
+	return -EBUSY;
 }
 
 /**
- * @brief Delete the cmd node from the SQ list and free memory.
+ * @brief Delete the cmd node from the SQ command table and free memory.
  * 
  * @param sq The submission queue where the command resides.
- * @param cmd_id command identify
+ * @param cmd command node
  */
-static void dnvme_delete_cmd(struct nvme_cmd *cmd)
+static void dnvme_delete_cmd(struct nvme_sq *sq, struct nvme_cmd *cmd)
 {
 	if (unlikely(!cmd))
 		return;
 
-	list_del(&cmd->entry);
-	kfree(cmd);
+	sq->cmds[cmd->cid] = NULL;
+	dnvme_free_cmd_node(sq, cmd);
+}
+
+/**
+ * @brief Get the NUMA node where queue memory is allocated, it's the node of
+ *  device unless user specifies one.
+ */
+static int dnvme_queue_node(struct nvme_device *ndev, bool use_node, u16 node)
+{
+	return use_node ? node : dev_to_node(&ndev->pdev->dev);
 }
 
 struct nvme_sq *dnvme_alloc_sq(struct nvme_device *ndev, 
 	struct nvme_prep_sq *prep, u8 sqes)
 {
 	struct nvme_sq *sq;
-	struct pci_dev *pdev = ndev->pdev;
 	void *sq_buf;
 	u32 sq_size;
 	dma_addr_t dma;
+	int node = dnvme_queue_node(ndev, prep->use_node, prep->numa_node);
 	int ret;
 
-	sq = kzalloc(sizeof(*sq), GFP_KERNEL);
+	sq = kzalloc_node(sizeof(*sq), GFP_KERNEL, node);
 	if (!sq) {
 		dnvme_err(ndev, "failed to alloc nvme_sq!\n");
 		return NULL;
 	}
 
+	sq->cmds = kcalloc_node(prep->elements, sizeof(struct nvme_cmd *), 
+		GFP_KERNEL, node);
+	if (!sq->cmds) {
+		dnvme_err(ndev, "failed to alloc cmd table!\n");
+		goto out;
+	}
+
+	sq->cmd_buf = kzalloc_node(1 << sqes, GFP_KERNEL, node);
+	if (!sq->cmd_buf) {
+		dnvme_err(ndev, "failed to alloc cmd buf!\n");
+		goto out;
+	}
+
+	/* fall back to kmem_cache if failed to preallocate descriptors */
+	sq->cmd_nodes = kvzalloc_node(array_size(prep->elements, 
+		sizeof(struct nvme_cmd)), GFP_KERNEL, node);
+	sq->prps_nodes = kvzalloc_node(array_size(prep->elements, 
+		sizeof(struct nvme_prps)), GFP_KERNEL, node);
+	if (!sq->cmd_nodes || !sq->prps_nodes)
+		dnvme_warn(ndev, "failed to prealloc descriptors for SQ(%u)!\n",
+			prep->sq_id);
+
 	sq_size = prep->elements << sqes;
 
 	if (prep->contig) {
@@ -113,25 +168,24 @@ struct nvme_sq *dnvme_alloc_sq(struct nvme_device *ndev,
 				goto out;
 			}
 
-			sq_buf = pci_alloc_p2pmem(pdev, sq_size);
+			sq_buf = (void *)dnvme_alloc_cmb(ndev, sq_size, &dma);
 			if (!sq_buf) {
-				dnvme_err(ndev, "failed to alloc p2pmem for SQ!\n");
-				goto out;
-			}
-			dma = pci_p2pmem_virt_to_bus(pdev, sq_buf);
-			if (!dma) {
-				pci_free_p2pmem(pdev, sq_buf, sq_size);
+				dnvme_err(ndev, "failed to alloc CMB for SQ!\n");
 				goto out;
 			}
+			memset_io((void __iomem *)sq_buf, 0, sq_size);
 			sq->use_cmb = 1;
 		} else {
-			sq_buf = dma_alloc_coherent(&pdev->dev, sq_size, &dma, GFP_KERNEL);
+			sq_buf = dnvme_dma_alloc_node(ndev, sq_size, &dma, node);
 			if (!sq_buf) {
 				dnvme_err(ndev, "failed to alloc DMA addr for SQ!\n");
 				goto out;
 			}
+			/* streaming DMA memory is zeroed before mapping */
+			sq->streaming = dnvme_is_foreign_node(ndev, node);
+			if (!sq->streaming)
+				memset(sq_buf, 0, sq_size);
 		}
-		memset(sq_buf, 0, sq_size);
 
 		sq->buf = sq_buf;
 		sq->dma = dma;
@@ -139,15 +193,18 @@ struct nvme_sq *dnvme_alloc_sq(struct nvme_device *ndev,
 	}
 
 	sq->ndev = ndev;
+	sq->node = node;
+	sq->node_pool = dnvme_get_node_pool(ndev, node);
 	sq->pub.sq_id = prep->sq_id;
 	sq->pub.cq_id = prep->cq_id;
 	sq->pub.elements = prep->elements;
 	sq->pub.sqes = sqes;
 
-	INIT_LIST_HEAD(&sq->cmd_list);
 	sq->size = sq_size;
 	sq->next_cid = 0;
+	mutex_init(&sq->lock);
 	sq->db = &ndev->dbs[prep->sq_id * 2 * ndev->db_stride];
+	dnvme_dbbuf_init_sq(sq);
 
 	dnvme_print_sq(sq);
 	
@@ -161,20 +218,23 @@ struct nvme_sq *dnvme_alloc_sq(struct nvme_device *ndev,
 out2:
 	if (sq->contig) {
 		if (sq->use_cmb) {
-			pci_free_p2pmem(pdev, sq->buf, sq->size);
+			dnvme_free_cmb(ndev, (void __iomem *)sq->buf, sq->size);
 		} else {
-			dma_free_coherent(&pdev->dev, sq->size, sq->buf, sq->dma);
+			dnvme_dma_free_node(ndev, sq->size, sq->buf, sq->dma, 
+				sq->node);
 		}
 	}
 out:
+	kvfree(sq->prps_nodes);
+	kvfree(sq->cmd_nodes);
+	kfree(sq->cmd_buf);
+	kfree(sq->cmds);
 	kfree(sq);
 	return NULL;
 }
 
 void dnvme_release_sq(struct nvme_device *ndev, struct nvme_sq *sq)
 {
-	struct pci_dev *pdev = ndev->pdev;
-
 	if (unlikely(!sq))
 		return;
 
@@ -184,14 +244,20 @@ void dnvme_release_sq(struct nvme_device *ndev, struct nvme_sq *sq)
 
 	if (sq->contig) {
 		if (sq->use_cmb)
-			pci_free_p2pmem(pdev, sq->buf, sq->size);
+			dnvme_free_cmb(ndev, (void __iomem *)sq->buf, sq->size);
 		else
-			dma_free_coherent(&pdev->dev, sq->size, sq->buf, sq->dma);
+			dnvme_dma_free_node(ndev, sq->size, sq->buf, sq->dma, 
+				sq->node);
 	} else {
 		dnvme_release_prps(ndev, sq->prps);
 		sq->prps = NULL;
 	}
 
+	kvfree(sq->lat);
+	kvfree(sq->prps_nodes);
+	kvfree(sq->cmd_nodes);
+	kfree(sq->cmd_buf);
+	kfree(sq->cmds);
 	kfree(sq);
 }
 
@@ -215,13 +281,13 @@ struct nvme_cq *dnvme_alloc_cq(struct nvme_device *ndev,
 	struct nvme_prep_cq *prep, u8 cqes)
 {
 	struct nvme_cq *cq;
-	struct pci_dev *pdev = ndev->pdev;
 	void *cq_buf;
 	u32 cq_size;
 	dma_addr_t dma;
+	int node = dnvme_queue_node(ndev, prep->use_node, prep->numa_node);
 	int ret;
 
-	cq = kzalloc(sizeof(*cq), GFP_KERNEL);
+	cq = kzalloc_node(sizeof(*cq), GFP_KERNEL, node);
 	if (!cq) {
 		dnvme_err(ndev, "failed to alloc nvme_cq!\n");
 		return NULL;
@@ -236,25 +302,24 @@ struct nvme_cq *dnvme_alloc_cq(struct nvme_device *ndev,
 				goto out;
 			}
 
-			cq_buf = pci_alloc_p2pmem(pdev, cq_size);
+			cq_buf = (void *)dnvme_alloc_cmb(ndev, cq_size, &dma);
 			if (!cq_buf) {
-				dnvme_err(ndev, "failed to alloc p2pmem for CQ!\n");
-				goto out;
-			}
-			dma = pci_p2pmem_virt_to_bus(pdev, cq_buf);
-			if (!dma) {
-				pci_free_p2pmem(pdev, cq_buf, cq_size);
+				dnvme_err(ndev, "failed to alloc CMB for CQ!\n");
 				goto out;
 			}
+			memset_io((void __iomem *)cq_buf, 0, cq_size);
 			cq->use_cmb = 1;
 		} else {
-			cq_buf = dma_alloc_coherent(&pdev->dev, cq_size, &dma, GFP_KERNEL);
+			cq_buf = dnvme_dma_alloc_node(ndev, cq_size, &dma, node);
 			if (!cq_buf) {
 				dnvme_err(ndev, "failed to alloc DMA addr for CQ!\n");
 				goto out;
 			}
+			/* streaming DMA memory is zeroed before mapping */
+			cq->streaming = dnvme_is_foreign_node(ndev, node);
+			if (!cq->streaming)
+				memset(cq_buf, 0, cq_size);
 		}
-		memset(cq_buf, 0, cq_size);
 
 		cq->buf = cq_buf;
 		cq->dma = dma;
@@ -262,15 +327,21 @@ struct nvme_cq *dnvme_alloc_cq(struct nvme_device *ndev,
 	}
 
 	cq->ndev = ndev;
+	cq->node = node;
 	cq->pub.q_id = prep->cq_id;
 	cq->pub.elements = prep->elements;
 	cq->pub.cqes = cqes;
 	cq->pub.irq_no = prep->cq_irq_no;
 	cq->pub.irq_enabled = prep->cq_irq_en;
 	cq->pub.pbit_new_entry = 1;
+	cq->pub.poll_mode = prep->poll_mode;
 
 	cq->size = cq_size;
 	cq->db = &ndev->dbs[(prep->cq_id * 2 + 1) * ndev->db_stride];
+	dnvme_dbbuf_init_cq(cq);
+	mutex_init(&cq->lock);
+	init_waitqueue_head(&cq->wait);
+	INIT_WORK(&cq->uring_work, dnvme_uring_reap_work);
 
 	dnvme_print_cq(cq);
 
@@ -284,9 +355,10 @@ struct nvme_cq *dnvme_alloc_cq(struct nvme_device *ndev,
 out2:
 	if (cq->contig) {
 		if (cq->use_cmb)
-			pci_free_p2pmem(pdev, cq->buf, cq->dma);
+			dnvme_free_cmb(ndev, (void __iomem *)cq->buf, cq->size);
 		else
-			dma_free_coherent(&pdev->dev, cq->size, cq->buf, cq->dma);
+			dnvme_dma_free_node(ndev, cq->size, cq->buf, cq->dma, 
+				cq->node);
 	}
 out:
 	kfree(cq);
@@ -295,18 +367,18 @@ out:
 
 void dnvme_release_cq(struct nvme_device *ndev, struct nvme_cq *cq)
 {
-	struct pci_dev *pdev = ndev->pdev;
-
 	if (unlikely(!cq))
 		return;
 
 	xa_erase(&ndev->cqs, cq->pub.q_id);
+	cancel_work_sync(&cq->uring_work);
 
 	if (cq->contig) {
 		if (cq->use_cmb)
-			pci_free_p2pmem(pdev, cq->buf, cq->dma);
+			dnvme_free_cmb(ndev, (void __iomem *)cq->buf, cq->size);
 		else
-			dma_free_coherent(&pdev->dev, cq->size, cq->buf, cq->dma);
+			dnvme_dma_free_node(ndev, cq->size, cq->buf, cq->dma, 
+				cq->node);
 	} else {
 		dnvme_release_prps(ndev, cq->prps);
 		cq->prps = NULL;
@@ -454,25 +526,52 @@ static void dnvme_reinit_acq(struct nvme_cq *cq)
 	cq->pub.tail_ptr = 0;
 	cq->pub.pbit_new_entry = 1;
 	cq->pub.irq_enabled = 1;
+	cq->nr_ready = 0;
 	memset(cq->buf, 0, cq->size);
 }
 
+/**
+ * @brief Write the tail of SQ to doorbell, the caller shall hold SQ lock.
+ */
+void __dnvme_ring_sq_doorbell(struct nvme_sq *sq)
+{
+	dnvme_dbg(sq->ndev, "RING SQ(%u) %u => %lx (old:%u)\n", sq->pub.sq_id, 
+		sq->pub.tail_ptr_virt, (unsigned long)sq->db,
+		sq->pub.tail_ptr);
+	if (sq->lat)
+		dnvme_lat_stamp_cmds(sq);
+	trace_dnvme_sq_doorbell(sq->ndev, sq->pub.sq_id, sq->pub.tail_ptr, 
+		sq->pub.tail_ptr_virt);
+	sq->pub.tail_ptr = sq->pub.tail_ptr_virt;
+	dnvme_write_sq_db(sq, sq->pub.tail_ptr);
+}
+
 int dnvme_ring_sq_doorbell(struct nvme_device *ndev, u16 sq_id)
 {
 	struct nvme_sq *sq;
+	int ret = 0;
+
+	dnvme_lock_device_for_queue(ndev, sq_id);
 
 	sq = dnvme_find_sq(ndev, sq_id);
 	if (!sq) {
 		dnvme_err(ndev, "SQ(%u) doesn't exist!\n", sq_id);
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out;
 	}
 
-	dnvme_dbg(ndev, "RING SQ(%u) %u => %lx (old:%u)\n", sq_id, 
-		sq->pub.tail_ptr_virt, (unsigned long)sq->db,
-		sq->pub.tail_ptr);
-	sq->pub.tail_ptr = sq->pub.tail_ptr_virt;
-	dnvme_writel(sq->db, 0, sq->pub.tail_ptr);
-	return 0;
+	if (sq->user_own) {
+		dnvme_err(ndev, "SQ(%u) is owned by user!\n", sq_id);
+		ret = -EPERM;
+		goto out;
+	}
+
+	mutex_lock(&sq->lock);
+	__dnvme_ring_sq_doorbell(sq);
+	mutex_unlock(&sq->lock);
+out:
+	dnvme_unlock_device_for_queue(ndev, sq_id);
+	return ret;
 }
 
 /**
@@ -518,33 +617,117 @@ void dnvme_delete_all_queues(struct nvme_device *ndev, enum nvme_state state)
 }
 
 
+/**
+ * @brief Sync the range of discontiguous queue memory which is mapped by
+ *  @prps, only the DMA segments overlapped with the range are touched.
+ *
+ * @param oft Offset from the start of queue memory
+ */
+static void dnvme_sync_prps_range(struct device *dev, struct nvme_prps *prps,
+	u32 oft, u32 len, bool for_device)
+{
+	struct scatterlist *sg;
+	u32 seg_len, size;
+	int i;
+
+	for_each_sg(prps->sg, sg, prps->num_dma_segs, i) {
+		seg_len = sg_dma_len(sg);
+		if (oft >= seg_len) {
+			oft -= seg_len;
+			continue;
+		}
+
+		size = min(len, seg_len - oft);
+		if (for_device)
+			dma_sync_single_range_for_device(dev, sg_dma_address(sg),
+				oft, size, prps->data_dir);
+		else
+			dma_sync_single_range_for_cpu(dev, sg_dma_address(sg),
+				oft, size, prps->data_dir);
+
+		len -= size;
+		if (!len)
+			break;
+		oft = 0;
+	}
+}
+
+/**
+ * @brief Hand the SQ entry over to device after it's written by CPU.
+ */
+void dnvme_sync_sq_entry(struct nvme_sq *sq, u32 idx)
+{
+	if (sq->contig) {
+		if (sq->streaming)
+			dma_sync_single_range_for_device(&sq->ndev->pdev->dev, 
+				sq->dma, idx << sq->pub.sqes, 1 << sq->pub.sqes, 
+				DMA_BIDIRECTIONAL);
+		return;
+	}
+
+	dnvme_sync_prps_range(&sq->ndev->pdev->dev, sq->prps, 
+		idx << sq->pub.sqes, 1 << sq->pub.sqes, true);
+}
+
+/**
+ * @brief Make the CQ entry written by device visible to CPU.
+ */
+void dnvme_sync_cq_entry(struct nvme_cq *cq, u32 idx)
+{
+	if (cq->contig) {
+		if (cq->streaming)
+			dma_sync_single_range_for_cpu(&cq->ndev->pdev->dev, 
+				cq->dma, idx << cq->pub.cqes, 1 << cq->pub.cqes, 
+				DMA_BIDIRECTIONAL);
+		return;
+	}
+
+	dnvme_sync_prps_range(&cq->ndev->pdev->dev, cq->prps, 
+		idx << cq->pub.cqes, 1 << cq->pub.cqes, false);
+}
+
+/**
+ * @brief Get the number of ready entries confirmed by the last scan which
+ *  are still not reaped.
+ *
+ * @note Entries between head and the confirmed tail can't be changed by
+ *  device until head moves past them. update_cq_head() keeps the count in
+ *  step with head, if head is moved by others, scan from head again.
+ */
+static u32 dnvme_cqe_confirmed(struct nvme_cq *cq)
+{
+	if (cq->pub.head_ptr != cq->scan_head ||
+		cq->pub.pbit_new_entry != cq->scan_phase)
+		return 0;
+
+	return cq->nr_ready;
+}
+
 /**
  * @brief Try to inquire the number of cmd in the CQ that are waiting
  *  to be reaped for any given q_id.
+ *
+ * @note The ready entries confirmed by the last call are not scanned again,
+ *  only the entries after the confirmed tail are inspected and synced for
+ *  CPU.
  */
 u32 dnvme_get_cqe_remain(struct nvme_cq *cq, struct device *dev)
 {
 	struct nvme_device *ndev = cq->ndev;
-	struct nvme_prps *prps = cq->prps;
-	struct nvme_completion *entry;
-	void *cq_addr;
-	u32 remain = 0;
+	u32 remain = dnvme_cqe_confirmed(cq);
 	u8 phase = cq->pub.pbit_new_entry;
 
-	if (cq->contig) {
-		cq_addr = cq->buf;
-	} else {
-		dma_sync_sg_for_cpu(dev, prps->sg, prps->num_map_pgs, 
-			prps->data_dir);
-		cq_addr = prps->buf;
+	/* Start from the confirmed tail and update till phase bit incorrect */
+	cq->pub.tail_ptr = cq->pub.head_ptr + remain;
+	if (cq->pub.tail_ptr >= cq->pub.elements) {
+		phase ^= 1;
+		cq->pub.tail_ptr -= cq->pub.elements;
 	}
-
-	/* Start from head ptr and update till phase bit incorrect */
-	cq->pub.tail_ptr = cq->pub.head_ptr;
-	entry = (struct nvme_completion *)cq_addr + cq->pub.tail_ptr;
+	dnvme_sync_cq_entry(cq, cq->pub.tail_ptr);
 
 	/* loop through the entries in the cq */
-	while (NVME_CQE_STATUS_TO_PHASE(entry->status) == phase) {
+	while (NVME_CQE_STATUS_TO_PHASE(dnvme_cqe_status(cq, 
+		cq->pub.tail_ptr)) == phase) {
 
 		remain++;
 		cq->pub.tail_ptr++;
@@ -554,9 +737,13 @@ u32 dnvme_get_cqe_remain(struct nvme_cq *cq, struct device *dev)
 			phase ^= 1;
 			cq->pub.tail_ptr = 0;
 		}
-		entry = (struct nvme_completion *)cq_addr + cq->pub.tail_ptr;
+		dnvme_sync_cq_entry(cq, cq->pub.tail_ptr);
 	}
 
+	cq->scan_head = cq->pub.head_ptr;
+	cq->scan_phase = cq->pub.pbit_new_entry;
+	cq->nr_ready = remain;
+
 	dnvme_vdbg(ndev, "Inquiry CQ(%u) element:%u, head:%u, tail:%u, remain:%u\n",
 		cq->pub.q_id, cq->pub.elements, cq->pub.head_ptr,
 		cq->pub.tail_ptr, remain);
@@ -564,6 +751,224 @@ u32 dnvme_get_cqe_remain(struct nvme_cq *cq, struct device *dev)
 }
 
 
+/**
+ * @brief Check whether there are CQ entries waiting to be reaped.
+ *
+ * @note Unlike dnvme_get_cqe_remain(), CQ isn't updated here. So it's allowed
+ *  to peek at the CQ without holding its lock, the result is advisory only.
+ */
+bool dnvme_cqe_is_pending(struct nvme_cq *cq)
+{
+	u16 head = READ_ONCE(cq->pub.head_ptr);
+	u8 phase = READ_ONCE(cq->pub.pbit_new_entry);
+
+	dnvme_sync_cq_entry(cq, head);
+	return NVME_CQE_STATUS_TO_PHASE(dnvme_cqe_status(cq, head)) == phase;
+}
+
+/**
+ * @brief Spin on the phase tag until there are at least @expect CQ entries.
+ *
+ * @param hybrid Sleep for half of the average latency before spinning. The
+ *  latency is measured from the start of waiting to the entries are ready.
+ * @return The number of CQ entries remained on success, otherwise a negative
+ *  errno.
+ */
+static int dnvme_spin_cqe(struct nvme_cq *cq, u32 expect, ktime_t deadline,
+	bool hybrid)
+{
+	struct device *dev = &cq->ndev->pdev->dev;
+	ktime_t start = ktime_get();
+	ktime_t slp;
+	u64 lat;
+	u32 remain;
+
+	remain = dnvme_get_cqe_remain(cq, dev);
+	if (remain >= expect)
+		return remain;
+
+	if (hybrid && cq->poll_lat) {
+		slp = ns_to_ktime(cq->poll_lat >> 1);
+		if (ktime_after(ktime_add(start, slp), deadline))
+			slp = ktime_sub(deadline, start);
+
+		if (ktime_to_ns(slp) > 0) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			schedule_hrtimeout(&slp, HRTIMER_MODE_REL);
+		}
+	}
+
+	for (;;) {
+		remain = dnvme_get_cqe_remain(cq, dev);
+		if (remain >= expect)
+			break;
+
+		if (ktime_after(ktime_get(), deadline))
+			return remain;
+
+		if (signal_pending(current))
+			return -EINTR;
+
+		cond_resched();
+		cpu_relax();
+	}
+
+	if (hybrid) {
+		/* exponentially weighted moving average, weight is 1/8 */
+		lat = ktime_to_ns(ktime_sub(ktime_get(), start));
+		cq->poll_lat = cq->poll_lat ? 
+			(cq->poll_lat * 7 + lat) >> 3 : lat;
+	}
+
+	return remain;
+}
+
+/**
+ * @brief Wait until there are at least @expect CQ entries to be reaped, the
+ *  caller shall hold CQ lock.
+ *
+ * @param timeout Maximum time to wait, in milliseconds.
+ * @return The number of CQ entries remained on success, otherwise a negative
+ *  errno.
+ * @note In default poll mode, if irq is enabled, sleep until the irq of CQ
+ *  fires. Once it fires, the irq is masked until CQ is reaped empty, so poll
+ *  for the rest entries. If irq is disabled, poll in short interval all the
+ *  time.
+ */
+int dnvme_wait_cqe(struct nvme_cq *cq, u32 expect, int timeout)
+{
+	struct nvme_device *ndev = cq->ndev;
+	struct device *dev = &ndev->pdev->dev;
+	ktime_t deadline = ktime_add_ms(ktime_get(), timeout);
+	bool use_irq = ndev->irq_set.irq_type != NVME_INT_NONE && 
+		cq->pub.irq_enabled;
+	s64 left;
+	u32 remain;
+	int ret;
+
+	switch (cq->pub.poll_mode) {
+	case NVME_CQ_POLL_BUSY:
+		return dnvme_spin_cqe(cq, expect, deadline, false);
+	case NVME_CQ_POLL_HYBRID:
+		return dnvme_spin_cqe(cq, expect, deadline, true);
+	}
+
+	for (;;) {
+		remain = dnvme_get_cqe_remain(cq, dev);
+		if (remain >= expect)
+			break;
+
+		left = ktime_to_us(ktime_sub(deadline, ktime_get()));
+		if (left <= 0)
+			break;
+
+		if (use_irq && !remain) {
+			/*
+			 * The irq vector may be masked by the other CQ which
+			 * shares it, don't sleep longer than 1ms at a time.
+			 */
+			ret = wait_event_interruptible_timeout(cq->wait, 
+				dnvme_cqe_is_pending(cq), 
+				usecs_to_jiffies(min_t(s64, left, USEC_PER_MSEC)));
+			if (ret < 0)
+				return ret;
+		} else {
+			usleep_range(DNVME_CQE_POLL_MIN_US, DNVME_CQE_POLL_MAX_US);
+		}
+	}
+
+	return remain;
+}
+
+/**
+ * @brief Find the CQ to reap and lock it, the device is locked for the
+ *  queue as well.
+ *
+ * @return The CQ on success, otherwise an ERR_PTR and nothing is locked.
+ */
+static struct nvme_cq *dnvme_lock_cq_for_reap(struct nvme_device *ndev, 
+	u16 cqid)
+{
+	struct nvme_cq *cq;
+
+	dnvme_lock_device_for_queue(ndev, cqid);
+
+	cq = dnvme_find_cq(ndev, cqid);
+	if (!cq) {
+		dnvme_err(ndev, "CQ(%u) doesn't exist!\n", cqid);
+		dnvme_unlock_device_for_queue(ndev, cqid);
+		return ERR_PTR(-EBADSLT);
+	}
+
+	if (cq->user_own) {
+		dnvme_err(ndev, "CQ(%u) is owned by user!\n", cqid);
+		dnvme_unlock_device_for_queue(ndev, cqid);
+		return ERR_PTR(-EPERM);
+	}
+
+	mutex_lock(&cq->lock);
+	return cq;
+}
+
+void dnvme_unlock_cq_for_reap(struct nvme_device *ndev, struct nvme_cq *cq)
+{
+	u16 cqid = cq->pub.q_id;
+
+	mutex_unlock(&cq->lock);
+	dnvme_unlock_device_for_queue(ndev, cqid);
+}
+
+/**
+ * @brief Lock the CQ and wait until there are at least @expect CQ entries.
+ *
+ * @param timeout Maximum time to wait, in milliseconds. Negative value
+ *  waits forever, which is only allowed in default poll mode.
+ * @param pcq Return the CQ locked as dnvme_lock_cq_for_reap() does, the
+ *  caller shall unlock it by dnvme_unlock_cq_for_reap(). It's NULL if the
+ *  CQ can't be locked.
+ * @return The number of CQ entries remained on success, otherwise a negative
+ *  errno.
+ * @note Busy and hybrid poll modes spin in slices, the locks are dropped
+ *  between slices so that the other users of device aren't starved.
+ */
+int dnvme_lock_wait_cqe(struct nvme_device *ndev, u16 cqid, u32 expect, 
+	int timeout, struct nvme_cq **pcq)
+{
+	ktime_t deadline = ktime_add_ms(ktime_get(), max(timeout, 0));
+	struct nvme_cq *cq;
+	s64 left;
+	int slice;
+	int ret;
+
+	for (;;) {
+		cq = dnvme_lock_cq_for_reap(ndev, cqid);
+		if (IS_ERR(cq)) {
+			*pcq = NULL;
+			return PTR_ERR(cq);
+		}
+		*pcq = cq;
+
+		if (cq->pub.poll_mode == NVME_CQ_POLL_DEFAULT)
+			return dnvme_wait_cqe(cq, expect, 
+				timeout < 0 ? S32_MAX : timeout);
+
+		if (timeout < 0) {
+			dnvme_err(ndev, "CQ(%u) can't spin without timeout!\n", 
+				cqid);
+			return -EINVAL;
+		}
+
+		left = ktime_ms_delta(deadline, ktime_get());
+		slice = clamp_t(s64, left, 0, DNVME_CQE_SPIN_SLICE_MS);
+		ret = dnvme_wait_cqe(cq, expect, slice);
+		if (ret < 0 || ret >= expect || left <= slice)
+			return ret;
+
+		dnvme_unlock_cq_for_reap(ndev, cq);
+		cond_resched();
+	}
+}
+
 /**
  * @brief Inquire the number of CQ entries that are waiting to be reaped.
  */
@@ -571,19 +976,35 @@ int dnvme_inquiry_cqe(struct nvme_device *ndev, struct nvme_inquiry __user *uinq
 {
 	struct nvme_cq *cq;
 	struct nvme_inquiry inquiry;
+	u32 elements;
 
 	if (copy_from_user(&inquiry, uinq, sizeof(inquiry))) {
 		dnvme_err(ndev, "failed to copy from user space!\n");
 		return -EFAULT;
 	}
 
+	dnvme_lock_device_for_queue(ndev, inquiry.cqid);
+
 	cq = dnvme_find_cq(ndev, inquiry.cqid);
 	if (!cq) {
 		dnvme_err(ndev, "CQ(%u) doesn't exist!\n", inquiry.cqid);
+		dnvme_unlock_device_for_queue(ndev, inquiry.cqid);
 		return -EINVAL;
 	}
 
+	if (cq->user_own) {
+		dnvme_err(ndev, "CQ(%u) is owned by user!\n", inquiry.cqid);
+		dnvme_unlock_device_for_queue(ndev, inquiry.cqid);
+		return -EPERM;
+	}
+
+	mutex_lock(&cq->lock);
 	inquiry.nr_cqe = dnvme_get_cqe_remain(cq, &ndev->pdev->dev);
+	/* CQ may be deleted once the device is unlocked */
+	elements = cq->pub.elements;
+	mutex_unlock(&cq->lock);
+
+	dnvme_unlock_device_for_queue(ndev, inquiry.cqid);
 
 	if (copy_to_user(uinq, &inquiry, sizeof(inquiry))) {
 		dnvme_err(ndev, "failed to copy to user space!\n");
@@ -591,7 +1012,7 @@ int dnvme_inquiry_cqe(struct nvme_device *ndev, struct nvme_inquiry __user *uinq
 	}
 
 	/* Check for hw violation of full Q definition */
-	if (inquiry.nr_cqe >= cq->pub.elements) {
+	if (inquiry.nr_cqe >= elements) {
 		dnvme_err(ndev, "HW violating full Q definition!\n");
 		return -EPERM;
 	}
@@ -599,6 +1020,87 @@ int dnvme_inquiry_cqe(struct nvme_device *ndev, struct nvme_inquiry __user *uinq
 	return 0;
 }
 
+/**
+ * @brief Select the CQs watched by poll(), the caller shall lock the device.
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_set_poll_cq(struct nvme_device *ndev, struct nvme_poll_cq __user *upoll)
+{
+	struct nvme_poll_cq poll;
+	struct nvme_cq *cq;
+	unsigned long idx;
+	u16 *cqid = NULL;
+	int ret = 0;
+	u32 i;
+
+	if (copy_from_user(&poll, upoll, sizeof(poll))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	if (poll.nr_cq) {
+		if (!poll.cqid) {
+			dnvme_err(ndev, "CQ ID array is NULL!\n");
+			return -EINVAL;
+		}
+
+		cqid = memdup_user(poll.cqid, poll.nr_cq * sizeof(*cqid));
+		if (IS_ERR(cqid)) {
+			dnvme_err(ndev, "failed to copy from user space!\n");
+			return PTR_ERR(cqid);
+		}
+	}
+
+	for (i = 0; i < poll.nr_cq; i++) {
+		cq = dnvme_find_cq(ndev, cqid[i]);
+		if (!cq) {
+			dnvme_err(ndev, "CQ(%u) doesn't exist!\n", cqid[i]);
+			ret = -EBADSLT;
+			goto out;
+		}
+
+		if (cq->user_own) {
+			dnvme_err(ndev, "CQ(%u) is owned by user!\n", cqid[i]);
+			ret = -EPERM;
+			goto out;
+		}
+	}
+
+	xa_for_each_marked(&ndev->cqs, idx, cq, DNVME_CQ_POLL_MARK)
+		xa_clear_mark(&ndev->cqs, idx, DNVME_CQ_POLL_MARK);
+
+	for (i = 0; i < poll.nr_cq; i++)
+		xa_set_mark(&ndev->cqs, cqid[i], DNVME_CQ_POLL_MARK);
+out:
+	kfree(cqid);
+	return ret;
+}
+
+/**
+ * @brief Check whether any CQ selected for poll has entries to reap.
+ */
+__poll_t dnvme_poll_cqe(struct nvme_device *ndev, struct file *filp,
+	poll_table *wait)
+{
+	struct nvme_cq *cq;
+	unsigned long idx;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &ndev->poll_wait, wait);
+
+	down_read(&ndev->queue_sem);
+	xa_for_each_marked(&ndev->cqs, idx, cq, DNVME_CQ_POLL_MARK) {
+		if (cq->created && dnvme_cqe_is_pending(cq)) {
+			mask |= EPOLLIN | EPOLLRDNORM;
+			break;
+		}
+	}
+	up_read(&ndev->queue_sem);
+
+	return mask;
+}
+
 /**
  * @brief Handle create/delete IO queue command completion 
  */
@@ -627,7 +1129,7 @@ static int handle_queue_cmd_completion(struct nvme_sq *sq, struct nvme_cmd *cmd,
 	}
 
 del_cmd:
-	dnvme_delete_cmd(cmd);
+	dnvme_delete_cmd(sq, cmd);
 	return ret;
 }
 
@@ -638,7 +1140,7 @@ static int handle_gen_cmd_completion(struct nvme_sq *sq, struct nvme_cmd *node)
 {
 	dnvme_release_prps(sq->ndev, node->prps);
 	node->prps = NULL;
-	dnvme_delete_cmd(node);
+	dnvme_delete_cmd(sq, node);
 	return 0;
 }
 
@@ -663,6 +1165,11 @@ static int handle_admin_cmd_completion(struct nvme_sq *sq, struct nvme_cmd *cmd,
 	case nvme_admin_create_cq:
 		ret = handle_queue_cmd_completion(sq, cmd, NVME_CQ, (status != 0));
 		break;
+	case nvme_admin_dbbuf:
+		if (!status)
+			dnvme_dbbuf_activate(sq->ndev);
+		ret = handle_gen_cmd_completion(sq, cmd);
+		break;
 	default:
 		ret = handle_gen_cmd_completion(sq, cmd);
 		break;
@@ -672,10 +1179,13 @@ static int handle_admin_cmd_completion(struct nvme_sq *sq, struct nvme_cmd *cmd,
 
 /**
  * @brief Handle all command completion which include admin & IO command etc.
+ *
+ * @note The caller shall hold CQ lock, and SQ lock is taken here.
  */
-static int handle_cmd_completion(struct nvme_device *ndev, 
+static int handle_cmd_completion(struct nvme_cq *cq, 
 	struct nvme_completion *cq_entry)
 {
+	struct nvme_device *ndev = cq->ndev;
 	struct nvme_sq *sq;
 	struct nvme_cmd *cmd;
 	u16 status;
@@ -689,35 +1199,71 @@ static int handle_cmd_completion(struct nvme_device *ndev,
 		return -EBADSLT;
 	}
 
+	/* 
+	 * Admin commands are only handled with device locked exclusively,
+	 * don't let a bogus entry in I/O CQ touch the other SQ.
+	 */
+	if (sq->pub.cq_id != cq->pub.q_id) {
+		dnvme_err(ndev, "SQ(%u) isn't associated with CQ(%u)!\n",
+			cq_entry->sq_id, cq->pub.q_id);
+		return -EBADSLT;
+	}
+
+	mutex_lock(&sq->lock);
+
 	/* update SQ info */
 	sq->pub.head_ptr = cq_entry->sq_head;
 	status = (NVME_CQE_STATUS_TO_STATE(cq_entry->status) & 0x7ff);
 
+	/* commands in user owned SQ are not tracked by driver */
+	if (sq->user_own)
+		goto out;
+
 	cmd = dnvme_find_cmd(sq, cq_entry->command_id);
 	if (!cmd) {
 		dnvme_err(ndev, "CMD(%u) doesn't exist in SQ(%u)!\n",
 			cq_entry->command_id, cq_entry->sq_id);
-		return -EBADSLT;
+		ret = -EBADSLT;
+		goto out;
 	}
 
+	dnvme_lat_record(sq, cmd);
+
+	if (cmd->ioucmd)
+		dnvme_uring_cmd_end(ndev, cmd, 
+			NVME_CQE_STATUS_TO_STATE(cq_entry->status),
+			le64_to_cpu(cq_entry->result.u64));
+
 	if (cq_entry->sq_id == NVME_AQ_ID) {
 		ret = handle_admin_cmd_completion(sq, cmd, status);
 	} else {
 		ret = handle_gen_cmd_completion(sq, cmd);
 	}
-
+out:
+	mutex_unlock(&sq->lock);
 	return ret;
 }
 
 /**
  * @brief Copy the cq data to user buffer for the elements reaped.
+ *
+ * @param nr_reap The number of entries expected to reap, and return the
+ *  number of entries which are not reaped.
+ * @note The ready entries are copied to user buffer at once (twice if the
+ *  queue wraps), then only the commands of entries copied are completed.
+ *  So the entries left in CQ are never completed twice.
  */
 static int copy_cq_data(struct nvme_cq *cq, u32 *nr_reap, u8 __user *buffer)
 {
 	struct nvme_device *ndev = cq->ndev;
-	void *cq_head;
 	void *cq_base;
 	u32 cqes = 1 << cq->pub.cqes;
+	u32 head = cq->pub.head_ptr;
+	u32 nr_done = 0;
+	u32 nr_first, nr_copied;
+	unsigned long len, left;
+	void *bounce = NULL;
+	void *entry;
 	int latentErr = 0;
 
 	if (cq->contig)
@@ -725,31 +1271,47 @@ static int copy_cq_data(struct nvme_cq *cq, u32 *nr_reap, u8 __user *buffer)
 	else
 		cq_base = cq->prps->buf;
 
-	cq_head = cq_base + ((u32)cq->pub.head_ptr << cq->pub.cqes);
+	/* Copy to user first; the entries not copied stay in CQ */
+	nr_first = min_t(u32, *nr_reap, cq->pub.elements - head);
+	len = (unsigned long)nr_first << cq->pub.cqes;
 
-	while (*nr_reap) {
-		dnvme_vdbg(ndev, "Reaping CE's, %d left to reap", *nr_reap);
-
-		/* Call the process reap algos based on CE entry */
-		latentErr = handle_cmd_completion(ndev, cq_head);
-		if (latentErr) {
-			dnvme_err(ndev, "Unable to find CE.SQ_id in dnvme metrics");
+	if (cq->use_cmb) {
+		/* copy_to_user() can't read I/O memory, bounce CQ in CMB */
+		bounce = kvmalloc((size_t)*nr_reap << cq->pub.cqes, GFP_KERNEL);
+		if (!bounce) {
+			dnvme_err(ndev, "failed to alloc bounce buffer!\n");
+			return -ENOMEM;
 		}
-
-		/* Copy to user even on err; allows seeing latent err */
-		if (copy_to_user(buffer, cq_head, cqes)) {
-			dnvme_err(ndev, "Unable to copy request data to user space");
-			return -EFAULT;
+		memcpy_fromio(bounce, 
+			(void __iomem *)(cq_base + (head << cq->pub.cqes)), len);
+		memcpy_fromio(bounce + len, (void __iomem *)cq_base, 
+			(size_t)(*nr_reap - nr_first) << cq->pub.cqes);
+
+		len = (unsigned long)*nr_reap << cq->pub.cqes;
+		left = copy_to_user(buffer, bounce, len);
+		nr_copied = (len - left) / cqes;
+	} else {
+		left = copy_to_user(buffer, cq_base + (head << cq->pub.cqes), len);
+		if (!left && *nr_reap > nr_first) {
+			len = (unsigned long)(*nr_reap - nr_first) << cq->pub.cqes;
+			left = copy_to_user(buffer + 
+				((unsigned long)nr_first << cq->pub.cqes), cq_base, len);
+			nr_copied = nr_first + (len - left) / cqes;
+		} else {
+			nr_copied = (len - left) / cqes;
 		}
+	}
 
-		cq_head += cqes;     /* Point to next CE entry */
-		buffer += cqes;          /* Prepare for next element */
-		*nr_reap -= 1;              /* decrease for the one reaped. */
+	while (nr_done < nr_copied) {
+		if (bounce)
+			entry = bounce + (nr_done << cq->pub.cqes);
+		else
+			entry = cq_base + (((head + nr_done) % cq->pub.elements) << 
+				cq->pub.cqes);
 
-		if (cq_head >= (cq_base + cq->size)) {
-			/* Q wrapped so point to base again */
-			cq_head = cq_base;
-		}
+		/* Call the process reap algos based on CE entry */
+		latentErr = handle_cmd_completion(cq, entry);
+		nr_done++;
 
 		if (latentErr) {
 			/* Latent errors were introduced to allow reaping CE's to user
@@ -759,10 +1321,24 @@ static int copy_cq_data(struct nvme_cq *cq, u32 *nr_reap, u8 __user *buffer)
 			 * entire IOCTL should error, but we successfully reaped some CE's
 			 * which allows tnvme to inspect and trust the copied CE's for debug
 			 */
-			dnvme_err(ndev, "Detected a partial reap situation; some, not all reaped");
-			return latentErr;
+			dnvme_err(ndev, "Unable to find CE.SQ_id in dnvme metrics");
+			break;
 		}
 	}
+	dnvme_vdbg(ndev, "Reaping CE's, %u copied, %u completed", nr_copied, 
+		nr_done);
+	kvfree(bounce);
+
+	*nr_reap -= nr_done;
+	if (left) {
+		dnvme_err(ndev, "Unable to copy request data to user space");
+		return -EFAULT;
+	}
+
+	if (latentErr) {
+		dnvme_err(ndev, "Detected a partial reap situation; some, not all reaped");
+		return latentErr;
+	}
 
 	return 0;
 }
@@ -775,6 +1351,7 @@ static void update_cq_head(struct nvme_cq *cq, u32 num_reaped)
 {
 	struct nvme_device *ndev = cq->ndev;
 	u32 head = cq->pub.head_ptr;
+	u32 ready = dnvme_cqe_confirmed(cq);
 
 	head += num_reaped;
 	if (head >= cq->pub.elements) {
@@ -782,13 +1359,22 @@ static void update_cq_head(struct nvme_cq *cq, u32 num_reaped)
 		head = head % cq->pub.elements;
 	}
 
+	trace_dnvme_cq_doorbell(ndev, cq->pub.q_id, cq->pub.head_ptr, head);
 	cq->pub.head_ptr = (u16)head;
-	dnvme_writel(cq->db, 0, cq->pub.head_ptr);
+	dnvme_write_cq_db(cq, cq->pub.head_ptr);
+
+	/* the confirmed entries which are not reaped stay ready */
+	cq->nr_ready = ready > num_reaped ? ready - num_reaped : 0;
+	cq->scan_head = cq->pub.head_ptr;
+	cq->scan_phase = cq->pub.pbit_new_entry;
 
 	dnvme_vdbg(ndev, "CQ(%u) head:%u, tail:%u\n", cq->pub.q_id, 
 		cq->pub.head_ptr, cq->pub.tail_ptr);
 }
 
+/**
+ * @brief Reap CQ entries, the caller shall hold CQ lock.
+ */
 int dnvme_reap_cqe(struct nvme_cq *cq, u32 expect, void __user *buf, u32 size)
 {
 	struct nvme_device *ndev = cq->ndev;
@@ -813,12 +1399,14 @@ int dnvme_reap_cqe(struct nvme_cq *cq, u32 expect, void __user *buf, u32 size)
 	}
 
 	actual = expect;
+	trace_dnvme_reap_start(ndev, cq->pub.q_id, cq->pub.head_ptr, expect);
 
 	ret = copy_cq_data(cq, &actual, buf);
 
 	reaped = expect - actual;
 	if (reaped)
 		update_cq_head(cq, reaped);
+	trace_dnvme_reap_end(ndev, cq->pub.q_id, cq->pub.head_ptr, reaped);
 
 	remain = dnvme_get_cqe_remain(cq, &pdev->dev);
 	if (irq_type != NVME_INT_NONE && cq->pub.irq_enabled == 1 && remain == 0) {
@@ -832,6 +1420,125 @@ int dnvme_reap_cqe(struct nvme_cq *cq, u32 expect, void __user *buf, u32 size)
 	return reaped;
 }
 
+/**
+ * @brief Reap CQ entries of the commands submitted by io_uring, stop at the
+ *  first entry which isn't, so that it's left to be reaped by user.
+ *
+ * @note The caller shall hold CQ lock.
+ *
+ * @return The number of entries reaped.
+ */
+u32 dnvme_reap_uring_cqe(struct nvme_cq *cq)
+{
+	struct nvme_device *ndev = cq->ndev;
+	struct pci_dev *pdev = ndev->pdev;
+	enum nvme_irq_type irq_type = ndev->irq_set.irq_type;
+	struct nvme_completion *entry;
+	struct nvme_completion cqe;
+	struct nvme_cmd *cmd;
+	struct nvme_sq *sq;
+	u32 head = cq->pub.head_ptr;
+	u32 reaped = 0;
+	u8 phase = cq->pub.pbit_new_entry;
+	bool uring;
+
+	trace_dnvme_reap_start(ndev, cq->pub.q_id, head, 0);
+
+	for (;;) {
+		dnvme_sync_cq_entry(cq, head);
+		if (NVME_CQE_STATUS_TO_PHASE(dnvme_cqe_status(cq, head)) != phase)
+			break;
+		dma_rmb();
+
+		if (cq->use_cmb) {
+			dnvme_cqe_copy(cq, head, &cqe);
+			entry = &cqe;
+		} else {
+			entry = dnvme_cq_entry(cq, head);
+		}
+
+		sq = dnvme_find_sq(ndev, entry->sq_id);
+		if (!sq || sq->pub.cq_id != cq->pub.q_id)
+			break;
+
+		mutex_lock(&sq->lock);
+		cmd = sq->user_own ? NULL : dnvme_find_cmd(sq, entry->command_id);
+		uring = cmd && cmd->ioucmd;
+		mutex_unlock(&sq->lock);
+		if (!uring)
+			break;
+
+		handle_cmd_completion(cq, entry);
+		reaped++;
+
+		if (++head >= cq->pub.elements) {
+			head = 0;
+			phase ^= 1;
+		}
+	}
+
+	if (!reaped)
+		goto out;
+
+	update_cq_head(cq, reaped);
+
+	if (irq_type != NVME_INT_NONE && cq->pub.irq_enabled == 1 && 
+		!dnvme_get_cqe_remain(cq, &pdev->dev)) {
+		if (dnvme_reset_isr_flag(ndev, cq->pub.irq_no) < 0)
+			dnvme_warn(ndev, "reset isr fired flag failed\n");
+
+		dnvme_unmask_interrupt(&ndev->irq_set, cq->pub.irq_no);
+	}
+out:
+	trace_dnvme_reap_end(ndev, cq->pub.q_id, cq->pub.head_ptr, reaped);
+	return reaped;
+}
+
+/**
+ * @brief Wait for CQ entries and reap them.
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+int dnvme_reap_cqe_wait(struct nvme_device *ndev, 
+	struct nvme_reap_wait __user *ureap)
+{
+	struct nvme_reap_wait reap;
+	struct nvme_cq *cq;
+	int ret;
+
+	if (copy_from_user(&reap, ureap, sizeof(reap))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	ret = dnvme_lock_wait_cqe(ndev, reap.cqid, reap.expect, reap.timeout, 
+		&cq);
+	if (!cq)
+		return ret;
+	if (ret < 0)
+		goto out;
+	if (!ret) {
+		ret = -ETIMEDOUT;
+		goto out;
+	}
+
+	ret = dnvme_reap_cqe(cq, min_t(u32, ret, reap.expect), reap.buf, 
+		reap.size);
+	if (ret < 0)
+		goto out;
+
+	reap.reaped = ret;
+	ret = 0;
+out:
+	dnvme_unlock_cq_for_reap(ndev, cq);
+
+	if (!ret && copy_to_user(ureap, &reap, sizeof(reap))) {
+		dnvme_err(ndev, "failed to copy to user space!\n");
+		return -EFAULT;
+	}
+	return ret;
+}
+
 /* !TODO: obsolete */
 int dnvme_reap_cqe_legacy(struct nvme_device *ndev, struct nvme_reap __user *ureap)
 {
@@ -847,13 +1554,24 @@ int dnvme_reap_cqe_legacy(struct nvme_device *ndev, struct nvme_reap __user *ure
 		return -EFAULT;
 	}
 
+	dnvme_lock_device_for_queue(ndev, reap.cqid);
+
 	cq = dnvme_find_cq(ndev, reap.cqid);
 	if (!cq) {
 		dnvme_err(ndev, "CQ(%u) doesn't exist!\n", reap.cqid);
-		return -EBADSLT;
+		ret = -EBADSLT;
+		goto out;
+	}
+
+	if (cq->user_own) {
+		dnvme_err(ndev, "CQ(%u) is owned by user!\n", reap.cqid);
+		ret = -EPERM;
+		goto out;
 	}
 	cqes = 1 << cq->pub.cqes;
 
+	mutex_lock(&cq->lock);
+
 	/* calculate the number of CQ entries that the user expects to reap */
 	if (reap.expect)
 		expect = min_t(u32, reap.expect, reap.size >> cq->pub.cqes);
@@ -863,12 +1581,14 @@ int dnvme_reap_cqe_legacy(struct nvme_device *ndev, struct nvme_reap __user *ure
 	remain = dnvme_get_cqe_remain(cq, &pdev->dev);
 	if (remain >= cq->pub.elements) {
 		dnvme_err(ndev, "HW violating full Q definition!\n");
-		return -EPERM;
+		ret = -EPERM;
+		goto out_unlock_cq;
 	}
 
 	reap.reaped = min_t(u32, expect, remain);
 	reap.remained = remain - reap.reaped;
 	actual = reap.reaped;
+	trace_dnvme_reap_start(ndev, cq->pub.q_id, cq->pub.head_ptr, actual);
 
 	ret = copy_cq_data(cq, &actual, reap.buf);
 
@@ -878,11 +1598,13 @@ int dnvme_reap_cqe_legacy(struct nvme_device *ndev, struct nvme_reap __user *ure
 	/* update data to user */
 	if (copy_to_user(ureap, &reap, sizeof(reap))) {
 		dnvme_err(ndev, "failed to copy to user space!\n");
-		return (ret == 0) ? -EFAULT : ret;
+		ret = (ret == 0) ? -EFAULT : ret;
+		goto out_unlock_cq;
 	}
 
 	if (reap.reaped)
 		update_cq_head(cq, reap.reaped);
+	trace_dnvme_reap_end(ndev, cq->pub.q_id, cq->pub.head_ptr, reap.reaped);
 
 	if (irq_type != NVME_INT_NONE && cq->pub.irq_enabled == 1 &&
 		reap.remained == 0) {
@@ -890,11 +1612,16 @@ int dnvme_reap_cqe_legacy(struct nvme_device *ndev, struct nvme_reap __user *ure
 		ret = dnvme_reset_isr_flag(ndev, cq->pub.irq_no);
 		if (ret < 0) {
 			dnvme_err(ndev, "reset isr fired flag failed\n");
-			return ret;
+			goto out_unlock_cq;
 		}
 		dnvme_unmask_interrupt(&ndev->irq_set, cq->pub.irq_no);
 	}
 
-	return 0;
+	ret = 0;
+out_unlock_cq:
+	mutex_unlock(&cq->lock);
+out:
+	dnvme_unlock_device_for_queue(ndev, reap.cqid);
+	return ret;
 }
 
@@ -12,7 +12,10 @@
 #ifndef _DNVME_QUEUE_H_
 #define _DNVME_QUEUE_H_
 
+#include <linux/poll.h>
+
 #include "core.h"
+#include "io.h"
 
 /**
  * @breif Check whether the SQ is full
@@ -68,11 +71,141 @@ static inline struct nvme_meta *dnvme_find_meta(struct nvme_device *ndev, u32 id
 	return xa_load(&ndev->meta, id);
 }
 
+/**
+ * @brief Find the registered user buffer by the given ID
+ * 
+ * @param id buffer identify
+ * @return pointer to the buffer node on success. Otherwise returns NULL.
+ */
+static inline struct nvme_ubuf *dnvme_find_ubuf(struct nvme_device *ndev, u32 id)
+{
+	return xa_load(&ndev->ubufs, id);
+}
+
+/**
+ * @brief Copy the command to the entry of contiguous SQ. SQ in CMB is mapped
+ *  write-combining, so that the entry is posted in 64-byte bursts.
+ */
+static inline void dnvme_sq_copy_cmd(struct nvme_sq *sq, u16 idx, 
+	const void *cmd)
+{
+	void *entry = sq->buf + ((u32)idx << sq->pub.sqes);
+
+	if (sq->use_cmb)
+		memcpy_toio((void __iomem *)entry, cmd, 1 << sq->pub.sqes);
+	else
+		memcpy(entry, cmd, 1 << sq->pub.sqes);
+}
+
+/**
+ * @brief Get the entry of CQ. CQ in CMB is mapped as I/O memory, so the
+ *  entry shall be accessed by dnvme_cqe_status() or dnvme_cqe_copy().
+ */
+static inline void *dnvme_cq_entry(struct nvme_cq *cq, u32 idx)
+{
+	void *base = cq->contig ? cq->buf : cq->prps->buf;
+
+	return base + (idx << cq->pub.cqes);
+}
+
+/**
+ * @brief Read the status field of CQ entry, which carries phase tag.
+ */
+static inline __le16 dnvme_cqe_status(struct nvme_cq *cq, u32 idx)
+{
+	struct nvme_completion *entry = dnvme_cq_entry(cq, idx);
+
+	if (cq->use_cmb)
+		return cpu_to_le16(readw((void __iomem *)&entry->status));
+	return READ_ONCE(entry->status);
+}
+
+/**
+ * @brief Copy the CQ entry to @cqe, so that it can be parsed as memory.
+ */
+static inline void dnvme_cqe_copy(struct nvme_cq *cq, u32 idx, 
+	struct nvme_completion *cqe)
+{
+	void *entry = dnvme_cq_entry(cq, idx);
+
+	if (cq->use_cmb)
+		memcpy_fromio(cqe, (void __iomem *)entry, sizeof(*cqe));
+	else
+		memcpy(cqe, entry, sizeof(*cqe));
+}
+
+/**
+ * @brief Check whether the doorbell write from @old to @new_idx passes the
+ *  EventIdx, see "NVMe Base Spec - Doorbell Buffer Config command".
+ */
+static inline int dnvme_dbbuf_need_event(u16 event_idx, u16 new_idx, u16 old)
+{
+	return (u16)(new_idx - event_idx - 1) < (u16)(new_idx - old);
+}
+
+/**
+ * @brief Update the shadow doorbell if there is one.
+ *
+ * @return true if doorbell register shall be written, otherwise false.
+ */
+static inline bool dnvme_dbbuf_update(u16 value, __le32 *dbbuf_db,
+	__le32 *dbbuf_ei)
+{
+	u16 old_value, event_idx;
+
+	if (!dbbuf_db)
+		return true;
+
+	/* queue entries shall be visible before the shadow doorbell */
+	wmb();
+	old_value = le32_to_cpu(*dbbuf_db);
+	*dbbuf_db = cpu_to_le32(value);
+
+	if (!dbbuf_ei)
+		return true;
+
+	/* the shadow doorbell shall be visible before EventIdx is read */
+	mb();
+	event_idx = le32_to_cpu(READ_ONCE(*dbbuf_ei));
+	return dnvme_dbbuf_need_event(event_idx, value, old_value);
+}
+
+/**
+ * @brief Write SQ tail doorbell, the register is skipped if the shadow
+ *  doorbell is enough.
+ */
+static inline void dnvme_write_sq_db(struct nvme_sq *sq, u16 tail)
+{
+	/* commands written to CMB shall leave WC buffers before doorbell */
+	if (sq->use_cmb)
+		wmb();
+
+	if (dnvme_dbbuf_update(tail, sq->dbbuf_db, sq->dbbuf_ei))
+		dnvme_writel(sq->db, 0, tail);
+}
+
+/**
+ * @brief Write CQ head doorbell, the register is skipped if the shadow
+ *  doorbell is enough.
+ */
+static inline void dnvme_write_cq_db(struct nvme_cq *cq, u16 head)
+{
+	if (dnvme_dbbuf_update(head, cq->dbbuf_db, cq->dbbuf_ei))
+		dnvme_writel(cq->db, 0, head);
+}
+
+/* Interval of polling CQ entries if irq can't be used, unit: us */
+#define DNVME_CQE_POLL_MIN_US		10
+#define DNVME_CQE_POLL_MAX_US		20
+/* Time to spin on CQ before the locks are dropped once, unit: ms */
+#define DNVME_CQE_SPIN_SLICE_MS		10
 
 int dnvme_check_qid_unique(struct nvme_device *ndev, 
 	enum nvme_queue_type type, u16 id);
 
 struct nvme_cmd *dnvme_find_cmd(struct nvme_sq *sq, u16 id);
+int dnvme_get_free_cid(struct nvme_sq *sq);
+
 struct nvme_sq *dnvme_alloc_sq(struct nvme_device *ndev, 
 	struct nvme_prep_sq *prep, u8 sqes);
 void dnvme_release_sq(struct nvme_device *ndev, struct nvme_sq *sq);
@@ -86,12 +219,28 @@ int dnvme_create_acq(struct nvme_device *ndev, u32 elements);
 
 void dnvme_delete_all_queues(struct nvme_device *ndev, enum nvme_state state);
 
+void __dnvme_ring_sq_doorbell(struct nvme_sq *sq);
 int dnvme_ring_sq_doorbell(struct nvme_device *ndev, u16 sq_id);
 
+void dnvme_sync_sq_entry(struct nvme_sq *sq, u32 idx);
+void dnvme_sync_cq_entry(struct nvme_cq *cq, u32 idx);
+
 u32 dnvme_get_cqe_remain(struct nvme_cq *cq, struct device *dev);
+bool dnvme_cqe_is_pending(struct nvme_cq *cq);
+int dnvme_wait_cqe(struct nvme_cq *cq, u32 expect, int timeout);
+void dnvme_unlock_cq_for_reap(struct nvme_device *ndev, struct nvme_cq *cq);
+int dnvme_lock_wait_cqe(struct nvme_device *ndev, u16 cqid, u32 expect, 
+	int timeout, struct nvme_cq **pcq);
 int dnvme_inquiry_cqe(struct nvme_device *ndev, struct nvme_inquiry __user *uinq);
 
+int dnvme_set_poll_cq(struct nvme_device *ndev, struct nvme_poll_cq __user *upoll);
+__poll_t dnvme_poll_cqe(struct nvme_device *ndev, struct file *filp,
+	poll_table *wait);
+
 int dnvme_reap_cqe(struct nvme_cq *cq, u32 expect, void __user *buf, u32 size);
+u32 dnvme_reap_uring_cqe(struct nvme_cq *cq);
+int dnvme_reap_cqe_wait(struct nvme_device *ndev, 
+	struct nvme_reap_wait __user *ureap);
 int dnvme_reap_cqe_legacy(struct nvme_device *ndev, struct nvme_reap __user *ureap);
 
 #endif /* !_DNVME_QUEUE_H_ */
@@ -168,7 +168,8 @@ DECLARE_EVENT_CLASS(nvme_log_cqe,
 		__field(u16, status)
 	),
 	TP_fast_assign(
-		__entry->addr_phys = virt_to_phys(cqe);
+		/* entry of CQ in CMB is copied, it has no physical address */
+		__entry->addr_phys = virt_addr_valid(cqe) ? virt_to_phys(cqe) : 0;
 		__entry->result = le64_to_cpu(cqe->result.u64);
 		__entry->sq_head = le16_to_cpu(cqe->sq_head);
 		__entry->sq_id = le16_to_cpu(cqe->sq_id);
@@ -205,6 +206,126 @@ DEFINE_EVENT(nvme_log_irq, dnvme_interrupt,
 	TP_ARGS(irq_set, vec)
 );
 
+/*
+ * The events below are on the hot path of command, they only carry the
+ * instance of device instead of the name, so that nothing is copied.
+ */
+DECLARE_EVENT_CLASS(nvme_log_db,
+	TP_PROTO(struct nvme_device *ndev, u16 qid, u16 old, u16 val),
+	TP_ARGS(ndev, qid, old, val),
+	TP_STRUCT__entry(
+		__field(int, instance)
+		__field(u16, qid)
+		__field(u16, old)
+		__field(u16, val)
+	),
+	TP_fast_assign(
+		__entry->instance = ndev->instance;
+		__entry->qid = qid;
+		__entry->old = old;
+		__entry->val = val;
+	),
+	TP_printk("nvme%d->%u: %u => %u", __entry->instance, __entry->qid,
+		__entry->old, __entry->val)
+);
+
+/* Commands between old and new tail are submitted by this doorbell */
+DEFINE_EVENT(nvme_log_db, dnvme_sq_doorbell, 
+	TP_PROTO(struct nvme_device *ndev, u16 qid, u16 old, u16 val),
+	TP_ARGS(ndev, qid, old, val)
+);
+
+DEFINE_EVENT(nvme_log_db, dnvme_cq_doorbell, 
+	TP_PROTO(struct nvme_device *ndev, u16 qid, u16 old, u16 val),
+	TP_ARGS(ndev, qid, old, val)
+);
+
+DECLARE_EVENT_CLASS(nvme_log_map_start,
+	TP_PROTO(struct nvme_device *ndev, u16 sqid, u16 cid, u32 size),
+	TP_ARGS(ndev, sqid, cid, size),
+	TP_STRUCT__entry(
+		__field(int, instance)
+		__field(u16, sqid)
+		__field(u16, cid)
+		__field(u32, size)
+	),
+	TP_fast_assign(
+		__entry->instance = ndev->instance;
+		__entry->sqid = sqid;
+		__entry->cid = cid;
+		__entry->size = size;
+	),
+	TP_printk("nvme%d->%u: cid:%04x size:%x", __entry->instance, 
+		__entry->sqid, __entry->cid, __entry->size)
+);
+
+DEFINE_EVENT(nvme_log_map_start, dnvme_map_user_page_start, 
+	TP_PROTO(struct nvme_device *ndev, u16 sqid, u16 cid, u32 size),
+	TP_ARGS(ndev, sqid, cid, size)
+);
+
+DECLARE_EVENT_CLASS(nvme_log_map_end,
+	TP_PROTO(struct nvme_device *ndev, u16 sqid, u16 cid, u32 nr_segs, 
+		int ret),
+	TP_ARGS(ndev, sqid, cid, nr_segs, ret),
+	TP_STRUCT__entry(
+		__field(int, instance)
+		__field(u16, sqid)
+		__field(u16, cid)
+		__field(u32, nr_segs)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->instance = ndev->instance;
+		__entry->sqid = sqid;
+		__entry->cid = cid;
+		__entry->nr_segs = nr_segs;
+		__entry->ret = ret;
+	),
+	TP_printk("nvme%d->%u: cid:%04x segs:%u ret:%d", __entry->instance, 
+		__entry->sqid, __entry->cid, __entry->nr_segs, __entry->ret)
+);
+
+DEFINE_EVENT(nvme_log_map_end, dnvme_map_user_page_end, 
+	TP_PROTO(struct nvme_device *ndev, u16 sqid, u16 cid, u32 nr_segs, 
+		int ret),
+	TP_ARGS(ndev, sqid, cid, nr_segs, ret)
+);
+
+/*
+ * Entries reaped between start and end are traced by handle_cmd_completion,
+ * @num is the number expected at start (0 if not limited) and the number
+ * reaped at end.
+ */
+DECLARE_EVENT_CLASS(nvme_log_reap,
+	TP_PROTO(struct nvme_device *ndev, u16 cqid, u16 head, u32 num),
+	TP_ARGS(ndev, cqid, head, num),
+	TP_STRUCT__entry(
+		__field(int, instance)
+		__field(u16, cqid)
+		__field(u16, head)
+		__field(u32, num)
+	),
+	TP_fast_assign(
+		__entry->instance = ndev->instance;
+		__entry->cqid = cqid;
+		__entry->head = head;
+		__entry->num = num;
+	),
+	TP_printk("nvme%d->%u: head:%u num:%u", __entry->instance, 
+		__entry->cqid, __entry->head, __entry->num)
+);
+
+DEFINE_EVENT(nvme_log_reap, dnvme_reap_start, 
+	TP_PROTO(struct nvme_device *ndev, u16 cqid, u16 head, u32 num),
+	TP_ARGS(ndev, cqid, head, num)
+);
+
+DEFINE_EVENT(nvme_log_reap, dnvme_reap_end, 
+	TP_PROTO(struct nvme_device *ndev, u16 cqid, u16 head, u32 num),
+	TP_ARGS(ndev, cqid, head, num)
+);
+
 #endif /* _TRACE_NVME_H */
 
 /* this part must be outside header guard */
@@ -229,6 +350,12 @@ DEFINE_EVENT(nvme_log_irq, dnvme_interrupt,
 #define trace_dnvme_interrupt(a, b)
 #define trace_dnvme_proc_write(a, b)
 #define trace_handle_cmd_completion(a)
+#define trace_dnvme_sq_doorbell(a, b, c, d)
+#define trace_dnvme_cq_doorbell(a, b, c, d)
+#define trace_dnvme_map_user_page_start(a, b, c, d)
+#define trace_dnvme_map_user_page_end(a, b, c, d, e)
+#define trace_dnvme_reap_start(a, b, c, d)
+#define trace_dnvme_reap_end(a, b, c, d)
 
 #endif /* !_DNVME_TRACE_H_ */
 
@@ -0,0 +1,305 @@
+/**
+ * @file uring.c
+ * @author yeqiang_xu <yeqiang_xu@maxio-tech.com>
+ * @brief Submit commands by io_uring passthrough.
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/uio.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+
+#include "core.h"
+#include "queue.h"
+
+#ifdef DNVME_HAS_URING_CMD
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+
+/*
+ * struct dnvme_uring_pdu - saved in the PDU area of io_uring command until
+ *  the completion is posted in task context.
+ *
+ * @ndev: The device which the command is submitted to.
+ * @cqid: CQ which the command completes in, reaped by io_uring IOPOLL.
+ */
+struct dnvme_uring_pdu {
+	struct nvme_device	*ndev;
+	u64	result;
+	int	status;
+	u16	cqid;
+};
+
+static inline struct dnvme_uring_pdu *dnvme_uring_cmd_pdu(
+	struct io_uring_cmd *ioucmd)
+{
+	return (struct dnvme_uring_pdu *)&ioucmd->pdu;
+}
+
+static inline const struct nvme_uring_cmd *dnvme_uring_sqe_cmd(
+	struct io_uring_cmd *ioucmd)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	return io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	return ioucmd->cmd;
+#endif
+}
+
+static int dnvme_uring_import_fixed(struct nvme_64b_cmd *cmd,
+	struct iov_iter *iter, struct io_uring_cmd *ioucmd,
+	unsigned int issue_flags)
+{
+	int rw = cmd->data_dir == DMA_TO_DEVICE ? ITER_SOURCE : ITER_DEST;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	return io_uring_cmd_import_fixed((u64)(uintptr_t)cmd->data_buf_ptr,
+		cmd->data_buf_size, rw, iter, ioucmd, issue_flags);
+#else
+	return io_uring_cmd_import_fixed((u64)(uintptr_t)cmd->data_buf_ptr,
+		cmd->data_buf_size, rw, iter, ioucmd);
+#endif
+}
+
+static void dnvme_uring_task_cb(struct io_uring_cmd *ioucmd,
+	unsigned int issue_flags)
+{
+	struct dnvme_uring_pdu *pdu = dnvme_uring_cmd_pdu(ioucmd);
+
+	io_uring_cmd_done(ioucmd, pdu->status, pdu->result, issue_flags);
+}
+
+/**
+ * @brief Post the completion of io_uring command, the caller shall hold
+ *  SQ lock.
+ *
+ * @param status Status field of CQ entry, or a negative errno if the command
+ *  is aborted by driver.
+ */
+void dnvme_uring_cmd_end(struct nvme_device *ndev, struct nvme_cmd *cmd,
+	int status, u64 result)
+{
+	struct io_uring_cmd *ioucmd = cmd->ioucmd;
+	struct dnvme_uring_pdu *pdu = dnvme_uring_cmd_pdu(ioucmd);
+
+	pdu->status = status;
+	pdu->result = result;
+	cmd->ioucmd = NULL;
+	atomic_dec(&ndev->nr_uring);
+
+	io_uring_cmd_complete_in_task(ioucmd, dnvme_uring_task_cb);
+}
+
+/**
+ * @brief Reap CQ entries of io_uring commands in process context.
+ *
+ * @note It's queued by the interrupt of CQ. CQs without interrupt are reaped
+ *  by io_uring IOPOLL instead, see dnvme_uring_cmd_iopoll().
+ */
+void dnvme_uring_reap_work(struct work_struct *work)
+{
+	struct nvme_cq *cq = container_of(work, struct nvme_cq, uring_work);
+	struct nvme_device *ndev = cq->ndev;
+
+	/*
+	 * Queues are being changed with device locked exclusively, which may
+	 * be waiting for this work to finish. Leave the CQ to be kicked when
+	 * the device is unlocked, see dnvme_uring_kick_deferred().
+	 */
+	if (!down_read_trylock(&ndev->queue_sem)) {
+		atomic_set(&cq->uring_defer, 1);
+		atomic_set(&ndev->uring_defer, 1);
+		smp_mb();
+		/* device may be unlocked before seeing the flag */
+		if (!down_read_trylock(&ndev->queue_sem))
+			return;
+		atomic_set(&cq->uring_defer, 0);
+	}
+
+	if (cq->created && !cq->user_own) {
+		mutex_lock(&cq->lock);
+		dnvme_reap_uring_cqe(cq);
+		mutex_unlock(&cq->lock);
+	}
+	up_read(&ndev->queue_sem);
+}
+
+/**
+ * @brief Requeue the reaping of CQs which was deferred while the device was
+ *  locked exclusively. The caller shall have unlocked the device.
+ */
+void dnvme_uring_kick_deferred(struct nvme_device *ndev)
+{
+	struct nvme_cq *cq;
+	unsigned long i;
+
+	/* fully ordered, pairs with smp_mb() in dnvme_uring_reap_work() */
+	if (!atomic_xchg(&ndev->uring_defer, 0))
+		return;
+
+	down_read(&ndev->queue_sem);
+	xa_for_each(&ndev->cqs, i, cq) {
+		if (atomic_xchg(&cq->uring_defer, 0))
+			queue_work(system_highpri_wq, &cq->uring_work);
+	}
+	up_read(&ndev->queue_sem);
+}
+
+/**
+ * @brief Reap CQ entries for io_uring which is set up with IOPOLL.
+ *
+ * @return The number of entries reaped.
+ */
+int dnvme_uring_cmd_iopoll(struct io_uring_cmd *ioucmd,
+	struct io_comp_batch *iob, unsigned int poll_flags)
+{
+	struct dnvme_uring_pdu *pdu = dnvme_uring_cmd_pdu(ioucmd);
+	struct nvme_device *ndev = pdu->ndev;
+	struct nvme_cq *cq;
+	int ret = 0;
+
+	if (!down_read_trylock(&ndev->queue_sem))
+		return 0;
+
+	cq = dnvme_find_cq(ndev, pdu->cqid);
+	if (cq && mutex_trylock(&cq->lock)) {
+		ret = dnvme_reap_uring_cqe(cq);
+		mutex_unlock(&cq->lock);
+	}
+	up_read(&ndev->queue_sem);
+	return ret;
+}
+
+/**
+ * @brief Submit the command carried by io_uring, and the completion is
+ *  posted after the CQ entry is reaped.
+ *
+ * @return -EIOCBQUEUED on success, otherwise a negative errno.
+ */
+int dnvme_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	struct nvme_device *ndev;
+	const struct nvme_uring_cmd *ucmd = dnvme_uring_sqe_cmd(ioucmd);
+	struct nvme_uring_cmd ucmd_copy;
+	struct nvme_64b_cmd cmd;
+	struct iov_iter iter;
+	struct iov_iter *piter = NULL;
+	struct dnvme_uring_pdu *pdu = dnvme_uring_cmd_pdu(ioucmd);
+	struct nvme_cmd *node;
+	struct nvme_sq *sq;
+	struct nvme_cq *cq;
+	int ret;
+
+	ndev = dnvme_find_device(iminor(file_inode(ioucmd->file)));
+	if (IS_ERR(ndev))
+		return PTR_ERR(ndev);
+
+	if (ioucmd->cmd_op != NVME_URING_CMD_SUBMIT_64B) {
+		dnvme_err(ndev, "cmd op(0x%x) is unknown!\n", ioucmd->cmd_op);
+		return -ENOTTY;
+	}
+
+	/* SQE may be changed by user, read it once */
+	ucmd_copy.cmd = READ_ONCE(ucmd->cmd);
+	ucmd_copy.ring_db = READ_ONCE(ucmd->ring_db);
+
+	if (copy_from_user(&cmd, ucmd_copy.cmd, sizeof(cmd))) {
+		dnvme_err(ndev, "failed to copy from user space!\n");
+		return -EFAULT;
+	}
+
+	if (cmd.sqid == NVME_AQ_ID) {
+		dnvme_err(ndev, "admin cmd shall be submitted by ioctl!\n");
+		return -EINVAL;
+	}
+
+	if (ioucmd->flags & IORING_URING_CMD_FIXED) {
+		if (cmd.use_reg_buf || !cmd.data_buf_ptr || !cmd.data_buf_size) {
+			dnvme_err(ndev, "fixed buffer ptr or size is invalid!\n");
+			return -EINVAL;
+		}
+
+		ret = dnvme_uring_import_fixed(&cmd, &iter, ioucmd, issue_flags);
+		if (ret < 0) {
+			dnvme_err(ndev, "failed to import fixed buffer!(%d)\n", ret);
+			return ret;
+		}
+		piter = &iter;
+	}
+
+	if (issue_flags & IO_URING_F_NONBLOCK) {
+		if (!down_read_trylock(&ndev->queue_sem))
+			return -EAGAIN;
+	} else {
+		down_read(&ndev->queue_sem);
+	}
+
+	sq = dnvme_find_sq(ndev, cmd.sqid);
+	if (!sq) {
+		dnvme_err(ndev, "SQ(%u) doesn't exist!\n", cmd.sqid);
+		ret = -EBADSLT;
+		goto out;
+	}
+
+	cq = dnvme_find_cq(ndev, sq->pub.cq_id);
+	if (!cq) {
+		dnvme_err(ndev, "CQ(%u) doesn't exist!\n", sq->pub.cq_id);
+		ret = -EBADSLT;
+		goto out;
+	}
+
+	/* nobody reaps CQ without interrupt except io_uring IOPOLL */
+	if (!(issue_flags & IO_URING_F_IOPOLL) && (!cq->pub.irq_enabled ||
+		ndev->irq_set.irq_type == NVME_INT_NONE)) {
+		dnvme_err(ndev, "CQ(%u) has no irq, set up io_uring with "
+			"IOPOLL!\n", cq->pub.q_id);
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+	pdu->ndev = ndev;
+	pdu->cqid = cq->pub.q_id;
+
+	if (issue_flags & IO_URING_F_NONBLOCK) {
+		if (!mutex_trylock(&sq->lock)) {
+			ret = -EAGAIN;
+			goto out;
+		}
+	} else {
+		mutex_lock(&sq->lock);
+	}
+
+	ret = __dnvme_submit_64b_cmd(ndev, sq, &cmd, piter);
+	if (ret < 0) {
+		mutex_unlock(&sq->lock);
+		goto out;
+	}
+
+	node = dnvme_find_cmd(sq, cmd.cid);
+	node->ioucmd = ioucmd;
+	atomic_inc(&ndev->nr_uring);
+
+	if (ucmd_copy.ring_db)
+		__dnvme_ring_sq_doorbell(sq);
+	mutex_unlock(&sq->lock);
+
+	/* the command is in flight, it's too late to fail */
+	if (put_user(cmd.cid, &ucmd_copy.cmd->cid))
+		dnvme_warn(ndev, "failed to copy to user space!\n");
+
+	ret = -EIOCBQUEUED;
+out:
+	up_read(&ndev->queue_sem);
+	return ret;
+}
+
+#endif /* DNVME_HAS_URING_CMD */